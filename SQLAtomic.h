@@ -0,0 +1,64 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLAtomic.h
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Integer shared between threads without a lock
+ */
+#ifndef SQLATOMIC_H
+#define SQLATOMIC_H
+
+#if __cplusplus >= 201103L
+#include <atomic>
+#endif
+
+/**
+ * Integer that may be read and updated by several threads at once. Loads
+ * and stores are not ordered with respect to other memory so are only
+ * suitable for counters and hints. Updates are fully ordered.
+ */
+template <class T>
+class SQLAtomic
+{
+public:
+    SQLAtomic(T v = T()) : value_(v) { ; }
+
+#if __cplusplus >= 201103L
+    T load() const { return value_.load(std::memory_order_relaxed); }
+    void store(T v) { value_.store(v, std::memory_order_relaxed); }
+
+    /** Add to the value and return the result */
+    T add(T v) { return value_.fetch_add(v) + v; }
+
+    /** Set the value to desired if it is expected and return true */
+    bool compareExchange(T expected, T desired)
+    {
+	return value_.compare_exchange_strong(expected, desired);
+    }
+#else
+    T load() const { return value_; }
+    void store(T v) { value_ = v; }
+
+    T add(T v) { return __sync_add_and_fetch(&value_, v); }
+
+    bool compareExchange(T expected, T desired)
+    {
+	return __sync_bool_compare_and_swap(&value_, expected, desired);
+    }
+#endif
+
+private:
+    SQLAtomic(const SQLAtomic &);
+    void operator=(const SQLAtomic &);
+
+#if __cplusplus >= 201103L
+    std::atomic<T> value_;
+#else
+    volatile T value_;
+#endif
+};
+
+#endif
@@ -8,12 +8,14 @@
  *
  * Description : Context pattern to map variables and functions to values
  */
-#include "math.h"
 #include "SQLContext.h"
+#include "SQLFunction.h"
+#include <limits.h>
+#include <typeinfo>
 
 // Create a context
 SQLContext::SQLContext()
-: nextInChain(0)
+: nextInChain(0), parameters(0), memo(0)
 {
 }
 
@@ -38,9 +40,24 @@ SQLContext * SQLContext::getNextInChain() const
     return nextInChain;
 }
 
+void SQLContext::setParameters(const SQLParameters *p)
+{
+    parameters = p;
+}
+
+const SQLParameters * SQLContext::getParameters() const
+{
+    return parameters;
+}
+
 SQLValue SQLContext::variableLookup(const std::string &class_name,
 				    const std::string &member_name) const
 {
+    // Contexts that only provide variables by slot
+    int slot = resolveSlot(class_name, member_name);
+    if (slot >= 0)
+	return fetchSlot(slot);
+
     if (nextInChain != 0)
 	return nextInChain->variableLookup(class_name, member_name);
     else
@@ -56,6 +73,66 @@ SQLValue SQLContext::variableLookup(const std::string &class_name,
     }
 }
 
+// The position of the context in the chain is kept in the low bits of the
+// slot
+static const int MAX_CHAIN = 16;
+
+int SQLContext::resolve(const std::string &class_name,
+			const std::string &member_name) const
+{
+    int depth = 0;
+    const SQLContext *c;
+
+    for (c = this; c != 0 && depth < MAX_CHAIN; c = c->nextInChain, depth++)
+    {
+	int slot = c->resolveSlot(class_name, member_name);
+
+	if (slot == NO_SLOT)
+	    return NO_SLOT;
+
+	if (slot >= 0)
+	    return slot < INT_MAX / MAX_CHAIN ? slot * MAX_CHAIN + depth :
+		NO_SLOT;
+    }
+
+    // Every context was asked so the variable would give an exception
+    // from variableLookup()
+    if (c == 0)
+	return UNKNOWN_VARIABLE;
+
+    return NO_SLOT;
+}
+
+SQLValue SQLContext::fetch(int slot) const
+{
+    const SQLContext *c = this;
+
+    for (int depth = slot % MAX_CHAIN; depth > 0 && c != 0; depth--)
+	c = c->nextInChain;
+
+    if (c == 0)
+	return SQLValue(new SQLExceptionValue(
+			    "Variable resolved by another context"));
+
+    return c->fetchSlot(slot / MAX_CHAIN);
+}
+
+// A plain SQLContext only passes variables on to the chain. Any other
+// class may look them up by name.
+int SQLContext::resolveSlot(const std::string &,
+			    const std::string &) const
+{
+    if (typeid(*this) == typeid(SQLContext))
+	return NEXT_IN_CHAIN;
+    else
+	return NO_SLOT;
+}
+
+SQLValue SQLContext::fetchSlot(int) const
+{
+    return SQLValue(new SQLExceptionValue("Unknown variable slot"));
+}
+
 SQLValue SQLContext::functionLookup(const std::string &class_name,
 				    const std::string &member_name,
 				    int num_args, SQLValue *args)
@@ -68,47 +145,31 @@ SQLValue SQLContext::functionLookup(const std::string &class_name,
 				     num_args, args);
 }
 
+bool SQLContext::isDefaultFunction(const std::string &class_name,
+				   const std::string &member_name,
+				   int num_args)
+{
+    const SQLFunction *f =
+	SQLFunctionRegistry::builtins().findFunction(class_name, member_name);
+
+    return f != 0 && f->isPure() && f->acceptsArguments(num_args);
+}
+
 SQLValue SQLContext::defaultFunctionLookup(const std::string &class_name,
 					   const std::string &member_name,
 					   int num_args, SQLValue *args)
 {
-    // These functions should have global scope
-    if (class_name.empty())
-    {
-	// Functions that take one argument
-	if (num_args == 1)
-	{
-	    double arg1 = args[0].asReal();
-	    double result;
-	    if (member_name == "abs")
-		result = fabs(arg1);
-	    else if (member_name == "atan")
-		result = atan(arg1);
-	    else if (member_name == "cos")
-		result = cos(arg1);
-	    else if (member_name == "exp")
-		result = exp(arg1);
-	    else if (member_name == "log")
-		result = log(arg1);
-	    else if (member_name == "sin")
-		result = sin(arg1);
-	    else if (member_name == "sqrt")
-		result = sqrt(arg1);
-	    else
-		return SQLValue(new SQLExceptionValue(
-					   "Unknown function '" +
-					   member_name + "'"));
-
-	    return SQLValue(new SQLRealValue(result));
-	}
-
-
-	return SQLValue(new SQLExceptionValue("Unknown function '" +
-					      member_name + "'"));
-    }
+    const SQLFunction *f =
+	SQLFunctionRegistry::builtins().findFunction(class_name, member_name);
+
+    if (f != 0 && f->acceptsArguments(num_args))
+	return f->call(*this, num_args, args);
+
+    std::string name;
+    if (!class_name.empty())
+	name = class_name + ".";
+    name += member_name;
 
     // Return exception is no match is possible.
-    return SQLValue(new SQLExceptionValue("Unknown function '" +
-					  class_name + "." + member_name +
-					  "'"));
+    return SQLValue(new SQLExceptionValue("Unknown function '" + name + "'"));
 }
@@ -13,6 +13,9 @@
 
 #include "SQLValue.h"
 
+class SQLParameters;
+struct SQLMemo;
+
 class SQLContext
 {
 public:
@@ -29,23 +32,88 @@ public:
 
     /**
      * Lookup the a variable optionally in a class and return its
-     * value.
+     * value. By default this returns the variables that the context
+     * provides by slot.
      */
     virtual SQLValue variableLookup(const std::string &class_name,
 				    const std::string &member_name) const;
 
+    /**
+     * Returned by resolve() for a variable that is looked up by name, and
+     * for one that no context in the chain has.
+     */
+    enum { NO_SLOT = -1, UNKNOWN_VARIABLE = -3 };
+
+    /**
+     * Resolve a variable once when an expression is parsed so that its
+     * value is fetched on each row without comparing names. The contexts
+     * in the chain are asked in turn, which flattens the chain into the
+     * slot. Returns NO_SLOT if the variable has to be looked up by name
+     * with variableLookup(), or UNKNOWN_VARIABLE if every context in the
+     * chain provides its variables by slot and none has this one.
+     */
+    int resolve(const std::string &class_name,
+		const std::string &member_name) const;
+
+    /**
+     * Return the value of a variable resolved by a context of the same
+     * class chained to contexts of the same classes as this one.
+     */
+    SQLValue fetch(int slot) const;
+
     /** Evaluate a function and return its value. */
     virtual SQLValue functionLookup(const std::string &class_name,
 				    const std::string &member_name,
 				    int num_args, SQLValue *arguments);
 
+    /**
+     * True if the function is one of the default SQL functions. These
+     * depend only on their arguments so can be evaluated when the
+     * expression is parsed.
+     */
+    static bool isDefaultFunction(const std::string &class_name,
+				  const std::string &member_name,
+				  int num_args);
+
+    /**
+     * Use a set of parameter values for expressions evaluated with this
+     * context in place of the values bound with SQLParse. This allows one
+     * expression to be evaluated with many sets of values at the same
+     * time. Use 0 for the values bound with SQLParse.
+     */
+    void setParameters(const SQLParameters *p);
+    const SQLParameters *getParameters() const;
+
+    /**
+     * Values of the common sub-expressions for the row being evaluated.
+     * This is set by SQLCommonScopeExpression.
+     */
+    void setMemo(SQLMemo *m) { memo = m; }
+    SQLMemo *getMemo() const { return memo; }
+
 protected:
+    /** Returned by resolveSlot() for a variable the context does not have */
+    enum { NEXT_IN_CHAIN = -2 };
+
+    /**
+     * Override with fetchSlot() to provide variables by slot. Return a
+     * slot of zero or more, NEXT_IN_CHAIN to ask the next context in the
+     * chain, or NO_SLOT to look the variable up by name. By default a
+     * context that overrides variableLookup() has its variables looked up
+     * by name.
+     */
+    virtual int resolveSlot(const std::string &class_name,
+			    const std::string &member_name) const;
+    virtual SQLValue fetchSlot(int slot) const;
+
     /** Evaluate some default SQL functions. */
     SQLValue defaultFunctionLookup(const std::string &class_name,
 				   const std::string &member_name,
 				   int num_args, SQLValue *arguments);
 
     SQLContext *nextInChain;
+    const SQLParameters *parameters;
+    SQLMemo *memo;
 };
 
 #endif
@@ -11,12 +11,28 @@
 #include <sys/types.h>
 #include "SQLExpression.h"
 #include "SQLContext.h"
+#include "SQLFunction.h"
+#include "SQLParameters.h"
+#include "SQLProgram.h"
+#include "SQLReferences.h"
+#include "SQLSchema.h"
+#include "SQLPool.h"
+#include "SQLPredicate.h"
 #include <assert.h>
+#include <map>
+#include <set>
+#include <typeinfo>
 #include <string.h>
+#include <ctype.h>
 #include <stdio.h>
+#include <sstream>
+#include <time.h>
+#if __cplusplus >= 201103L
+#include <chrono>
+#endif
 
-SQLValue SQLExpression::SQLTrueValue(new SQLBooleanValue(true));
-SQLValue SQLExpression::SQLFalseValue(new SQLBooleanValue(false));
+SQLValue SQLExpression::SQLTrueValue(SQLValue::makeBoolean(true));
+SQLValue SQLExpression::SQLFalseValue(SQLValue::makeBoolean(false));
 
 SQLExpression::SQLExpression()
 : refCount(0)
@@ -25,7 +41,675 @@ SQLExpression::SQLExpression()
 
 SQLExpression::~SQLExpression()
 {
-    assert(refCount == 0);
+    assert(refCount.load() == 0);
+}
+
+int SQLExpression::compile(SQLProgram &program)
+{
+    int r = program.pushRegister();
+
+    program.emit(SQLProgram::Evaluate, r, program.addNode(this));
+
+    return r;
+}
+
+SQLExpression * SQLExpression::optimise()
+{
+    return this;
+}
+
+void SQLExpression::optimiseTree(SQLExpression *&e)
+{
+    replace(e, e->optimise());
+}
+
+SQLExpression * SQLExpression::bindSchema(const SQLSchema &,
+					  std::vector<std::string> &)
+{
+    return this;
+}
+
+void SQLExpression::bindTree(SQLExpression *&e, const SQLSchema &schema,
+			     std::vector<std::string> &errors)
+{
+    replace(e, e->bindSchema(schema, errors));
+}
+
+void SQLExpression::replace(SQLExpression *&e, SQLExpression *o)
+{
+    if (o == e)
+	return;
+
+    // The new expression may be a child of e so hold it first
+    o->getRef();
+    e->releaseRef();
+    e = o;
+}
+
+SQLValueType SQLExpression::resultType() const
+{
+    return SQLOtherType;
+}
+
+bool SQLExpression::isConstant() const
+{
+    return false;
+}
+
+bool SQLExpression::canRaise() const
+{
+    return true;
+}
+
+void SQLExpression::visitChildren(SQLExpressionVisitor &)
+{
+}
+
+unsigned long SQLExpression::hash() const
+{
+    return (unsigned long)this;
+}
+
+bool SQLExpression::equals(const SQLExpression *e) const
+{
+    return e == this;
+}
+
+// FNV-1a hash of a name
+static unsigned long hashName(const std::string &s)
+{
+    unsigned long h = 2166136261UL;
+
+    for (size_t i = 0; i < s.length(); i++)
+    {
+	h ^= (unsigned char)s[i];
+	h *= 16777619UL;
+    }
+
+    return h;
+}
+
+static unsigned long hashCombine(unsigned long h, unsigned long v)
+{
+    return h ^ (v + 0x9e3779b9UL + (h << 6) + (h >> 2));
+}
+
+namespace
+{
+    // A class of equal sub-expressions
+    struct Common
+    {
+	SQLExpression *expression;
+	int count;
+	SQLCommonExpression *shared;
+    };
+
+    // Finds the sub-expressions that occur more than once and replaces
+    // them. The sub-expressions of each class are only visited the first
+    // time the class is seen, as the others will share its value.
+    class CommonFinder
+    : public SQLExpressionVisitor
+    {
+    public:
+	CommonFinder() : replacing(false), slots(0) { ; }
+
+	~CommonFinder()
+	{
+	    for (Map::iterator i = classes.begin(); i != classes.end(); ++i)
+		for (size_t j = 0; j < i->second.size(); j++)
+		    if (i->second[j].shared != 0)
+			i->second[j].shared->releaseRef();
+	}
+
+	virtual void visit(SQLExpression *&e)
+	{
+	    Common &c = find(e);
+
+	    if (!replacing)
+	    {
+		if (c.count++ == 0)
+		    e->visitChildren(*this);
+		return;
+	    }
+
+	    if (c.count < 2 || e->isConstant() ||
+		dynamic_cast<SQLParameterExpression *>(e) != 0)
+	    {
+		e->visitChildren(*this);
+		return;
+	    }
+
+	    if (c.shared == 0)
+	    {
+		if (slots == SQLCommonExpression::MAX_SLOTS)
+		{
+		    c.count = 1;
+		    e->visitChildren(*this);
+		    return;
+		}
+
+		e->visitChildren(*this);
+		c.shared = new SQLCommonExpression(e, slots++);
+		c.shared->getRef();
+	    }
+
+	    c.shared->getRef();
+	    e->releaseRef();
+	    e = c.shared;
+	}
+
+	bool replacing;
+	int slots;
+
+    private:
+	typedef std::map<unsigned long, std::vector<Common> > Map;
+	Map classes;
+
+	Common &find(SQLExpression *e)
+	{
+	    std::vector<Common> &v = classes[e->hash()];
+
+	    for (size_t i = 0; i < v.size(); i++)
+		if (v[i].expression == e || v[i].expression->equals(e))
+		    return v[i];
+
+	    Common c;
+	    c.expression = e;
+	    c.count = 0;
+	    c.shared = 0;
+	    v.push_back(c);
+
+	    return v.back();
+	}
+    };
+}
+
+namespace
+{
+    // Reset the chains below an expression whose sub-expressions have been
+    // replaced
+    class ChainResetter
+    : public SQLExpressionVisitor
+    {
+    public:
+	virtual void visit(SQLExpression *&e)
+	{
+	    e->visitChildren(*this);
+
+	    SQLLogicChainExpression *c =
+		dynamic_cast<SQLLogicChainExpression *>(e);
+	    if (c != 0)
+		c->reset();
+	}
+    };
+}
+
+namespace
+{
+    class VariableResolver
+    : public SQLExpressionVisitor
+    {
+    public:
+	VariableResolver(const SQLContext &c, std::vector<std::string> &e)
+	: context(c), errors(e) { ; }
+
+	virtual void visit(SQLExpression *&e)
+	{
+	    SQLVariableExpression *v = dynamic_cast<SQLVariableExpression *>(e);
+	    if (v != 0 && v->resolve(context) == SQLContext::UNKNOWN_VARIABLE &&
+		unknown.insert(v->name()).second)
+		errors.push_back("Unknown variable '" + v->name() + "'");
+
+	    e->visitChildren(*this);
+	}
+
+    private:
+	const SQLContext &context;
+	std::vector<std::string> &errors;
+	std::set<std::string> unknown;
+    };
+}
+
+void SQLExpression::resolveVariables(SQLExpression *e,
+				     const SQLContext &context,
+				     std::vector<std::string> &errors)
+{
+    VariableResolver resolver(context, errors);
+
+    e->getRef();
+    SQLExpression *root = e;
+    resolver.visit(root);
+    root->releaseRef();
+}
+
+namespace
+{
+    // Record each variable with the usage that its parent gives it. Common
+    // sub-expressions pass on the usage of their own parent.
+    class ReferenceFinder
+    : public SQLExpressionVisitor
+    {
+    public:
+	ReferenceFinder(SQLReferences &r)
+	: refs(r), usage(SQLVariableReference::Other) { ; }
+
+	virtual void visit(SQLExpression *&e)
+	{
+	    SQLVariableExpression *v = dynamic_cast<SQLVariableExpression *>(e);
+	    if (v != 0)
+	    {
+		refs.addVariable(v->getClassName(), v->getMemberName(), usage);
+		return;
+	    }
+
+	    SQLFunctionExpression *f = dynamic_cast<SQLFunctionExpression *>(e);
+	    if (f != 0)
+		refs.addFunction(f->name());
+
+	    int outer = usage;
+	    if (dynamic_cast<SQLCommonExpression *>(e) == 0)
+		usage = childUsage(e);
+
+	    e->visitChildren(*this);
+	    usage = outer;
+	}
+
+    private:
+	SQLReferences &refs;
+	int usage;
+
+	static int childUsage(SQLExpression *e)
+	{
+	    if (dynamic_cast<SQLEqualsExpression *>(e) != 0 ||
+		dynamic_cast<SQLNotEqualsExpression *>(e) != 0 ||
+		dynamic_cast<SQLInExpression *>(e) != 0)
+		return SQLVariableReference::Equality;
+
+	    if (dynamic_cast<SQLLessThanExpression *>(e) != 0 ||
+		dynamic_cast<SQLGreaterThanExpression *>(e) != 0 ||
+		dynamic_cast<SQLLessEqualsExpression *>(e) != 0 ||
+		dynamic_cast<SQLGreaterEqualsExpression *>(e) != 0 ||
+		dynamic_cast<SQLRangeExpression *>(e) != 0)
+		return SQLVariableReference::Range;
+
+	    if (dynamic_cast<SQLLikeExpression *>(e) != 0)
+		return SQLVariableReference::Pattern;
+
+	    SQLConstantCompareExpression *c =
+		dynamic_cast<SQLConstantCompareExpression *>(e);
+	    if (c != 0)
+	    {
+		switch (c->test())
+		{
+		case SQLProgram::Equals:
+		case SQLProgram::NotEquals:
+		    return SQLVariableReference::Equality;
+		case SQLProgram::Within:
+		    return SQLVariableReference::Other;
+		default:
+		    return SQLVariableReference::Range;
+		}
+	    }
+
+	    return SQLVariableReference::Other;
+	}
+    };
+}
+
+void SQLExpression::findReferences(SQLExpression *e, SQLReferences &refs)
+{
+    ReferenceFinder finder(refs);
+
+    e->getRef();
+    SQLExpression *root = e;
+    finder.visit(root);
+    root->releaseRef();
+}
+
+namespace
+{
+    // Replace each common sub-expression by the expression it shares
+    class CommonRemover
+    : public SQLExpressionVisitor
+    {
+    public:
+	virtual void visit(SQLExpression *&e)
+	{
+	    SQLCommonExpression *c;
+	    while ((c = dynamic_cast<SQLCommonExpression *>(e)) != 0)
+	    {
+		SQLExpression *o = c->operand();
+		o->getRef();
+		e->releaseRef();
+		e = o;
+	    }
+
+	    e->visitChildren(*this);
+	}
+    };
+
+    // A predicate that must be true for the expression to be true. The
+    // bounds of a range are separate predicates.
+    struct Conjunct
+    {
+	SQLExpression *expression;
+	SQLRangeExpression *range;
+	bool accepted;
+    };
+
+    void addConjunct(std::vector<Conjunct> &conjuncts, SQLExpression *e,
+		     SQLRangeExpression *range)
+    {
+	Conjunct c;
+	c.expression = e;
+	c.range = range;
+	c.accepted = false;
+	conjuncts.push_back(c);
+    }
+
+    void findConjuncts(SQLExpression *e, std::vector<Conjunct> &conjuncts)
+    {
+	SQLRangeExpression *r = dynamic_cast<SQLRangeExpression *>(e);
+	if (r != 0)
+	{
+	    addConjunct(conjuncts, r->lowerBound(), r);
+	    addConjunct(conjuncts, r->upperBound(), r);
+	    return;
+	}
+
+	SQLAndChainExpression *c = dynamic_cast<SQLAndChainExpression *>(e);
+	if (c != 0)
+	{
+	    for (int i = 0; i < c->numOperands(); i++)
+		findConjuncts(c->operandNumber(i), conjuncts);
+	    return;
+	}
+
+	SQLAndExpression *a = dynamic_cast<SQLAndExpression *>(e);
+	if (a != 0)
+	{
+	    findConjuncts(a->firstOperand(), conjuncts);
+	    findConjuncts(a->secondOperand(), conjuncts);
+	    return;
+	}
+
+	addConjunct(conjuncts, e, 0);
+    }
+
+    bool constantOf(SQLExpression *e, SQLValue &v)
+    {
+	SQLValueExpression *c = dynamic_cast<SQLValueExpression *>(e);
+	if (c == 0)
+	    return false;
+
+	v = c->getValue();
+	return true;
+    }
+
+    bool setVariable(SQLExpression *e, SQLPredicate &p)
+    {
+	SQLVariableExpression *v = dynamic_cast<SQLVariableExpression *>(e);
+	if (v == 0)
+	    return false;
+
+	p.className = v->getClassName();
+	p.memberName = v->getMemberName();
+	return true;
+    }
+
+    // The operator with its operands swapped
+    SQLPredicate::Operator swapped(SQLPredicate::Operator op)
+    {
+	switch (op)
+	{
+	case SQLPredicate::LessThan:
+	    return SQLPredicate::GreaterThan;
+	case SQLPredicate::GreaterThan:
+	    return SQLPredicate::LessThan;
+	case SQLPredicate::LessEquals:
+	    return SQLPredicate::GreaterEquals;
+	case SQLPredicate::GreaterEquals:
+	    return SQLPredicate::LessEquals;
+	default:
+	    return op;
+	}
+    }
+
+    bool comparisonOperator(SQLExpression *e, SQLPredicate::Operator &op)
+    {
+	if (dynamic_cast<SQLEqualsExpression *>(e) != 0)
+	    op = SQLPredicate::Equals;
+	else if (dynamic_cast<SQLNotEqualsExpression *>(e) != 0)
+	    op = SQLPredicate::NotEquals;
+	else if (dynamic_cast<SQLLessThanExpression *>(e) != 0)
+	    op = SQLPredicate::LessThan;
+	else if (dynamic_cast<SQLGreaterThanExpression *>(e) != 0)
+	    op = SQLPredicate::GreaterThan;
+	else if (dynamic_cast<SQLLessEqualsExpression *>(e) != 0)
+	    op = SQLPredicate::LessEquals;
+	else if (dynamic_cast<SQLGreaterEqualsExpression *>(e) != 0)
+	    op = SQLPredicate::GreaterEquals;
+	else if (dynamic_cast<SQLWithinExpression *>(e) != 0)
+	    op = SQLPredicate::Within;
+	else
+	    return false;
+
+	return true;
+    }
+
+    // Describe a predicate on a single variable
+    bool describePredicate(SQLExpression *e, SQLPredicate &p)
+    {
+	p.expression = e;
+	p.values.clear();
+	p.caseInsensitive = SQLStringValue::isCaseInsensitive();
+
+	SQLConstantCompareExpression *cc =
+	    dynamic_cast<SQLConstantCompareExpression *>(e);
+	if (cc != 0)
+	{
+	    // The tests are in the same order as the operators
+	    p.op = (SQLPredicate::Operator)cc->test();
+	    p.values.push_back(cc->constant());
+	    return setVariable(cc->operand(), p);
+	}
+
+	SQLBinaryExpression *b = dynamic_cast<SQLBinaryExpression *>(e);
+	if (b != 0 && comparisonOperator(e, p.op))
+	{
+	    SQLValue v;
+
+	    if (constantOf(b->secondOperand(), v) &&
+		setVariable(b->firstOperand(), p))
+	    {
+		p.values.push_back(v);
+		return true;
+	    }
+
+	    if (p.op != SQLPredicate::Within &&
+		constantOf(b->firstOperand(), v) &&
+		setVariable(b->secondOperand(), p))
+	    {
+		p.op = swapped(p.op);
+		p.values.push_back(v);
+		return true;
+	    }
+
+	    return false;
+	}
+
+	SQLInExpression *in = dynamic_cast<SQLInExpression *>(e);
+	if (in != 0)
+	{
+	    if (in->getParameter() != 0)
+		return false;
+
+	    SQLExpressionList *list = in->getList();
+	    for (int i = 0; i < list->numExpressions(); i++)
+	    {
+		SQLValue v;
+		if (!constantOf(list->expressionNumber(i), v))
+		    return false;
+		p.values.push_back(v);
+	    }
+
+	    p.op = SQLPredicate::In;
+	    return setVariable(in->operand(), p);
+	}
+
+	SQLLikeExpression *like = dynamic_cast<SQLLikeExpression *>(e);
+	if (like != 0)
+	{
+	    if (like->isRegex())
+		return false;
+
+	    p.op = SQLPredicate::Like;
+	    p.values.push_back(SQLValue::makeString(like->getPattern()));
+	    return setVariable(like->operand(), p);
+	}
+
+	SQLNullExpression *n = dynamic_cast<SQLNullExpression *>(e);
+	if (n != 0)
+	{
+	    p.op = SQLPredicate::IsNull;
+	    return setVariable(n->operand(), p);
+	}
+
+	return false;
+    }
+}
+
+void SQLExpression::pushDown(SQLExpression *&e, SQLPredicateHandler &handler)
+{
+    e->getRef();
+    SQLExpression *root = e;
+
+    // The common sub-expressions are found again in what is left
+    SQLCommonScopeExpression *scope =
+	dynamic_cast<SQLCommonScopeExpression *>(root);
+    if (scope != 0)
+	replace(root, scope->operand());
+
+    CommonRemover remover;
+    remover.visit(root);
+
+    std::vector<Conjunct> conjuncts;
+    findConjuncts(root, conjuncts);
+
+    bool accepted = false;
+
+    for (size_t i = 0; i < conjuncts.size(); i++)
+    {
+	SQLPredicate p;
+	if (describePredicate(conjuncts[i].expression, p) &&
+	    handler.accept(p))
+	    conjuncts[i].accepted = accepted = true;
+    }
+
+    // The rest of the expression, which this holds a reference to
+    SQLExpression *residual = 0;
+
+    for (size_t i = 0; i < conjuncts.size(); i++)
+    {
+	if (conjuncts[i].accepted)
+	    continue;
+
+	SQLExpression *c = conjuncts[i].expression;
+
+	// Keep a range when neither bound was accepted
+	if (conjuncts[i].range != 0 && i + 1 < conjuncts.size() &&
+	    conjuncts[i + 1].range == conjuncts[i].range &&
+	    !conjuncts[i + 1].accepted)
+	{
+	    c = conjuncts[i].range;
+	    i++;
+	}
+
+	SQLExpression *next;
+	if (residual == 0)
+	    next = c;
+	else if (residual->isPredicate() && c->isPredicate())
+	    next = new SQLAndChainExpression(residual, c);
+	else
+	    next = new SQLAndExpression(residual, c);
+
+	// A chain takes the operands of the chain it is made from
+	next->getRef();
+	if (residual != 0)
+	    residual->releaseRef();
+	residual = next;
+    }
+
+    if (residual == 0)
+    {
+	residual = new SQLValueExpression(SQLValue::makeBoolean(true));
+	residual->getRef();
+    }
+
+    if (accepted)
+	replace(root, residual);
+    residual->releaseRef();
+
+    eliminateCommon(root);
+
+    replace(e, root);
+    root->releaseRef();
+}
+
+void SQLExpression::eliminateCommon(SQLExpression *&e)
+{
+    CommonFinder finder;
+
+    // Count the occurrences of each class
+    e->getRef();
+    SQLExpression *root = e;
+    finder.visit(root);
+
+    finder.replacing = true;
+    finder.visit(root);
+
+    if (finder.slots > 0)
+	replace(root, new SQLCommonScopeExpression(root, finder.slots));
+
+    // Sub-expressions of the chain operands may have been shared
+    ChainResetter resetter;
+    resetter.visit(root);
+
+    replace(e, root);
+    root->releaseRef();
+}
+
+// Evaluate an expression of constants and return it as a value.
+// Exceptions are left to be raised when the expression is evaluated.
+SQLExpression * SQLExpression::fold()
+{
+    SQLContext context;
+    SQLValue v = evaluate(context);
+
+    if (v.isException())
+	return this;
+
+    return new SQLValueExpression(v);
+}
+
+// True if the type is a built in type that values can be converted to
+static bool isKnownType(SQLValueType type)
+{
+    return type != SQLNullType && type != SQLExceptionType &&
+	type != SQLOtherType;
+}
+
+// True if values of the type convert between each other without a string
+static bool isNumericType(SQLValueType type)
+{
+    return type == SQLBooleanType || type == SQLIntegerType ||
+	type == SQLRealType || type == SQLDateTimeType;
+}
+
+// Return the value of a SQLValueExpression
+static const SQLValue &constantValue(SQLExpression *e)
+{
+    return static_cast<SQLValueExpression *>(e)->getValue();
 }
 
 // SQLExpressionList definition
@@ -34,635 +718,2760 @@ SQLExpressionList::SQLExpressionList()
 {
 }
 
-SQLExpressionList::~SQLExpressionList()
+SQLExpressionList::~SQLExpressionList()
+{
+    if (expressions != 0)
+    {
+	for(int i = 0; i < numExpr; i++)
+	    expressions[i]->releaseRef();
+
+	delete[] expressions;
+    }
+}
+
+void SQLExpressionList::addExpression(SQLExpression *e)
+{
+    e->getRef();
+
+    SQLExpression **new_expressions =
+	new SQLExpression *[numExpr + 1];
+
+    int i;
+    for(i = 0; i < numExpr; i++)
+	new_expressions[i] = expressions[i];
+
+    new_expressions[i] = e;
+    numExpr++;
+
+    if (expressions != 0)
+	delete[] expressions;
+    expressions = new_expressions;
+}
+
+int SQLExpressionList::numExpressions()
+{
+    return numExpr;
+}
+
+SQLExpression * SQLExpressionList::expressionNumber(int i)
+{
+    if (i < 0 || i >= numExpr)
+	return 0;
+
+    return expressions[i];
+}
+
+void SQLExpressionList::optimise()
+{
+    for(int i = 0; i < numExpr; i++)
+	SQLExpression::optimiseTree(expressions[i]);
+}
+
+void SQLExpressionList::bindSchema(const SQLSchema &schema,
+				   std::vector<std::string> &errors)
+{
+    for(int i = 0; i < numExpr; i++)
+	SQLExpression::bindTree(expressions[i], schema, errors);
+}
+
+bool SQLExpressionList::isConstant() const
+{
+    for(int i = 0; i < numExpr; i++)
+	if (!expressions[i]->isConstant())
+	    return false;
+
+    return true;
+}
+
+void SQLExpressionList::visitExpressions(SQLExpressionVisitor &visitor)
+{
+    for(int i = 0; i < numExpr; i++)
+	visitor.visit(expressions[i]);
+}
+
+unsigned long SQLExpressionList::hash() const
+{
+    unsigned long h = numExpr;
+
+    for(int i = 0; i < numExpr; i++)
+	h = hashCombine(h, expressions[i]->hash());
+
+    return h;
+}
+
+bool SQLExpressionList::equals(const SQLExpressionList *l) const
+{
+    if (l->numExpr != numExpr)
+	return false;
+
+    for(int i = 0; i < numExpr; i++)
+	if (!expressions[i]->equals(l->expressions[i]))
+	    return false;
+
+    return true;
+}
+
+std::string SQLExpressionList::asString() const
+{
+    std::string str;
+
+    str += "{";
+
+    for(int i = 0; i < numExpr; i++)
+    {
+	str += expressions[i]->asString();
+
+	if (i < numExpr - 1)
+	    str += ", ";
+    }
+
+    str += "}";
+
+    return str;
+}
+
+// Major expression types
+SQLUnaryExpression::SQLUnaryExpression(SQLExpression *expr_)
+: expr(expr_)
+{
+    expr->getRef();
+}
+
+SQLUnaryExpression::~SQLUnaryExpression()
+{
+    // Destroy the children
+    expr->releaseRef();
+}
+
+std::string SQLUnaryExpression::asString() const
+{
+    return std::string(shortName()) + "(" + expr->asString() + ")";
+}
+
+const char * SQLUnaryExpression::shortName() const
+{
+    return "nUary";
+}
+
+void SQLUnaryExpression::visitChildren(SQLExpressionVisitor &visitor)
+{
+    visitor.visit(expr);
+}
+
+bool SQLUnaryExpression::canRaise() const
+{
+    return expr->canRaise();
+}
+
+unsigned long SQLUnaryExpression::hash() const
+{
+    return hashCombine(hashName(shortName()), expr->hash());
+}
+
+bool SQLUnaryExpression::equals(const SQLExpression *e) const
+{
+    if (e == this)
+	return true;
+    if (typeid(*e) != typeid(*this))
+	return false;
+
+    const SQLUnaryExpression *u = static_cast<const SQLUnaryExpression *>(e);
+
+    return expr->equals(u->expr);
+}
+
+SQLExpression * SQLUnaryExpression::optimise()
+{
+    optimiseTree(expr);
+
+    if (expr->isConstant())
+	return fold();
+
+    return this;
+}
+
+SQLExpression * SQLUnaryExpression::bindSchema(const SQLSchema &schema,
+					       std::vector<std::string> &errors)
+{
+    bindTree(expr, schema, errors);
+
+    return this;
+}
+
+SQLBinaryExpression::SQLBinaryExpression(SQLExpression *expr1_,
+					 SQLExpression *expr2_)
+: expr1(expr1_), expr2(expr2_)
+{
+    expr1->getRef();
+    expr2->getRef();
+}
+
+SQLBinaryExpression::~SQLBinaryExpression()
+{
+    // Destroy the children
+    expr1->releaseRef();
+    expr2->releaseRef();
+}
+
+std::string SQLBinaryExpression::asString() const
+{
+    return std::string(shortName()) + "(" + expr1->asString() + ", " +
+	expr2->asString() + ")";
+}
+
+const char * SQLBinaryExpression::shortName() const
+{
+    return "Binary";
+}
+
+void SQLBinaryExpression::visitChildren(SQLExpressionVisitor &visitor)
+{
+    visitor.visit(expr1);
+    visitor.visit(expr2);
+}
+
+// The second operand is converted to the type of the first, which only
+// succeeds for every row if the types are known and match.
+bool SQLBinaryExpression::canRaise() const
+{
+    if (expr1->canRaise() || expr2->canRaise())
+	return true;
+
+    SQLValueType t1 = expr1->resultType();
+    SQLValueType t2 = expr2->resultType();
+    if (!isKnownType(t1) || !isKnownType(t2))
+	return true;
+
+    return t1 != t2 && !(isNumericType(t1) && isNumericType(t2));
+}
+
+unsigned long SQLBinaryExpression::hash() const
+{
+    return hashCombine(hashCombine(hashName(shortName()), expr1->hash()),
+		       expr2->hash());
+}
+
+bool SQLBinaryExpression::equals(const SQLExpression *e) const
+{
+    if (e == this)
+	return true;
+    if (typeid(*e) != typeid(*this))
+	return false;
+
+    const SQLBinaryExpression *b = static_cast<const SQLBinaryExpression *>(e);
+
+    return expr1->equals(b->expr1) && expr2->equals(b->expr2);
+}
+
+SQLExpression * SQLBinaryExpression::optimise()
+{
+    optimiseTree(expr1);
+    optimiseTree(expr2);
+
+    if (expr1->isConstant() && expr2->isConstant())
+	return fold();
+
+    preType();
+
+    return this;
+}
+
+// A string constant compared with an expression of known type is
+// converted once here rather than on the first evaluation
+void SQLBinaryExpression::preType()
+{
+    if (!expr2->isConstant() || constantValue(expr2).type() != SQLStringType)
+	return;
+
+    SQLValue v(constantValue(expr2));
+    if (!v.convertToType(expr1->resultType()))
+	return;
+
+    SQLExpression *e = new SQLValueExpression(v);
+    e->getRef();
+    expr2->releaseRef();
+    expr2 = e;
+}
+
+SQLExpression * SQLBinaryExpression::bindSchema(const SQLSchema &schema,
+						std::vector<std::string> &errors)
+{
+    bindTree(expr1, schema, errors);
+    bindTree(expr2, schema, errors);
+
+    return this;
+}
+
+// Check that values of the types of the siblings can be converted to be
+// compared. A constant is converted to the type of expr1 here rather than
+// on the first evaluation. Returns false after adding an error if the
+// types do not match.
+bool SQLBinaryExpression::checkTypes(std::vector<std::string> &errors)
+{
+    SQLValueType t1 = expr1->resultType();
+    SQLValueType t2 = expr2->resultType();
+
+    if (!isKnownType(t1) || !isKnownType(t2) || t1 == t2)
+	return true;
+
+    if (expr2->isConstant())
+    {
+	SQLValue v(constantValue(expr2));
+
+	if (v.convertToType(t1))
+	{
+	    replace(expr2, new SQLValueExpression(v));
+	    return true;
+	}
+    }
+    // Other values are converted through a string when evaluated
+    else if (t1 == SQLStringType || t2 == SQLStringType ||
+	     (isNumericType(t1) && isNumericType(t2)))
+	return true;
+
+    errors.push_back("Mismatched types in expression: " +
+		     expr1->asString() + " and " + expr2->asString());
+    return false;
+}
+
+// Bind a comparison and replace it with a SQLConstantCompareExpression
+// when it compares an expression of known type with a constant
+SQLExpression * SQLBinaryExpression::bindComparison(const SQLSchema &schema,
+						    std::vector<std::string> &errors,
+						    int test)
+{
+    SQLBinaryExpression::bindSchema(schema, errors);
+
+    if (!checkTypes(errors))
+	return this;
+
+    SQLValueType t = expr1->resultType();
+    if (!expr2->isConstant() || constantValue(expr2).type() != t ||
+	!SQLConstantCompareExpression::isSpecialised(t))
+	return this;
+
+    return new SQLConstantCompareExpression(expr1, constantValue(expr2), test);
+}
+
+
+bool SQLBinaryExpression::evaluateSiblings(SQLContext &context,
+					   SQLValue &v1, SQLValue &v2)
+{
+    v1 = expr1->evaluate(context);
+    // Exception should just return.
+    SQLValueType t1 = v1.type();
+    if (t1 == SQLExceptionType || t1 == SQLNullType)
+        return false;
+
+    // Performance optimisation to aim to only do the type conversion once
+    // for things like SQLDateTimeValue
+    SQLValueExpression *ve = dynamic_cast<SQLValueExpression *>(expr2);
+    if (ve != 0)
+        v2 = ve->valueAsType(v1);
+    else
+        v2 = expr2->evaluate(context);
+
+    return matchSiblings(v1, v2);
+}
+
+bool SQLBinaryExpression::matchSiblings(SQLValue &v1, SQLValue &v2)
+{
+    SQLValueType t1 = v1.type();
+    SQLValueType t2 = v2.type();
+    if (t2 == SQLExceptionType || t2 == SQLNullType)
+    {
+	v1.swap(v2);
+	return false;
+    }
+
+    if (t2 == t1 && t1 != SQLOtherType)
+        return true;
+
+    if (v2.typeConvert(v1))
+        return true;
+
+    v1 = SQLValue(new SQLExceptionValue(
+                      "Mismatched types in expression: " +
+                      v1.asString() + " and " + v2.asString()));
+    return false;
+}
+
+// Compile to the instructions that match evaluateSiblings() followed by
+// the given Compare or Operation. The result is left in the register of
+// expr1.
+int SQLBinaryExpression::compileSiblings(SQLProgram &program, int op, int arg)
+{
+    int r = expr1->compile(program);
+    int skip = program.emit(SQLProgram::JumpIfNull, r);
+
+    // Constants keep their type conversion as in evaluateSiblings()
+    SQLValueExpression *ve = dynamic_cast<SQLValueExpression *>(expr2);
+    if (ve != 0)
+	program.emit((SQLProgram::OpCode)op, r, program.addConstant(ve), arg,
+		     true);
+    else
+    {
+	int r2 = expr2->compile(program);
+	program.emit((SQLProgram::OpCode)op, r, r2, arg);
+	program.popRegister();
+    }
+
+    program.setJump(skip);
+
+    return r;
+}
+
+std::string SQLTerminalExpression::asString() const
+{
+    return shortName();
+}
+
+const char * SQLTerminalExpression::shortName() const
+{
+    return "Terminal";
+}
+
+// Actual expression implementation
+SQLValue SQLEqualsExpression::evaluate(SQLContext &context)
+{
+    SQLValue v1, v2;
+    if (!evaluateSiblings(context, v1, v2))
+	return v1;
+
+    bool res = (v1.compare(v2) == 0);
+
+
+    return res ? SQLTrueValue : SQLFalseValue;
+}
+
+const char * SQLEqualsExpression::shortName() const
+{
+    return "Equals";
+}
+
+SQLValueType SQLEqualsExpression::resultType() const
+{
+    return SQLBooleanType;
+}
+
+SQLExpression * SQLEqualsExpression::bindSchema(const SQLSchema &schema,
+						std::vector<std::string> &errors)
+{
+    return bindComparison(schema, errors, SQLProgram::Equals);
+}
+
+int SQLEqualsExpression::compile(SQLProgram &program)
+{
+    return compileSiblings(program, SQLProgram::Compare, SQLProgram::Equals);
+}
+
+SQLValue SQLNotEqualsExpression::evaluate(SQLContext &context)
+{
+    SQLValue v1, v2;
+    if (!evaluateSiblings(context, v1, v2))
+	return v1;
+
+    bool res = (v1.compare(v2) != 0);
+
+
+    return res ? SQLTrueValue : SQLFalseValue;
+}
+
+const char * SQLNotEqualsExpression::shortName() const
+{
+    return "NotEquals";
+}
+
+SQLValueType SQLNotEqualsExpression::resultType() const
+{
+    return SQLBooleanType;
+}
+
+SQLExpression * SQLNotEqualsExpression::bindSchema(const SQLSchema &schema,
+						   std::vector<std::string> &errors)
+{
+    return bindComparison(schema, errors, SQLProgram::NotEquals);
+}
+
+int SQLNotEqualsExpression::compile(SQLProgram &program)
+{
+    return compileSiblings(program, SQLProgram::Compare, SQLProgram::NotEquals);
+}
+
+SQLValue SQLLessThanExpression::evaluate(SQLContext &context)
+{
+    SQLValue v1, v2;
+    if (!evaluateSiblings(context, v1, v2))
+	return v1;
+
+    bool res = (v1.compare(v2) < 0);
+
+    return res ? SQLTrueValue : SQLFalseValue;
+}
+
+const char * SQLLessThanExpression::shortName() const
+{
+    return "LessThan";
+}
+
+SQLValueType SQLLessThanExpression::resultType() const
+{
+    return SQLBooleanType;
+}
+
+SQLExpression * SQLLessThanExpression::bindSchema(const SQLSchema &schema,
+						  std::vector<std::string> &errors)
+{
+    return bindComparison(schema, errors, SQLProgram::LessThan);
+}
+
+int SQLLessThanExpression::compile(SQLProgram &program)
+{
+    return compileSiblings(program, SQLProgram::Compare, SQLProgram::LessThan);
+}
+
+SQLValue SQLGreaterThanExpression::evaluate(SQLContext &context)
+{
+    SQLValue v1, v2;
+    if (!evaluateSiblings(context, v1, v2))
+	return v1;
+
+    bool res = (v1.compare(v2) > 0);
+
+    return res ? SQLTrueValue : SQLFalseValue;
+}
+
+const char * SQLGreaterThanExpression::shortName() const
+{
+    return "GreaterThan";
+}
+
+SQLValueType SQLGreaterThanExpression::resultType() const
+{
+    return SQLBooleanType;
+}
+
+SQLExpression * SQLGreaterThanExpression::bindSchema(const SQLSchema &schema,
+						     std::vector<std::string> &errors)
+{
+    return bindComparison(schema, errors, SQLProgram::GreaterThan);
+}
+
+int SQLGreaterThanExpression::compile(SQLProgram &program)
+{
+    return compileSiblings(program, SQLProgram::Compare, SQLProgram::GreaterThan);
+}
+
+SQLValue SQLLessEqualsExpression::evaluate(SQLContext &context)
+{
+    SQLValue v1, v2;
+    if (!evaluateSiblings(context, v1, v2))
+	return v1;
+
+    bool res = (v1.compare(v2) <= 0);
+
+    return res ? SQLTrueValue : SQLFalseValue;
+}
+
+const char * SQLLessEqualsExpression::shortName() const
+{
+    return "LessEquals";
+}
+
+SQLValueType SQLLessEqualsExpression::resultType() const
+{
+    return SQLBooleanType;
+}
+
+SQLExpression * SQLLessEqualsExpression::bindSchema(const SQLSchema &schema,
+						    std::vector<std::string> &errors)
+{
+    return bindComparison(schema, errors, SQLProgram::LessEquals);
+}
+
+int SQLLessEqualsExpression::compile(SQLProgram &program)
+{
+    return compileSiblings(program, SQLProgram::Compare, SQLProgram::LessEquals);
+}
+
+SQLValue SQLGreaterEqualsExpression::evaluate(SQLContext &context)
+{
+    SQLValue v1, v2;
+    if (!evaluateSiblings(context, v1, v2))
+	return v1;
+
+    bool res = (v1.compare(v2) >= 0);
+
+    return res ? SQLTrueValue : SQLFalseValue;
+}
+
+const char * SQLGreaterEqualsExpression::shortName() const
+{
+    return "GreaterEquals";
+}
+
+SQLValueType SQLGreaterEqualsExpression::resultType() const
+{
+    return SQLBooleanType;
+}
+
+SQLExpression * SQLGreaterEqualsExpression::bindSchema(const SQLSchema &schema,
+						       std::vector<std::string> &errors)
+{
+    return bindComparison(schema, errors, SQLProgram::GreaterEquals);
+}
+
+int SQLGreaterEqualsExpression::compile(SQLProgram &program)
+{
+    return compileSiblings(program, SQLProgram::Compare, SQLProgram::GreaterEquals);
+}
+
+SQLValue SQLWithinExpression::evaluate(SQLContext &context)
+{
+    SQLValue v1, v2;
+    if (!evaluateSiblings(context, v1, v2))
+	return v1;
+
+    if (v1.type() != SQLIPAddressType)
+	return SQLValue(new SQLExceptionValue(
+			    "Subnet match on a value that is not an IP address: " +
+			    v1.asString()));
+
+    bool res = v1.isWithin(v2);
+
+    return res ? SQLTrueValue : SQLFalseValue;
+}
+
+const char * SQLWithinExpression::shortName() const
+{
+    return "Within";
+}
+
+SQLValueType SQLWithinExpression::resultType() const
+{
+    return SQLBooleanType;
+}
+
+bool SQLWithinExpression::canRaise() const
+{
+    return SQLBinaryExpression::canRaise() ||
+	expr1->resultType() != SQLIPAddressType;
+}
+
+SQLExpression * SQLWithinExpression::bindSchema(const SQLSchema &schema,
+						std::vector<std::string> &errors)
+{
+    SQLBinaryExpression::bindSchema(schema, errors);
+
+    SQLValueType t = expr1->resultType();
+    if (isKnownType(t) && t != SQLIPAddressType)
+    {
+	errors.push_back("Subnet match on a value that is not an IP address: " +
+			 expr1->asString());
+	return this;
+    }
+
+    checkTypes(errors);
+
+    return this;
+}
+
+int SQLWithinExpression::compile(SQLProgram &program)
+{
+    return compileSiblings(program, SQLProgram::Compare, SQLProgram::Within);
+}
+
+SQLValue SQLAndExpression::evaluate(SQLContext &context)
+{
+    SQLValue v1 = expr1->evaluate(context);
+    // Exception should just return.
+    if (v1.isException())
+	return v1;
+
+    // Shortcut false return. Don't shortcut on void as we want this to
+    // walk the entire expression tree.
+    if (!v1.isNull() && !v1.asBoolean())
+	return v1;
+
+    SQLValue v2 = expr2->evaluate(context);
+    if (!v2.asBoolean() || v2.isNull())
+	return v2;
+    else
+	return v1;
+}
+
+const char * SQLAndExpression::shortName() const
+{
+    return "And";
+}
+
+SQLExpression * SQLAndExpression::optimise()
+{
+    optimiseTree(expr1);
+    optimiseTree(expr2);
+
+    if (expr1->isConstant())
+    {
+	const SQLValue &v1 = constantValue(expr1);
+
+	if (expr2->isConstant())
+	    return fold();
+
+	// A false constant is always the result
+	if (!v1.isNull() && !v1.asBoolean())
+	    return expr1;
+
+	// true and x is x if x is a boolean
+	if (v1.type() == SQLBooleanType && expr2->isPredicate())
+	    return expr2;
+    }
+    else if (expr2->isConstant())
+    {
+	const SQLValue &v2 = constantValue(expr2);
+
+	// x and true is always x
+	if (!v2.isNull() && v2.asBoolean())
+	    return expr1;
+    }
+
+    if (resultType() == SQLBooleanType)
+	return new SQLAndChainExpression(expr1, expr2);
+
+    return this;
+}
+
+SQLValueType SQLAndExpression::resultType() const
+{
+    if (expr1->isPredicate() && expr2->isPredicate())
+	return SQLBooleanType;
+
+    return SQLOtherType;
+}
+
+bool SQLAndExpression::canRaise() const
+{
+    return expr1->canRaise() || expr2->canRaise();
+}
+
+SQLExpression * SQLAndExpression::bindSchema(const SQLSchema &schema,
+					     std::vector<std::string> &errors)
+{
+    SQLBinaryExpression::bindSchema(schema, errors);
+
+    SQLExpression *range = SQLRangeExpression::create(expr1, expr2);
+    if (range != 0)
+	return range;
+
+    return this;
+}
+
+int SQLAndExpression::compile(SQLProgram &program)
+{
+    int r = expr1->compile(program);
+    int skip = program.emit(SQLProgram::JumpIfFalse, r);
+
+    int r2 = expr2->compile(program);
+    program.emit(SQLProgram::And, r, r2);
+    program.popRegister();
+
+    program.setJump(skip);
+
+    return r;
+}
+
+SQLValue SQLOrExpression::evaluate(SQLContext &context)
+{
+    SQLValue v1 = expr1->evaluate(context);
+    // Exception should just return.
+    if (v1.isException())
+	return v1;
+
+    // Shortcut true return
+    if (v1.asBoolean())
+	return v1;
+
+    SQLValue v2 = expr2->evaluate(context);
+    if (v2.asBoolean() || v2.isNull())
+	return v2;
+    else
+	return v1;
+}
+
+const char * SQLOrExpression::shortName() const
+{
+    return "Or";
+}
+
+SQLExpression * SQLOrExpression::optimise()
+{
+    optimiseTree(expr1);
+    optimiseTree(expr2);
+
+    if (expr1->isConstant())
+    {
+	const SQLValue &v1 = constantValue(expr1);
+
+	if (expr2->isConstant())
+	    return fold();
+
+	// A true constant is always the result. false or x is not
+	// simplified as an exception from x gives false.
+	if (v1.asBoolean())
+	    return expr1;
+    }
+    else if (expr2->isConstant())
+    {
+	const SQLValue &v2 = constantValue(expr2);
+
+	// x or false is always x
+	if (!v2.isNull() && !v2.asBoolean())
+	    return expr1;
+    }
+
+    if (resultType() == SQLBooleanType)
+	return new SQLOrChainExpression(expr1, expr2);
+
+    return this;
+}
+
+SQLValueType SQLOrExpression::resultType() const
+{
+    if (expr1->isPredicate() && expr2->isPredicate())
+	return SQLBooleanType;
+
+    return SQLOtherType;
+}
+
+bool SQLOrExpression::canRaise() const
+{
+    return expr1->canRaise() || expr2->canRaise();
+}
+
+int SQLOrExpression::compile(SQLProgram &program)
+{
+    int r = expr1->compile(program);
+    int skip = program.emit(SQLProgram::JumpIfTrue, r);
+
+    int r2 = expr2->compile(program);
+    program.emit(SQLProgram::Or, r, r2);
+    program.popRegister();
+
+    program.setJump(skip);
+
+    return r;
+}
+
+SQLLogicChainExpression::SQLLogicChainExpression(bool decides_)
+: decides(decides_), statistics(0), order(0), samples(0), reordering(0),
+  raised(0)
+{
+}
+
+SQLLogicChainExpression::~SQLLogicChainExpression()
+{
+    for (size_t i = 0; i < programs.size(); i++)
+	delete programs[i];
+
+    for (size_t i = 0; i < operands.size(); i++)
+	operands[i]->releaseRef();
+
+    delete [] statistics;
+    delete [] order;
+}
+
+void SQLLogicChainExpression::addOperand(SQLExpression *e, bool merge)
+{
+    SQLLogicChainExpression *c = dynamic_cast<SQLLogicChainExpression *>(e);
+
+    if (merge && canMerge(e) &&
+	operands.size() + c->operands.size() <= MAX_OPERANDS)
+    {
+	for (size_t i = 0; i < c->operands.size(); i++)
+	    addOperand(c->operands[i], false);
+	return;
+    }
+
+    e->getRef();
+    operands.push_back(e);
+}
+
+void SQLLogicChainExpression::reset()
+{
+    for (size_t i = 0; i < programs.size(); i++)
+	delete programs[i];
+    programs.clear();
+
+    delete [] statistics;
+    delete [] order;
+
+    statistics = new Statistics[operands.size()];
+    order = new SQLAtomic<unsigned char>[operands.size()];
+
+    for (size_t i = 0; i < operands.size(); i++)
+    {
+	order[i].store(i);
+	statistics[i].canRaise = operands[i]->canRaise();
+    }
+
+    samples.store(0);
+    raised.store(0);
+}
+
+int SQLLogicChainExpression::numOperands() const
+{
+    return operands.size();
+}
+
+SQLExpression * SQLLogicChainExpression::operandNumber(int i) const
+{
+    return operands[i];
+}
+
+int SQLLogicChainExpression::evaluationOrder(int i) const
+{
+    return order[i].load();
+}
+
+static unsigned long nanoseconds()
+{
+#if __cplusplus >= 201103L
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::steady_clock::now().time_since_epoch()).count();
+#elif !defined(__WIN32__)
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec * 1000000000UL + t.tv_nsec;
+#else
+    // Without a clock the operands are ordered on their decisions alone
+    return 0;
+#endif
+}
+
+// Pick the evaluations to sample at random so that chains evaluated in a
+// fixed pattern are all sampled.
+static SQL_THREAD_LOCAL unsigned int sampleState = 2463534242U;
+
+static bool sampleEvaluation()
+{
+    unsigned int x = sampleState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sampleState = x;
+
+    return x % SQLLogicChainExpression::SAMPLE_RATE == 0;
+}
+
+SQLValue SQLLogicChainExpression::evaluateOperand(int i, SQLContext &context)
+{
+    SQLProgram *p = i < (int)programs.size() ? programs[i] : 0;
+
+    return p != 0 ? p->evaluate(context) : operands[i]->evaluate(context);
+}
+
+SQLValue SQLLogicChainExpression::evaluate(SQLContext &context)
+{
+    if (raised.load())
+	return evaluateInOrder(context, 0);
+
+    if (sampleEvaluation())
+	return evaluateSample(context);
+
+    int count = operands.size();
+    unsigned long long done = 0;
+    SQLValue null_value;
+    bool got_null = false;
+
+    // A reorder by another thread may mean an operand is seen twice and
+    // another missed, so the second pass picks up any that were missed.
+    for (int i = 0; i < count * 2; i++)
+    {
+	int k = i < count ? order[i].load() : i - count;
+	unsigned long long bit = 1ULL << k;
+
+	if (done & bit)
+	    continue;
+	done |= bit;
+
+	SQLValue v = evaluateOperand(k, context);
+	if (v.isException())
+	{
+	    raised.store(1);
+	    return evaluateInOrder(context, 0);
+	}
+
+	if (v.isNull())
+	{
+	    if (!got_null)
+		null_value = v;
+	    got_null = true;
+	}
+	else if (v.asBoolean() == decides)
+	    return v;
+    }
+
+    if (got_null)
+	return null_value;
+
+    return decides ? SQLFalseValue : SQLTrueValue;
+}
+
+// Evaluate every operand in the written order to measure them. This also
+// finds the operands that raise exceptions before any reordering is done.
+SQLValue SQLLogicChainExpression::evaluateSample(SQLContext &context)
+{
+    SQLValue values[MAX_OPERANDS];
+    bool got_exception = false;
+
+    for (size_t i = 0; i < operands.size(); i++)
+    {
+	unsigned long start = nanoseconds();
+	values[i] = evaluateOperand(i, context);
+	unsigned long end = nanoseconds();
+
+	Statistics &s = statistics[i];
+	s.evaluations.add(1);
+	s.cost.add(end - start);
+
+	SQLValue &v = values[i];
+	if (v.isException())
+	    got_exception = true;
+	else if (!v.isNull() && v.asBoolean() == decides)
+	    s.decisions.add(1);
+    }
+
+    if (got_exception)
+	raised.store(1);
+    else if (samples.add(1) % REORDER_SAMPLES == 0)
+	reorder();
+
+    return evaluateInOrder(context, values);
+}
+
+// The same as evaluating the binary expressions in the written order. The
+// values are those already evaluated or 0 to evaluate the operands.
+SQLValue SQLLogicChainExpression::evaluateInOrder(SQLContext &context,
+						  SQLValue *values)
+{
+    SQLValue result = values ? values[0] : operands[0]->evaluate(context);
+
+    for (size_t i = 1; i < operands.size(); i++)
+    {
+	if (result.isException())
+	    return result;
+
+	if (!result.isNull() && result.asBoolean() == decides)
+	    return result;
+
+	SQLValue v = values ? values[i] : operands[i]->evaluate(context);
+	if (v.isNull() || v.asBoolean() == decides)
+	    result = v;
+    }
+
+    return result;
+}
+
+// Try first the operands with the lowest cost for each time they decide
+// the result. The statistics are then halved so the order follows changes
+// in the data. This runs while rows are being evaluated so it does not
+// allocate.
+void SQLLogicChainExpression::reorder()
+{
+    if (!reordering.compareExchange(0, 1))
+	return;
+
+    int count = operands.size();
+    double total_cost = 0;
+    double total_evaluations = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+	total_cost += statistics[i].cost.load();
+	total_evaluations += statistics[i].evaluations.load();
+    }
+
+    // Operands that have not been reached are given the average cost
+    double average = total_evaluations > 0 ? total_cost / total_evaluations : 1;
+
+    double rank[MAX_OPERANDS];
+    int indexes[MAX_OPERANDS];
+    for (int i = 0; i < count; i++)
+    {
+	Statistics &s = statistics[i];
+	double n = s.evaluations.load();
+	double cost = n > 0 ? s.cost.load() / n : average;
+	double decided = (s.decisions.load() + 1) / (n + 2);
+
+	rank[i] = (cost + 1) / decided;
+	indexes[i] = i;
+
+	s.evaluations.store(s.evaluations.load() / 2);
+	s.decisions.store(s.decisions.load() / 2);
+	s.cost.store(s.cost.load() / 2);
+    }
+
+    // Chains are short so an insertion sort does, and it keeps ties in order.
+    // An operand is not moved ahead of one that may raise an exception, as
+    // the exception would be hidden whenever the moved operand decides.
+    for (int i = 1; i < count; i++)
+    {
+	int k = indexes[i];
+	int j = i;
+
+	for (; j > 0 && rank[indexes[j - 1]] > rank[k] &&
+		 !statistics[indexes[j - 1]].canRaise; j--)
+	    indexes[j] = indexes[j - 1];
+	indexes[j] = k;
+    }
+
+    for (int i = 0; i < count; i++)
+	order[i].store(indexes[i]);
+
+    reordering.store(0);
+}
+
+// Each operand is compiled on its own so the chain can run them in any order
+int SQLLogicChainExpression::compile(SQLProgram &program)
+{
+    if (programs.empty())
+	for (size_t i = 0; i < operands.size(); i++)
+	    programs.push_back(new SQLProgram(operands[i]));
+
+    return SQLExpression::compile(program);
+}
+
+SQLExpression * SQLLogicChainExpression::optimise()
+{
+    for (size_t i = 0; i < operands.size(); i++)
+	optimiseTree(operands[i]);
+
+    reset();
+
+    return this;
+}
+
+SQLExpression * SQLLogicChainExpression::bindSchema(const SQLSchema &schema,
+						    std::vector<std::string> &errors)
+{
+    for (size_t i = 0; i < operands.size(); i++)
+	bindTree(operands[i], schema, errors);
+
+    reset();
+
+    return this;
+}
+
+SQLValueType SQLLogicChainExpression::resultType() const
+{
+    return SQLBooleanType;
+}
+
+bool SQLLogicChainExpression::canRaise() const
+{
+    for (size_t i = 0; i < operands.size(); i++)
+	if (operands[i]->canRaise())
+	    return true;
+
+    return false;
+}
+
+std::string SQLLogicChainExpression::asString() const
+{
+    std::string s = std::string(shortName()) + "(";
+
+    for (size_t i = 0; i < operands.size(); i++)
+    {
+	if (i > 0)
+	    s += ", ";
+	s += operands[i]->asString();
+    }
+
+    return s + ")";
+}
+
+void SQLLogicChainExpression::visitChildren(SQLExpressionVisitor &visitor)
+{
+    for (size_t i = 0; i < operands.size(); i++)
+	visitor.visit(operands[i]);
+}
+
+unsigned long SQLLogicChainExpression::hash() const
+{
+    unsigned long h = hashName(shortName());
+
+    for (size_t i = 0; i < operands.size(); i++)
+	h = hashCombine(h, operands[i]->hash());
+
+    return h;
+}
+
+bool SQLLogicChainExpression::equals(const SQLExpression *e) const
+{
+    if (e == this)
+	return true;
+    if (typeid(*e) != typeid(*this))
+	return false;
+
+    const SQLLogicChainExpression *c =
+	static_cast<const SQLLogicChainExpression *>(e);
+    if (c->operands.size() != operands.size())
+	return false;
+
+    for (size_t i = 0; i < operands.size(); i++)
+	if (!operands[i]->equals(c->operands[i]))
+	    return false;
+
+    return true;
+}
+
+SQLAndChainExpression::SQLAndChainExpression(SQLExpression *expr1,
+					     SQLExpression *expr2)
+: SQLLogicChainExpression(false)
+{
+    addOperand(expr1, true);
+    addOperand(expr2, true);
+    reset();
+}
+
+const char * SQLAndChainExpression::shortName() const
+{
+    return "And";
+}
+
+bool SQLAndChainExpression::canMerge(SQLExpression *e) const
+{
+    return dynamic_cast<SQLAndChainExpression *>(e) != 0;
+}
+
+SQLExpression * SQLAndChainExpression::bindSchema(const SQLSchema &schema,
+						  std::vector<std::string> &errors)
+{
+    SQLLogicChainExpression::bindSchema(schema, errors);
+
+    // Bounds on the same variable next to each other become a range
+    for (size_t i = 0; i + 1 < operands.size(); i++)
+    {
+	SQLExpression *range =
+	    SQLRangeExpression::create(operands[i], operands[i + 1]);
+	if (range == 0)
+	    continue;
+
+	replace(operands[i], range);
+	operands[i + 1]->releaseRef();
+	operands.erase(operands.begin() + i + 1);
+    }
+
+    reset();
+
+    if (operands.size() == 1)
+	return operands[0];
+
+    return this;
+}
+
+SQLOrChainExpression::SQLOrChainExpression(SQLExpression *expr1,
+					   SQLExpression *expr2)
+: SQLLogicChainExpression(true)
+{
+    addOperand(expr1, true);
+    addOperand(expr2, false);
+    reset();
+}
+
+const char * SQLOrChainExpression::shortName() const
+{
+    return "Or";
+}
+
+bool SQLOrChainExpression::canMerge(SQLExpression *e) const
+{
+    return dynamic_cast<SQLOrChainExpression *>(e) != 0;
+}
+
+SQLValue SQLXorExpression::evaluate(SQLContext &context)
+{
+    SQLValue v1 = expr1->evaluate(context);
+    SQLValue v2 = expr2->evaluate(context);
+    // Exception should just return.
+    if (v1.isException())
+       return v1;
+    if (v2.isException())
+       return v2;
+
+    bool b1 = v1.asBoolean();
+    bool b2 = v2.asBoolean();
+    if (b1 ^ b2)
+       return SQLTrueValue;
+    else
+       return SQLFalseValue;
+}
+
+const char * SQLXorExpression::shortName() const
+{
+    return "Xor";
+}
+
+SQLExpression * SQLXorExpression::optimise()
+{
+    optimiseTree(expr1);
+    optimiseTree(expr2);
+
+    if (expr1->isConstant() && expr2->isConstant())
+	return fold();
+
+    return this;
+}
+
+SQLValueType SQLXorExpression::resultType() const
+{
+    return SQLBooleanType;
+}
+
+bool SQLXorExpression::canRaise() const
+{
+    return expr1->canRaise() || expr2->canRaise();
+}
+
+int SQLXorExpression::compile(SQLProgram &program)
+{
+    int r = expr1->compile(program);
+    int r2 = expr2->compile(program);
+    program.emit(SQLProgram::Xor, r, r2);
+    program.popRegister();
+
+    return r;
+}
+
+SQLValue SQLOperationExpression::evaluate(SQLContext &context)
+{
+    SQLValue v1, v2;
+    if (!evaluateSiblings(context, v1, v2))
+	return v1;
+
+    return v1.binaryOperation(v2, op);
+}
+
+const char * SQLOperationExpression::shortName() const
+{
+    return "Operation";
+}
+
+unsigned long SQLOperationExpression::hash() const
+{
+    return hashCombine(SQLBinaryExpression::hash(), op);
+}
+
+bool SQLOperationExpression::equals(const SQLExpression *e) const
+{
+    return SQLBinaryExpression::equals(e) &&
+	static_cast<const SQLOperationExpression *>(e)->op == op;
+}
+
+int SQLOperationExpression::compile(SQLProgram &program)
+{
+    return compileSiblings(program, SQLProgram::Operation, op);
+}
+
+SQLExpression * SQLOperationExpression::bindSchema(const SQLSchema &schema,
+						   std::vector<std::string> &errors)
+{
+    SQLBinaryExpression::bindSchema(schema, errors);
+
+    checkTypes(errors);
+
+    return this;
+}
+
+// The operation is carried out in the type of the first operand
+SQLValueType SQLOperationExpression::resultType() const
+{
+    return expr1->resultType();
+}
+
+// A division may raise for any row so is never taken to be safe
+bool SQLOperationExpression::canRaise() const
+{
+    if (op == '/' || SQLBinaryExpression::canRaise())
+	return true;
+
+    switch (resultType())
+    {
+    case SQLBooleanType:
+	return op == '-';
+    case SQLIntegerType:
+    case SQLRealType:
+#if SQL_DATE_SUPPORT
+    case SQLDateTimeType:
+#endif
+	return false;
+    case SQLStringType:
+	return op != '+';
+    default:
+	return true;
+    }
+}
+
+std::string SQLOperationExpression::asString() const
+{
+    std::string s(1, op);
+    return std::string(shortName()) + "(" + expr1->asString() + " " + s + " " +
+	expr2->asString() + ")";
+}
+
+SQLValue SQLNotExpression::evaluate(SQLContext &context)
+{
+    SQLValue v = expr->evaluate(context);
+    // Void or exception should just return.
+    if (v.isNull() || v.isException())
+	return v;
+
+    return v.asBoolean() ? SQLFalseValue : SQLTrueValue;
+}
+
+const char * SQLNotExpression::shortName() const
+{
+    return "Not";
+}
+
+SQLExpression * SQLNotExpression::optimise()
+{
+    optimiseTree(expr);
+
+    if (expr->isConstant())
+	return fold();
+
+    // not not x is x if x is a boolean
+    SQLNotExpression *n = dynamic_cast<SQLNotExpression *>(expr);
+    if (n != 0 && n->expr->isPredicate())
+	return n->expr;
+
+    return this;
+}
+
+SQLValueType SQLNotExpression::resultType() const
+{
+    return SQLBooleanType;
+}
+
+int SQLNotExpression::compile(SQLProgram &program)
+{
+    int r = expr->compile(program);
+    program.emit(SQLProgram::Not, r);
+
+    return r;
+}
+
+SQLValue SQLNegateExpression::evaluate(SQLContext &context)
+{
+    SQLValue v = expr->evaluate(context);
+
+    return v.unaryOperation('-');
+}
+
+const char * SQLNegateExpression::shortName() const
+{
+    return "Negate";
+}
+
+SQLValueType SQLNegateExpression::resultType() const
+{
+    SQLValueType t = expr->resultType();
+
+    if (t == SQLIntegerType || t == SQLRealType)
+	return t;
+
+    return SQLOtherType;
+}
+
+bool SQLNegateExpression::canRaise() const
+{
+    return expr->canRaise() || resultType() == SQLOtherType;
+}
+
+int SQLNegateExpression::compile(SQLProgram &program)
+{
+    int r = expr->compile(program);
+    program.emit(SQLProgram::Negate, r);
+
+    return r;
+}
+
+SQLInExpression::SQLInExpression(SQLExpression *expr_,
+				 SQLExpressionList *list_)
+: expr(expr_), list(list_), parameter(0)
+{
+    for (int t = 0; t < SQLExceptionType; t++)
+	setUsable[t] = false;
+    expr->getRef();
+}
+
+SQLInExpression::SQLInExpression(SQLExpression *expr_,
+				 SQLParameterExpression *parameter_)
+: expr(expr_), list(new SQLExpressionList), parameter(parameter_)
+{
+    for (int t = 0; t < SQLExceptionType; t++)
+	setUsable[t] = false;
+    expr->getRef();
+    parameter->getRef();
+}
+
+SQLInExpression::~SQLInExpression()
+{
+    delete list;
+
+    if (parameter != 0)
+	parameter->releaseRef();
+    expr->releaseRef();
+}
+
+SQLValue SQLInExpression::evaluate(SQLContext &context)
+{
+    SQLValue v1 = expr->evaluate(context);
+    // Exception should just return.
+    if (v1.isException() || v1.isNull())
+	return v1;
+
+    if (parameter != 0)
+	return parameter->contains(context, v1);
+
+    SQLValueType t = v1.type();
+    if (t < SQLExceptionType && setUsable[t])
+    {
+	if (sets[t].contains(v1))
+	    return SQLTrueValue;
+
+	return sets[t].hasNull() ? SQLValue() : SQLFalseValue;
+    }
+
+    bool got_null = false;
+
+    for (int i = 0; i < list->numExpressions(); i++)
+    {
+	SQLExpression *e = list->expressionNumber(i);
+
+	SQLValue v2 = e->evaluate(context);
+	if (v2.isException())
+	    return v2;
+
+        if (v2.isNull())
+        {
+            got_null = true;
+            continue;
+        }
+
+	// Convert v2 to the same type as v1
+	if (!v2.typeConvert(v1))
+	    return SQLValue(new SQLExceptionValue(
+                            "Mismatched types in list expression:" +
+                            v1.asString() + " and " + v2.asString()));
+	if (v1.compare(v2) == 0)
+	    return SQLTrueValue;
+    }
+
+    if (got_null)
+        return SQLValue();
+    else
+        return SQLFalseValue;
+}
+
+// Convert a list of constants to each type and put them in the set for
+// that type. If any cannot be converted to a type the list is searched as
+// before for that type so the same exception is raised.
+void SQLInExpression::buildSets()
+{
+    std::vector<SQLValue> values;
+    bool constant = parameter == 0 && list->isConstant();
+    if (constant)
+	for (int i = 0; i < list->numExpressions(); i++)
+	    values.push_back(constantValue(list->expressionNumber(i)));
+
+    for (int t = 0; t < SQLExceptionType; t++)
+    {
+	sets[t].clear();
+	setUsable[t] = constant && t != SQLNullType &&
+	    sets[t].assign(values, SQLValueType(t));
+    }
+}
+
+// Show the parse tree as a string. This is useful for debugging
+std::string SQLInExpression::asString() const
+{
+    return std::string(shortName()) + "(" + expr->asString() + ", " +
+	(parameter != 0 ? parameter->asString() : list->asString()) + ")";
+}
+
+const char * SQLInExpression::shortName() const
+{
+    return "In";
+}
+
+void SQLInExpression::visitChildren(SQLExpressionVisitor &visitor)
+{
+    visitor.visit(expr);
+    list->visitExpressions(visitor);
+}
+
+unsigned long SQLInExpression::hash() const
+{
+    unsigned long h = hashCombine(hashName(shortName()), expr->hash());
+
+    return hashCombine(h, parameter != 0 ? parameter->hash() : list->hash());
+}
+
+bool SQLInExpression::equals(const SQLExpression *e) const
+{
+    if (e == this)
+	return true;
+
+    const SQLInExpression *in = dynamic_cast<const SQLInExpression *>(e);
+    if (in == 0 || !expr->equals(in->expr))
+	return false;
+
+    if (parameter != 0 || in->parameter != 0)
+	return parameter != 0 && in->parameter != 0 &&
+	    parameter->equals(in->parameter);
+
+    return list->equals(in->list);
+}
+
+SQLExpression * SQLInExpression::optimise()
+{
+    optimiseTree(expr);
+    list->optimise();
+
+    if (parameter == 0 && expr->isConstant() && list->isConstant())
+	return fold();
+
+    buildSets();
+
+    return this;
+}
+
+SQLValueType SQLInExpression::resultType() const
+{
+    return SQLBooleanType;
+}
+
+// Only a list of constants that was converted to the type of the operand
+// is searched without a conversion that may fail
+bool SQLInExpression::canRaise() const
+{
+    if (expr->canRaise() || parameter != 0)
+	return true;
+
+    SQLValueType t = expr->resultType();
+
+    return !isKnownType(t) || !setUsable[t];
+}
+
+SQLExpression * SQLInExpression::bindSchema(const SQLSchema &schema,
+					    std::vector<std::string> &errors)
+{
+    bindTree(expr, schema, errors);
+    list->bindSchema(schema, errors);
+
+    // Binding may have changed the list so build the sets again
+    buildSets();
+
+    return this;
+}
+
+SQLLikeExpression::SQLLikeExpression(SQLExpression *expr,
+                                     const std::string &pattern_,
+				     const std::string &escape)
+: SQLUnaryExpression(expr), pattern(pattern_), match(Wildcard),
+  anyStart(false), anyEnd(false)
+{
+    if (escape.length() > 0)
+    {
+	size_t pos = pattern.find(escape[0]);
+	if (pos != std::string::npos)
+	{
+	    compileRegex(pattern, pos);
+	    return;
+	}
+    }
+
+    // Split the pattern at each run of '%'
+    size_t start = 0;
+    while (start < pattern.length())
+    {
+	size_t pos = pattern.find('%', start);
+	if (pos == std::string::npos)
+	    pos = pattern.length();
+
+	if (pos > start)
+	    segments.push_back(pattern.substr(start, pos - start));
+
+	start = pos + 1;
+    }
+
+    anyStart = !pattern.empty() && pattern[0] == '%';
+    anyEnd = !pattern.empty() && pattern[pattern.length() - 1] == '%';
+
+    if (pattern.find('_') != std::string::npos)
+	match = Wildcard;
+    else if (segments.size() == 0)
+	match = anyStart ? Contains : Exact;
+    else if (segments.size() > 1)
+	match = Wildcard;
+    else if (!anyStart && !anyEnd)
+	match = Exact;
+    else if (!anyStart)
+	match = Prefix;
+    else if (!anyEnd)
+	match = Suffix;
+    else
+	match = Contains;
+}
+
+// The part of the pattern before the escape character is translated to a
+// regular expression and the rest is used as it is.
+void SQLLikeExpression::compileRegex(const std::string &str,
+				     size_t escape_pos)
+{
+    match = Regex;
+
+    std::string regexp_str;
+
+    for(size_t pos = 0; pos < escape_pos; pos++)
+    {
+	char c = str[pos];
+
+	if (c == '_')
+	    regexp_str += ".";
+	else if (c ==  '%')
+	    regexp_str += ".*";
+	else if (strchr("+*?.[]^$(){}|\\", c) != 0)
+	{
+	    regexp_str += '\\';
+	    regexp_str += c;
+	}
+	else
+	    regexp_str += c;
+    }
+
+    regexp_str += str.substr(escape_pos + 1);
+
+    // Regexp needs to be anchored at the start and end of the string
+    regexp_str = "^" + regexp_str + "$";
+
+    int err = regcomp(&regex, regexp_str.c_str(), REG_EXTENDED);
+    if (err == 0)
+    {
+	err = regcomp(&regexIcase, regexp_str.c_str(),
+		      REG_EXTENDED | REG_ICASE);
+	if (err == 0)
+	    return;
+
+	regfree(&regex);
+    }
+
+    char buf[256];
+    regerror(err, 0, buf, sizeof(buf));
+    regexError = "Invalid regular expression in like pattern '" +
+	pattern + "': " + buf;
+}
+
+SQLLikeExpression::~SQLLikeExpression()
+{
+    if (match == Regex && regexError.empty())
+    {
+	regfree(&regex);
+	regfree(&regexIcase);
+    }
+}
+
+static inline bool equalChar(char c1, char c2, bool icase)
+{
+    return c1 == c2 ||
+	(icase && tolower((unsigned char)c1) == tolower((unsigned char)c2));
+}
+
+// Compare the characters of a segment where '_' matches any character
+static bool matchSegment(const char *s, const std::string &seg, bool icase)
+{
+    for (size_t i = 0; i < seg.length(); i++)
+	if (seg[i] != '_' && !equalChar(s[i], seg[i], icase))
+	    return false;
+
+    return true;
+}
+
+// Compare the characters of a literal
+static inline bool matchLiteral(const char *s, const std::string &lit,
+				bool icase)
+{
+    if (!icase)
+	return memcmp(s, lit.data(), lit.length()) == 0;
+
+    return matchSegment(s, lit, icase);
+}
+
+// Find the first occurrence of a segment in s or return 0
+static const char *findSegment(const char *s, size_t len,
+			       const std::string &seg, bool icase,
+			       bool wildcards)
+{
+    size_t n = seg.length();
+    if (n > len)
+	return 0;
+
+#ifndef __WIN32__
+    if (!icase && !wildcards)
+	return (const char *)memmem(s, len, seg.data(), n);
+#endif
+
+    for (size_t i = 0; i + n <= len; i++)
+	if (matchSegment(s + i, seg, icase))
+	    return s + i;
+
+    return 0;
+}
+
+// Match a general pattern. The first and last segments are anchored unless
+// the pattern starts or ends with '%'. Each segment in between matches at
+// its first occurrence after the previous one as this leaves the most room
+// for the rest of the pattern.
+bool SQLLikeExpression::matchWildcard(const char *s, size_t len,
+				      bool icase) const
+{
+    size_t first = 0;
+    size_t last = segments.size();
+
+    if (!anyStart)
+    {
+	if (last == 0)
+	    return len == 0;
+
+	const std::string &seg = segments[0];
+	if (seg.length() > len || !matchSegment(s, seg, icase))
+	    return false;
+
+	s += seg.length();
+	len -= seg.length();
+	first = 1;
+
+	if (!anyEnd && last == 1)
+	    return len == 0;
+    }
+
+    if (!anyEnd && last > first)
+    {
+	const std::string &seg = segments[last - 1];
+	if (seg.length() > len ||
+	    !matchSegment(s + len - seg.length(), seg, icase))
+	    return false;
+
+	len -= seg.length();
+	last--;
+    }
+
+    for (size_t i = first; i < last; i++)
+    {
+	const std::string &seg = segments[i];
+	const char *p = findSegment(s, len, seg, icase, true);
+	if (p == 0)
+	    return false;
+
+	size_t skip = p - s + seg.length();
+	s += skip;
+	len -= skip;
+    }
+
+    return true;
+}
+
+bool SQLLikeExpression::matches(const char *s, size_t len) const
+{
+    bool icase = SQLStringValue::isCaseInsensitive();
+
+    switch (match)
+    {
+    case Exact:
+	return len == pattern.length() && matchLiteral(s, pattern, icase);
+    case Prefix:
+    {
+	const std::string &lit = segments[0];
+	return len >= lit.length() && matchLiteral(s, lit, icase);
+    }
+    case Suffix:
+    {
+	const std::string &lit = segments[0];
+	return len >= lit.length() &&
+	    matchLiteral(s + len - lit.length(), lit, icase);
+    }
+    case Contains:
+	return segments.empty() ||
+	    findSegment(s, len, segments[0], icase, false) != 0;
+    case Wildcard:
+	return matchWildcard(s, len, icase);
+    case Regex:
+    {
+	if (!regexError.empty())
+	    return false;
+
+	const regex_t *re = icase ? &regexIcase : &regex;
+#ifdef REG_STARTEND
+	regmatch_t range;
+	range.rm_so = 0;
+	range.rm_eo = len;
+
+	return regexec(re, s, 1, &range, REG_STARTEND) == 0;
+#else
+	std::string str(s, len);
+
+	return regexec(re, str.c_str(), 0, 0, 0) == 0;
+#endif
+    }
+    default:
+	assert(0);
+	return false;
+    }
+}
+
+SQLValue SQLLikeExpression::evaluate(SQLContext &context)
 {
-    if (expressions != 0)
+    SQLValue v = expr->evaluate(context);
+    // Exception should just return.
+    if (v.isException())
+	return v;
+
+    if (!regexError.empty())
+	return SQLValue(new SQLExceptionValue(regexError));
+
+    bool res;
+
+    // Match string values in place without copying them
+    size_t len;
+    const char *data = v.stringData(len);
+    if (data != 0)
+	res = matches(data, len);
+    else
     {
-	for(int i = 0; i < numExpr; i++)
-	    expressions[i]->releaseRef();
+	std::string s = v.asString();
 
-	delete[] expressions;
+	res = matches(s.data(), s.length());
     }
+
+    return res ? SQLTrueValue : SQLFalseValue;
 }
 
-void SQLExpressionList::addExpression(SQLExpression *e)
+std::string SQLLikeExpression::asString() const
 {
-    e->getRef();
+    return std::string(shortName()) + "(" + expr->asString() + ", " +
+	pattern + ")";
+}
 
-    SQLExpression **new_expressions =
-	new SQLExpression *[numExpr + 1];
+const char * SQLLikeExpression::shortName() const
+{
+    return "Like";
+}
 
-    int i;
-    for(i = 0; i < numExpr; i++)
-	new_expressions[i] = expressions[i];
+unsigned long SQLLikeExpression::hash() const
+{
+    return hashCombine(SQLUnaryExpression::hash(), hashName(pattern));
+}
 
-    new_expressions[i] = e;
-    numExpr++;
+// Patterns with a regular expression also depend on the escape character
+// so are only equal to themselves.
+bool SQLLikeExpression::equals(const SQLExpression *e) const
+{
+    if (e == this)
+	return true;
+    if (!SQLUnaryExpression::equals(e))
+	return false;
 
-    if (expressions != 0)
-	delete[] expressions;
-    expressions = new_expressions;
+    const SQLLikeExpression *l = static_cast<const SQLLikeExpression *>(e);
+
+    return match != Regex && l->match != Regex && l->pattern == pattern;
 }
 
-int SQLExpressionList::numExpressions()
+SQLValueType SQLLikeExpression::resultType() const
 {
-    return numExpr;
+    return SQLBooleanType;
 }
 
-SQLExpression * SQLExpressionList::expressionNumber(int i)
+bool SQLLikeExpression::canRaise() const
 {
-    if (i < 0 || i >= numExpr)
-	return 0;
+    return !regexError.empty() || expr->canRaise();
+}
 
-    return expressions[i];
+SQLFunctionExpression::SQLFunctionExpression(const std::string &class_name,
+					     const std::string &member_name,
+					     SQLExpressionList *list_)
+: className(class_name), memberName(member_name), list(list_),
+  function(0)
+{
 }
 
-std::string SQLExpressionList::asString() const
+SQLFunctionExpression::~SQLFunctionExpression()
 {
-    std::string str;
+    delete list;
+    delete function;
+}
 
-    str += "{";
+SQLValue SQLFunctionExpression::evaluate(SQLContext &context)
+{
+    int num_args = list->numExpressions();
+    SQLValueArray arguments(num_args);
 
-    for(int i = 0; i < numExpr; i++)
+    for (int i = 0; i < num_args; i++)
     {
-	str += expressions[i]->asString();
+	SQLExpression *e = list->expressionNumber(i);
 
-	if (i < numExpr - 1)
-	    str += ", ";
+	SQLValue a = e->evaluate(context);
+
+	// If the function arguments are Exceptions
+	// then return.
+	if (a.isException())
+	    return a;
+
+	arguments[i].swap(a);
     }
 
-    str += "}";
+    if (function != 0)
+	return function->call(context, num_args, arguments.values());
 
-    return str;
+    return context.functionLookup(className, memberName,
+				  num_args, arguments.values());
 }
 
-// Major expression types
-SQLUnaryExpression::SQLUnaryExpression(SQLExpression *expr_)
-: expr(expr_)
+// Show the parse tree as a string. This is useful for debugging
+std::string SQLFunctionExpression::asString() const
 {
-    expr->getRef();
+    return std::string(shortName()) + "(" + name() + ", " +
+	list->asString() + ")";
 }
 
-SQLUnaryExpression::~SQLUnaryExpression()
+std::string SQLFunctionExpression::name() const
 {
-    // Destroy the children
-    expr->releaseRef();
+    if (className.empty())
+	return memberName;
+    else
+	return className + "." + memberName;
 }
 
-std::string SQLUnaryExpression::asString() const
+const char * SQLFunctionExpression::shortName() const
 {
-    return std::string(shortName()) + "(" + expr->asString() + ")";
+    return "Function";
 }
 
-const char * SQLUnaryExpression::shortName() const
+void SQLFunctionExpression::visitChildren(SQLExpressionVisitor &visitor)
 {
-    return "nUary";
+    list->visitExpressions(visitor);
 }
 
-SQLBinaryExpression::SQLBinaryExpression(SQLExpression *expr1_,
-					 SQLExpression *expr2_)
-: expr1(expr1_), expr2(expr2_)
+SQLValueType SQLFunctionExpression::resultType() const
 {
-    expr1->getRef();
-    expr2->getRef();
+    return function != 0 ? function->returnType() : SQLOtherType;
 }
 
-SQLBinaryExpression::~SQLBinaryExpression()
+// A call resolved through the SQLContext may reach any function of the
+// application, so only the built in functions are known to be pure
+bool SQLFunctionExpression::isPure() const
 {
-    // Destroy the children
-    expr1->releaseRef();
-    expr2->releaseRef();
+    if (function != 0)
+	return function->isPure();
+
+    return SQLContext::isDefaultFunction(className, memberName,
+					 list->numExpressions());
 }
 
-std::string SQLBinaryExpression::asString() const
+unsigned long SQLFunctionExpression::hash() const
 {
-    return std::string(shortName()) + "(" + expr1->asString() + ", " +
-	expr2->asString() + ")";
+    if (!isPure())
+	return SQLExpression::hash();
+
+    return hashCombine(hashName(className + "." + memberName), list->hash());
 }
 
-const char * SQLBinaryExpression::shortName() const
+bool SQLFunctionExpression::equals(const SQLExpression *e) const
 {
-    return "Binary";
+    if (e == this)
+	return true;
+    if (!isPure())
+	return false;
+
+    const SQLFunctionExpression *f =
+	dynamic_cast<const SQLFunctionExpression *>(e);
+
+    return f != 0 && f->className == className &&
+	f->memberName == memberName && list->equals(f->list);
 }
 
+SQLExpression * SQLFunctionExpression::optimise()
+{
+    list->optimise();
 
-bool SQLBinaryExpression::evaluateSiblings(SQLContext &context,
-					   SQLValue &v1, SQLValue &v2)
+    // Only the default functions are known to depend on just their
+    // arguments
+    if (list->isConstant() &&
+	SQLContext::isDefaultFunction(className, memberName,
+				      list->numExpressions()))
+	return fold();
+
+    return this;
+}
+
+SQLExpression * SQLFunctionExpression::bindSchema(const SQLSchema &schema,
+						  std::vector<std::string> &errors)
 {
-    v1 = expr1->evaluate(context);
-    // Exception should just return.
-    if (v1.isException() || v1.isNull())
-        return false;
+    list->bindSchema(schema, errors);
 
-    // Performance optimisation to aim to only do the type conversion once
-    // for things like SQLDateTimeValue
-    SQLValueExpression *ve = dynamic_cast<SQLValueExpression *>(expr2);
-    if (ve != 0)
-        v2 = ve->evaluateAsType(v1);
-    else
-        v2 = expr2->evaluate(context);
+    const SQLFunction *f = schema.findFunction(className, memberName);
+    if (f == 0)
+	return this;
 
-    if (v2.isException() || v2.isNull())
+    int num_args = list->numExpressions();
+    if (!f->acceptsArguments(num_args))
     {
-	v1 = v2;
-	return false;
+	std::stringstream s;
+	s << "Wrong number of arguments to function '" << f->name()
+	  << "': expected " << (f->isVariadic() ? "at least " : "")
+	  << f->numArguments() << " but got " << num_args;
+	errors.push_back(s.str());
+	return this;
     }
 
-    if (v2.isSameType(v1))
-        return true;
+    bool valid = true;
+    for (int i = 0; i < f->numArguments(); i++)
+	if (!checkArgument(i, f->argumentType(i), errors))
+	    valid = false;
 
-    if (v2.typeConvert(v1))
-        return true;
+    if (!valid)
+	return this;
 
-    v1 = SQLValue(new SQLExceptionValue(
-                      "Mismatched types in expression: " +
-                      v1.asString() + " and " + v2.asString()));
-    return false;
+    delete function;
+    function = new SQLFunction(*f);
+
+    if (function->isPure() && list->isConstant())
+	return fold();
+
+    return this;
 }
 
-std::string SQLTerminalExpression::asString() const
+// Check that an argument can be converted to the declared type. As with
+// comparisons, values of other types are converted through a string.
+bool SQLFunctionExpression::checkArgument(int i, SQLValueType type,
+					  std::vector<std::string> &errors)
 {
-    return shortName();
+    SQLExpression *e = list->expressionNumber(i);
+    SQLValueType t = e->resultType();
+
+    if (!isKnownType(type) || !isKnownType(t) || t == type)
+	return true;
+
+    if (e->isConstant())
+    {
+	SQLValue v(constantValue(e));
+
+	if (v.convertToType(type))
+	    return true;
+    }
+    else if (t == SQLStringType || type == SQLStringType ||
+	     (isNumericType(t) && isNumericType(type)))
+	return true;
+
+    std::stringstream s;
+    s << "Mismatched type for argument " << i + 1 << " of function '"
+      << (className.empty() ? memberName : className + "." + memberName)
+      << "': " << e->asString();
+    errors.push_back(s.str());
+    return false;
 }
 
-const char * SQLTerminalExpression::shortName() const
+SQLValue SQLNullExpression::evaluate(SQLContext &context)
 {
-    return "Terminal";
+    SQLValue v = expr->evaluate(context);
+    // Exception should just return.
+    if (v.isException())
+	return v;
+
+    return v.isNull() ? SQLTrueValue : SQLFalseValue;
 }
 
-// Actual expression implementation
-SQLValue SQLEqualsExpression::evaluate(SQLContext &context)
+const char * SQLNullExpression::shortName() const
 {
-    SQLValue v1, v2;
-    if (!evaluateSiblings(context, v1, v2))
-	return v1;
+    return "Null";
+}
 
-    bool res = (v1.compare(v2) == 0);
+SQLValueType SQLNullExpression::resultType() const
+{
+    return SQLBooleanType;
+}
 
+int SQLNullExpression::compile(SQLProgram &program)
+{
+    int r = expr->compile(program);
+    program.emit(SQLProgram::IsNull, r);
 
-    return res ? SQLTrueValue : SQLFalseValue;
+    return r;
 }
 
-const char * SQLEqualsExpression::shortName() const
+SQLValue SQLVariableExpression::evaluate(SQLContext &context)
 {
-    return "Equals";
+    if (slotContext != 0 && typeid(context) == *slotContext)
+	return context.fetch(slot);
+
+    return context.variableLookup(className, memberName);
 }
 
-SQLValue SQLNotEqualsExpression::evaluate(SQLContext &context)
+int SQLVariableExpression::resolve(const SQLContext &context)
 {
-    SQLValue v1, v2;
-    if (!evaluateSiblings(context, v1, v2))
-	return v1;
+    int s = context.resolve(className, memberName);
 
-    bool res = (v1.compare(v2) != 0);
+    if (s >= 0)
+    {
+	slot = s;
+	slotContext = &typeid(context);
+    }
+    else
+    {
+	slot = SQLContext::NO_SLOT;
+	slotContext = 0;
+    }
 
+    return s;
+}
 
-    return res ? SQLTrueValue : SQLFalseValue;
+std::string SQLVariableExpression::name() const
+{
+    if (className.empty())
+	return memberName;
+    else
+	return className + "." + memberName;
 }
 
-const char * SQLNotEqualsExpression::shortName() const
+const char * SQLVariableExpression::shortName() const
 {
-    return "NotEquals";
+    return "Variable";
 }
 
-SQLValue SQLLessThanExpression::evaluate(SQLContext &context)
+unsigned long SQLVariableExpression::hash() const
 {
-    SQLValue v1, v2;
-    if (!evaluateSiblings(context, v1, v2))
-	return v1;
+    return hashCombine(hashName(className), hashName(memberName));
+}
 
-    bool res = (v1.compare(v2) < 0);
+bool SQLVariableExpression::equals(const SQLExpression *e) const
+{
+    if (e == this)
+	return true;
 
-    return res ? SQLTrueValue : SQLFalseValue;
+    const SQLVariableExpression *v =
+	dynamic_cast<const SQLVariableExpression *>(e);
+
+    return v != 0 && v->className == className &&
+	v->memberName == memberName;
 }
 
-const char * SQLLessThanExpression::shortName() const
+int SQLVariableExpression::compile(SQLProgram &program)
 {
-    return "LessThan";
+    int r = program.pushRegister();
+    program.emit(SQLProgram::LoadVariable, r,
+		 program.addVariable(className, memberName, slot, slotContext));
+
+    return r;
 }
 
-SQLValue SQLGreaterThanExpression::evaluate(SQLContext &context)
+SQLExpression * SQLVariableExpression::bindSchema(const SQLSchema &schema,
+						  std::vector<std::string> &)
 {
-    SQLValue v1, v2;
-    if (!evaluateSiblings(context, v1, v2))
-	return v1;
+    type = schema.fieldType(className, memberName);
 
-    bool res = (v1.compare(v2) > 0);
+    return this;
+}
 
-    return res ? SQLTrueValue : SQLFalseValue;
+SQLValueType SQLVariableExpression::resultType() const
+{
+    return type;
 }
 
-const char * SQLGreaterThanExpression::shortName() const
+bool SQLVariableExpression::canRaise() const
 {
-    return "GreaterThan";
+    return false;
 }
 
-SQLValue SQLLessEqualsExpression::evaluate(SQLContext &context)
+std::string SQLVariableExpression::asString() const
 {
-    SQLValue v1, v2;
-    if (!evaluateSiblings(context, v1, v2))
-	return v1;
+    if (className.empty())
+	return memberName;
+    else
+	return className + "." + memberName;
+}
 
-    bool res = (v1.compare(v2) <= 0);
+SQLParameterExpression::SQLParameterExpression(int index_,
+					       const std::string &name_,
+					       SQLParameters *parameters_)
+: index(index_), name(name_), parameters(parameters_)
+{
+    parameters->getRef();
+}
 
-    return res ? SQLTrueValue : SQLFalseValue;
+SQLParameterExpression::~SQLParameterExpression()
+{
+    parameters->releaseRef();
 }
 
-const char * SQLLessEqualsExpression::shortName() const
+const SQLParameters & SQLParameterExpression::lookup(SQLContext &context) const
 {
-    return "LessEquals";
+    const SQLParameters *p = context.getParameters();
+
+    return p != 0 ? *p : *parameters;
 }
 
-SQLValue SQLGreaterEqualsExpression::evaluate(SQLContext &context)
+SQLValue SQLParameterExpression::evaluate(SQLContext &context)
 {
-    SQLValue v1, v2;
-    if (!evaluateSiblings(context, v1, v2))
-	return v1;
+    return lookup(context).value(index);
+}
 
-    bool res = (v1.compare(v2) >= 0);
+bool SQLParameterExpression::canRaise() const
+{
+    return false;
+}
+
+SQLValue SQLParameterExpression::contains(SQLContext &context,
+					  const SQLValue &v)
+{
+    return lookup(context).contains(index, v);
+}
 
-    return res ? SQLTrueValue : SQLFalseValue;
+const char * SQLParameterExpression::shortName() const
+{
+    return "Parameter";
 }
 
-const char * SQLGreaterEqualsExpression::shortName() const
+unsigned long SQLParameterExpression::hash() const
 {
-    return "GreaterEquals";
+    return hashCombine(hashName(shortName()), index);
 }
 
-SQLValue SQLAndExpression::evaluate(SQLContext &context)
+bool SQLParameterExpression::equals(const SQLExpression *e) const
 {
-    SQLValue v1 = expr1->evaluate(context);
-    // Exception should just return.
-    if (v1.isException())
-	return v1;
+    if (e == this)
+	return true;
 
-    // Shortcut false return. Don't shortcut on void as we want this to
-    // walk the entire expression tree.
-    if (!v1.isNull() && !v1.asBoolean())
-	return v1;
+    const SQLParameterExpression *p =
+	dynamic_cast<const SQLParameterExpression *>(e);
 
-    SQLValue v2 = expr2->evaluate(context);
-    if (!v2.asBoolean() || v2.isNull())
-	return v2;
-    else
-	return v1;
+    return p != 0 && p->index == index && p->parameters == parameters;
 }
 
-const char * SQLAndExpression::shortName() const
+std::string SQLParameterExpression::asString() const
 {
-    return "And";
+    if (!name.empty())
+	return ":" + name;
+
+    std::stringstream s;
+    s << "?" << index;
+
+    return s.str();
 }
 
-SQLValue SQLOrExpression::evaluate(SQLContext &context)
+SQLValueExpression::SQLValueExpression(SQLValue value_)
+: value(value_)
 {
-    SQLValue v1 = expr1->evaluate(context);
-    // Exception should just return.
-    if (v1.isException())
-	return v1;
+    for (int t = 0; t < SQLExceptionType; t++)
+    {
+	typedValues[t] = value;
 
-    // Shortcut true return
-    if (v1.asBoolean())
-	return v1;
+	if (value.isNull() || value.isException())
+	    continue;
 
-    SQLValue v2 = expr2->evaluate(context);
-    if (v2.asBoolean() || v2.isNull())
-	return v2;
-    else
-	return v1;
+	SQLValue v = value;
+	if (v.convertToType((SQLValueType)t))
+	    typedValues[t] = v;
+    }
 }
 
-const char * SQLOrExpression::shortName() const
+SQLValue SQLValueExpression::evaluate(SQLContext &)
 {
-    return "Or";
+    return value;
 }
 
-SQLValue SQLXorExpression::evaluate(SQLContext &context)
+const char * SQLValueExpression::shortName() const
 {
-    SQLValue v1 = expr1->evaluate(context);
-    SQLValue v2 = expr2->evaluate(context);
-    // Exception should just return.
-    if (v1.isException())
-       return v1;
-    if (v2.isException())
-       return v2;
-
-    bool b1 = v1.asBoolean();
-    bool b2 = v2.asBoolean();
-    if (b1 ^ b2)
-       return SQLTrueValue;
-    else
-       return SQLFalseValue;
+    return "Value";
 }
 
-const char * SQLXorExpression::shortName() const
+unsigned long SQLValueExpression::hash() const
 {
-    return "Xor";
+    return hashCombine(value.type(), value.hash());
 }
 
-SQLValue SQLOperationExpression::evaluate(SQLContext &context)
+bool SQLValueExpression::equals(const SQLExpression *e) const
 {
-    SQLValue v1, v2;
-    if (!evaluateSiblings(context, v1, v2))
-	return v1;
+    if (e == this)
+	return true;
 
-    return v1.binaryOperation(v2, op);
+    const SQLValueExpression *v = dynamic_cast<const SQLValueExpression *>(e);
+
+    return v != 0 && v->value.type() == value.type() &&
+	v->value.asString() == value.asString();
 }
 
-const char * SQLOperationExpression::shortName() const
+SQLValueType SQLValueExpression::resultType() const
 {
-    return "Operation";
+    return value.type();
 }
 
-std::string SQLOperationExpression::asString() const
+bool SQLValueExpression::isConstant() const
 {
-    std::string s(1, op);
-    return std::string(shortName()) + "(" + expr1->asString() + " " + s + " " +
-	expr2->asString() + ")";
+    return true;
 }
 
-SQLValue SQLNotExpression::evaluate(SQLContext &context)
+bool SQLValueExpression::canRaise() const
 {
-    SQLValue v = expr->evaluate(context);
-    // Void or exception should just return.
-    if (v.isNull() || v.isException())
-	return v;
-
-    return v.asBoolean() ? SQLFalseValue : SQLTrueValue;
+    return value.isException();
 }
 
-const char * SQLNotExpression::shortName() const
+int SQLValueExpression::compile(SQLProgram &program)
 {
-    return "Not";
+    int r = program.pushRegister();
+    program.emit(SQLProgram::LoadConstant, r, program.addConstant(this));
+
+    return r;
 }
 
-SQLValue SQLNegateExpression::evaluate(SQLContext &context)
+std::string SQLValueExpression::asString() const
 {
-    SQLValue v = expr->evaluate(context);
+    return value.asString();
+}
 
-    return v.unaryOperation('-');
+// Apply a SQLProgram::Test to two values of the same type
+template <class T>
+static inline bool testValues(int test, T v1, T v2)
+{
+    switch (test)
+    {
+    case SQLProgram::Equals:
+	return v1 == v2;
+    case SQLProgram::NotEquals:
+	return v1 != v2;
+    case SQLProgram::LessThan:
+	return v1 < v2;
+    case SQLProgram::GreaterThan:
+	return v1 > v2;
+    case SQLProgram::LessEquals:
+	return v1 <= v2;
+    case SQLProgram::GreaterEquals:
+	return v1 >= v2;
+    default:
+	assert(0);
+	return false;
+    }
 }
 
-const char * SQLNegateExpression::shortName() const
+SQLConstantCompareExpression::SQLConstantCompareExpression(SQLExpression *expr,
+							   const SQLValue &constant,
+							   int test)
+: SQLUnaryExpression(expr), value(constant), test_(test)
 {
-    return "Negate";
+    assert(isSpecialised(value.type()));
 }
 
-SQLInExpression::SQLInExpression(SQLExpression *expr_,
-				 SQLExpressionList *list_)
-: expr(expr_), list(list_)
+bool SQLConstantCompareExpression::isSpecialised(SQLValueType type)
 {
-    expr->getRef();
+    return type == SQLIntegerType || type == SQLRealType ||
+	type == SQLStringType || type == SQLDateTimeType;
 }
 
-SQLInExpression::~SQLInExpression()
+bool SQLConstantCompareExpression::matches(const SQLValue &v) const
 {
-    delete list;
+    switch (value.type())
+    {
+    case SQLIntegerType:
+	return testValues(test_, v.integerValue(), value.integerValue());
+    case SQLRealType:
+	return testValues(test_, v.realValue(), value.realValue());
+#if SQL_DATE_SUPPORT
+    case SQLDateTimeType:
+	return testValues(test_, v.dateTimeValue(), value.dateTimeValue());
+#endif
+    case SQLStringType:
+    {
+	size_t l1, l2;
+	const char *s1 = v.stringData(l1);
+	const char *s2 = value.stringData(l2);
 
-    expr->releaseRef();
+	return testValues(test_,
+			  SQLStringValue::compareStrings(s1, l1, s2, l2), 0);
+    }
+    default:
+	return testValues(test_, v.compare(value), 0);
+    }
 }
 
-SQLValue SQLInExpression::evaluate(SQLContext &context)
+SQLValue SQLConstantCompareExpression::evaluate(SQLContext &context)
 {
-    SQLValue v1 = expr->evaluate(context);
-    // Exception should just return.
-    if (v1.isException() || v1.isNull())
-	return v1;
-
-    bool got_null = false;
+    SQLValue v = expr->evaluate(context);
 
-    for (int i = 0; i < list->numExpressions(); i++)
+    if (v.type() != value.type())
     {
-	SQLExpression *e = list->expressionNumber(i);
-
-	SQLValue v2 = e->evaluate(context);
-	if (v2.isException())
-	    return v2;
+	// Exception or null should just return.
+	if (v.isNull() || v.isException())
+	    return v;
 
-        if (v2.isNull())
-        {
-            got_null = true;
-            continue;
-        }
+	// The context returned a value of another type so convert
+	SQLValue c(value);
+	if (!SQLBinaryExpression::matchSiblings(v, c))
+	    return v;
 
-	// Convert v2 to the same type as v1
-	if (!v2.typeConvert(v1))
-	    return SQLValue(new SQLExceptionValue(
-                            "Mismatched types in list expression:" +
-                            v1.asString() + " and " + v2.asString()));
-	if (v1.compare(v2) == 0)
-	    return SQLTrueValue;
+	return testValues(test_, v.compare(c), 0) ? SQLTrueValue : SQLFalseValue;
     }
 
-    if (got_null)
-        return SQLValue();
-    else
-        return SQLFalseValue;
-}
-
-// Show the parse tree as a string. This is useful for debugging
-std::string SQLInExpression::asString() const
-{
-    return std::string(shortName()) + "(" + expr->asString() + ", " +
-	list->asString() + ")";
+    return matches(v) ? SQLTrueValue : SQLFalseValue;
 }
 
-const char * SQLInExpression::shortName() const
+SQLValueType SQLConstantCompareExpression::resultType() const
 {
-    return "In";
+    return SQLBooleanType;
 }
 
-SQLLikeExpression::SQLLikeExpression(SQLExpression *expr,
-                                     const std::string &pattern,
-				     const std::string &escape)
-: SQLUnaryExpression(expr)
+// Name of one of the specialised types
+static const char *typeName(SQLValueType type)
 {
-    std::string regexp_str;
-    char escape_char = '\0';
-    if (escape.length() > 0)
-	escape_char = escape[0];
-
-    size_t pos;
-    for(pos = 0; pos < pattern.length(); pos++)
+    switch (type)
     {
-	char c = pattern[pos];
-
-	if (c == escape_char)
-	{
-	    regexp_str += pattern.substr(pos + 1, pattern.length() - pos - 1);
-	    break;
-	}
-	else if (c == '_')
-	    regexp_str += ".";
-	else if (c ==  '%')
-	    regexp_str += ".*";
-	else if (c == '+' || c == '*' || c == '?' || c == '.' ||
-		 c == '[' || c == ']' || c == '^' || c == '$')
-	    regexp_str += "\\" + c;
-	else
-	    regexp_str.append(&c, 1);
+    case SQLIntegerType:
+	return "Integer";
+    case SQLRealType:
+	return "Real";
+    case SQLStringType:
+	return "String";
+    case SQLDateTimeType:
+	return "DateTime";
+    default:
+	return "";
     }
+}
 
-    // Regexp needs to be anchored at the start and end of the string
-    regexp_str = "^" + regexp_str + "$";
+std::string SQLConstantCompareExpression::asString() const
+{
+    return std::string(typeName(value.type())) +
+	SQLProgram::testName(test_) + "(" + expr->asString() + ", " +
+	value.asString() + ")";
+}
 
-    regcomp(&regex, regexp_str.c_str(), REG_EXTENDED);
+const char * SQLConstantCompareExpression::shortName() const
+{
+    return "ConstantCompare";
 }
 
-SQLLikeExpression::~SQLLikeExpression()
+unsigned long SQLConstantCompareExpression::hash() const
 {
-    regfree(&regex);
+    return hashCombine(hashCombine(SQLUnaryExpression::hash(), test_),
+		       value.hash());
 }
 
-SQLValue SQLLikeExpression::evaluate(SQLContext &context)
+bool SQLConstantCompareExpression::equals(const SQLExpression *e) const
 {
-    SQLValue v = expr->evaluate(context);
-    // Exception should just return.
-    if (v.isException())
-	return v;
+    if (e == this)
+	return true;
+    if (!SQLUnaryExpression::equals(e))
+	return false;
 
-    std::string s = v.asString();
+    const SQLConstantCompareExpression *c =
+	static_cast<const SQLConstantCompareExpression *>(e);
 
-    if (regexec(&regex, s.c_str(), 0, 0, 0) == 0)
-	return SQLTrueValue;
-    else
-	return SQLFalseValue;
+    return c->test_ == test_ && c->value.type() == value.type() &&
+	c->value.asString() == value.asString();
 }
 
-std::string SQLLikeExpression::asString() const
+SQLRangeExpression::SQLRangeExpression(SQLConstantCompareExpression *lower_,
+				       SQLConstantCompareExpression *upper_)
+: SQLAndExpression(lower_, upper_), lower(lower_), upper(upper_)
 {
-    return std::string(shortName()) + "(" + expr->asString() + ", <regexp>)";
 }
 
-const char * SQLLikeExpression::shortName() const
+static bool isLowerBound(int test)
 {
-    return "Like";
+    return test == SQLProgram::GreaterThan || test == SQLProgram::GreaterEquals;
 }
 
-SQLFunctionExpression::SQLFunctionExpression(const std::string &class_name,
-					     const std::string &member_name,
-					     SQLExpressionList *list_)
-: className(class_name), memberName(member_name), list(list_)
+static bool isUpperBound(int test)
 {
+    return test == SQLProgram::LessThan || test == SQLProgram::LessEquals;
 }
 
-SQLFunctionExpression::~SQLFunctionExpression()
+// Return a range if the comparisons are a lower and upper bound of the
+// same variable, otherwise 0.
+SQLRangeExpression * SQLRangeExpression::create(SQLExpression *e1,
+						SQLExpression *e2)
 {
-    delete list;
+    SQLConstantCompareExpression *c1 =
+	dynamic_cast<SQLConstantCompareExpression *>(e1);
+    SQLConstantCompareExpression *c2 =
+	dynamic_cast<SQLConstantCompareExpression *>(e2);
+    if (c1 == 0 || c2 == 0 ||
+	c1->constant().type() != c2->constant().type())
+	return 0;
+
+    // Between uses the same node for both comparisons
+    SQLExpression *v1 = c1->operand();
+    SQLExpression *v2 = c2->operand();
+    if (v1 != v2 &&
+	(dynamic_cast<SQLVariableExpression *>(v1) == 0 ||
+	 dynamic_cast<SQLVariableExpression *>(v2) == 0 ||
+	 v1->asString() != v2->asString()))
+	return 0;
+
+    if (isLowerBound(c1->test()) && isUpperBound(c2->test()))
+	return new SQLRangeExpression(c1, c2);
+    if (isUpperBound(c1->test()) && isLowerBound(c2->test()))
+	return new SQLRangeExpression(c2, c1);
+
+    return 0;
 }
 
-SQLValue SQLFunctionExpression::evaluate(SQLContext &context)
+SQLValue SQLRangeExpression::evaluate(SQLContext &context)
 {
-    int num_args = list->numExpressions();
-    SQLValue *arguments = new SQLValue[num_args];
+    SQLValue v = lower->operand()->evaluate(context);
 
-    for (int i = 0; i < num_args; i++)
+    if (v.type() != lower->constant().type())
     {
-	SQLExpression *e = list->expressionNumber(i);
+	// Exception or null should just return.
+	if (v.isNull() || v.isException())
+	    return v;
 
-	SQLValue a = e->evaluate(context);
+	return SQLAndExpression::evaluate(context);
+    }
 
-	// If the function arguments are Exceptions
-	// then return.
-	if (a.isException())
-	{
-	    delete [] arguments;
-	    return a;
-	}
+    return lower->matches(v) && upper->matches(v) ?
+	SQLTrueValue : SQLFalseValue;
+}
 
-	arguments[i] = a;
-    }
+int SQLRangeExpression::compile(SQLProgram &program)
+{
+    // Evaluate as a tree so the variable is only looked up once
+    return SQLExpression::compile(program);
+}
 
-    SQLValue v = context.functionLookup(className, memberName,
-					num_args, arguments);
-    delete [] arguments;
+std::string SQLRangeExpression::asString() const
+{
+    return std::string(shortName()) + "(" + lower->operand()->asString() +
+	", " + (lower->test() == SQLProgram::GreaterEquals ? "[" : "(") +
+	lower->constant().asString() + ", " + upper->constant().asString() +
+	(upper->test() == SQLProgram::LessEquals ? "]" : ")") + ")";
+}
 
-    return v;
+const char * SQLRangeExpression::shortName() const
+{
+    return "Range";
 }
 
-// Show the parse tree as a string. This is useful for debugging
-std::string SQLFunctionExpression::asString() const
+// The bounds share the operand, which the range evaluates once
+void SQLRangeExpression::visitChildren(SQLExpressionVisitor &visitor)
 {
-    std::string name;
-    if (className.empty())
-	name = memberName;
-    else
-	name = className + "." + memberName;
+    SQLExpression *e = lower->operand();
 
-    return std::string(shortName()) + "(" + name + ", " + list->asString() + ")";
+    e->getRef();
+    visitor.visit(e);
+    lower->setOperand(e);
+    upper->setOperand(e);
+    e->releaseRef();
 }
 
-const char * SQLFunctionExpression::shortName() const
+SQLCommonExpression::SQLCommonExpression(SQLExpression *expr, int slot_)
+: SQLUnaryExpression(expr), slot(slot_)
 {
-    return "Function";
 }
 
-SQLValue SQLNullExpression::evaluate(SQLContext &context)
+const char * SQLCommonExpression::shortName() const
 {
-    SQLValue v = expr->evaluate(context);
-    // Exception should just return.
-    if (v.isException())
-	return v;
+    return "Common";
+}
 
-    return v.isNull() ? SQLTrueValue : SQLFalseValue;
+std::string SQLCommonExpression::asString() const
+{
+    return expr->asString();
 }
 
-const char * SQLNullExpression::shortName() const
+// Equal sub-expressions are found while some are already shared
+unsigned long SQLCommonExpression::hash() const
 {
-    return "Null";
+    return expr->hash();
 }
 
-SQLValue SQLVariableExpression::evaluate(SQLContext &context)
+bool SQLCommonExpression::equals(const SQLExpression *e) const
 {
-    return context.variableLookup(className, memberName);
+    return e == this || expr->equals(e);
 }
 
-const char * SQLVariableExpression::shortName() const
+SQLValueType SQLCommonExpression::resultType() const
 {
-    return "Variable";
+    return expr->resultType();
 }
 
-std::string SQLVariableExpression::asString() const
+SQLValue SQLCommonExpression::evaluate(SQLContext &context)
 {
-    if (className.empty())
-	return memberName;
-    else
-	return className + "." + memberName;
+    SQLMemo *memo = context.getMemo();
+    if (memo == 0)
+	return expr->evaluate(context);
+
+    unsigned long long bit = 1ULL << slot;
+    SQLValue &v = memo->values[slot];
+
+    if (!(memo->filled & bit))
+    {
+	v = expr->evaluate(context);
+	memo->filled |= bit;
+    }
+
+    return v;
 }
 
-SQLValueExpression::SQLValueExpression(SQLValue value_)
-: value(value_)
+SQLCommonScopeExpression::SQLCommonScopeExpression(SQLExpression *expr,
+						   int num_slots)
+: SQLUnaryExpression(expr), slots(num_slots), program(0)
 {
 }
 
-SQLValue SQLValueExpression::evaluate(SQLContext &)
+SQLCommonScopeExpression::~SQLCommonScopeExpression()
 {
-    return value;
+    delete program;
 }
 
-// Extension to allow caching the type conversions
-SQLValue SQLValueExpression::evaluateAsType(const SQLValue &v2)
+const char * SQLCommonScopeExpression::shortName() const
 {
-    if (value.isSameType(v2))
-        return value;
+    return "CommonScope";
+}
 
-    if (typedValue.isSameType(v2))
-        return typedValue;
+std::string SQLCommonScopeExpression::asString() const
+{
+    return expr->asString();
+}
 
-    // FIXME Messy
-    std::string s = value.asString();
-    typedValue = SQLValue(new SQLStringValue(s));
-    if (typedValue.typeConvert(v2))
-        return typedValue;
-    else
-        return value;
+SQLValueType SQLCommonScopeExpression::resultType() const
+{
+    return expr->resultType();
 }
 
-const char * SQLValueExpression::shortName() const
+// The expression is compiled on its own so it is run with the SQLMemo set
+int SQLCommonScopeExpression::compile(SQLProgram &p)
 {
-    return "Value";
+    if (program == 0)
+	program = new SQLProgram(expr);
+
+    return SQLExpression::compile(p);
 }
 
-std::string SQLValueExpression::asString() const
+SQLValue SQLCommonScopeExpression::evaluate(SQLContext &context)
 {
-    return value.asString();
+    // Most expressions have only a few common sub-expressions
+    SQLValue small[SMALL_SLOTS];
+    SQLValueArray values(slots > SMALL_SLOTS ? slots : 0);
+
+    SQLMemo memo;
+    memo.values = slots > SMALL_SLOTS ? values.values() : small;
+    memo.filled = 0;
+
+    SQLMemo *outer = context.getMemo();
+    context.setMemo(&memo);
+    SQLValue v = program != 0 ? program->evaluate(context) :
+	expr->evaluate(context);
+    context.setMemo(outer);
+
+    return v;
 }
@@ -12,9 +12,34 @@
 #define EXPRESSION_H
 
 #include "SQLValue.h"
+#include <typeinfo>
+#include "SQLValueSet.h"
+#include "SQLAtomic.h"
 #include <regex.h>
+#include <vector>
 
 class SQLContext;
+class SQLFunction;
+class SQLParameters;
+class SQLPredicateHandler;
+class SQLProgram;
+class SQLReferences;
+class SQLSchema;
+class SQLParameterExpression;
+class SQLExpression;
+
+/**
+ * Called for each sub-expression of an expression by
+ * SQLExpression::visitChildren().
+ */
+class SQLExpressionVisitor
+{
+public:
+    virtual ~SQLExpressionVisitor() { ; }
+
+    /** The visitor may replace e, which the parent holds a reference to */
+    virtual void visit(SQLExpression *&e) = 0;
+};
 
 /**
  * SQLExpression evaluation classes.
@@ -26,6 +51,111 @@ public:
 
     virtual SQLValue evaluate(SQLContext &context) = 0;
 
+    /**
+     * Add the instructions that evaluate this expression to program and
+     * return the register that will hold the result. By default the
+     * expression is evaluated as a tree by the program.
+     */
+    virtual int compile(SQLProgram &program);
+
+    /**
+     * Return an expression that evaluates to the same result with constant
+     * sub-expressions folded into values and redundant logic removed. The
+     * result is this expression, one of its children or a new expression.
+     */
+    virtual SQLExpression *optimise();
+
+    /**
+     * Replace e, which the caller holds a reference to, with its optimised
+     * form.
+     */
+    static void optimiseTree(SQLExpression *&e);
+
+    /**
+     * Check the expression against the types declared for the variables
+     * in schema, adding a message to errors for each type error. Returns an
+     * expression that evaluates to the same result with comparisons
+     * replaced by versions specialised for the types of their operands.
+     * The context must return values of the declared types, null or an
+     * exception.
+     */
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+
+    /** Replace e, which the caller holds a reference to, with its bound form */
+    static void bindTree(SQLExpression *&e, const SQLSchema &schema,
+			 std::vector<std::string> &errors);
+
+    /**
+     * Return the type of the result when it is not null or an exception, or
+     * SQLOtherType if the type is not known until the expression is
+     * evaluated.
+     */
+    virtual SQLValueType resultType() const;
+
+    /** True if the expression always evaluates to a boolean, null or exception */
+    bool isPredicate() const { return resultType() == SQLBooleanType; }
+
+    /** True if the expression is a SQLValueExpression */
+    virtual bool isConstant() const;
+
+    /**
+     * True if the expression may give an exception for some rows. This is
+     * decided from the structure alone so a division, a function or a
+     * type conversion that may fail is taken to raise one. A variable is
+     * taken to be found for every row or for none.
+     */
+    virtual bool canRaise() const;
+
+    /** Call the visitor for each sub-expression in turn */
+    virtual void visitChildren(SQLExpressionVisitor &visitor);
+
+    /**
+     * Return a hash of the structure of the expression. Expressions that
+     * are equal have the same hash.
+     */
+    virtual unsigned long hash() const;
+
+    /**
+     * True if e has the same structure as this expression so always
+     * evaluates to the same value for a row. By default an expression is
+     * only equal to itself.
+     */
+    virtual bool equals(const SQLExpression *e) const;
+
+    /**
+     * Replace the sub-expressions that occur more than once in e, which
+     * the caller holds a reference to, with a SQLCommonExpression so each
+     * is evaluated at most once for a row.
+     */
+    static void eliminateCommon(SQLExpression *&e);
+
+    /**
+     * Resolve the variables in e to slots of the context. The expression
+     * is then evaluated faster with contexts of the same class chained to
+     * contexts of the same classes. Other contexts look the variables up
+     * by name. Variables that none of the contexts have are added to
+     * errors once each.
+     */
+    static void resolveVariables(SQLExpression *e, const SQLContext &context,
+				 std::vector<std::string> &errors);
+
+    /**
+     * Add the variables and functions that e references to refs along
+     * with how each variable is used.
+     */
+    static void findReferences(SQLExpression *e, SQLReferences &refs);
+
+    /**
+     * Split e, which the caller holds a reference to, into the predicates
+     * that must all be true for a row to match. Each predicate on a single
+     * variable is offered to the handler. e is replaced by the rest of
+     * the expression, which matches the same rows as e when it is only
+     * given rows that the handler selected for the predicates it
+     * accepted. If every predicate was accepted this is the constant true.
+     */
+    static void pushDown(SQLExpression *&e, SQLPredicateHandler &handler);
+
     /** Show the parse tree as a string. This is useful for debugging */
     virtual std::string asString() const = 0;
     virtual const char *shortName() const = 0;
@@ -33,19 +163,25 @@ public:
     static SQLValue SQLTrueValue;
     static SQLValue SQLFalseValue;
 
-    void getRef() { refCount++; }
+    void getRef() { refCount.add(1); }
 
     void releaseRef() 
     {
-        refCount--;
-
-        if (refCount <= 0)
+        if (refCount.add(-1) <= 0)
             delete this;
     }
 
 protected:
     virtual ~SQLExpression();
-    int refCount;
+
+    /** Cached expressions are shared by queries in several threads */
+    SQLAtomic<int> refCount;
+
+    /** Evaluate an expression of constants and return it as a value */
+    SQLExpression *fold();
+
+    /** Replace e, which the caller holds a reference to, with o */
+    static void replace(SQLExpression *&e, SQLExpression *o);
 };
 
 
@@ -63,6 +199,20 @@ public:
     int numExpressions();
     SQLExpression *expressionNumber(int i);
 
+    /** Optimise each expression in the list */
+    void optimise();
+
+    /** Bind each expression in the list to the schema */
+    void bindSchema(const SQLSchema &schema,
+		    std::vector<std::string> &errors);
+
+    /** True if every expression in the list is a constant */
+    bool isConstant() const;
+
+    void visitExpressions(SQLExpressionVisitor &visitor);
+    unsigned long hash() const;
+    bool equals(const SQLExpressionList *l) const;
+
     std::string asString() const;
 
 protected:
@@ -81,6 +231,19 @@ public:
     SQLUnaryExpression(SQLExpression *expr);
     virtual std::string asString() const;
     virtual const char *shortName() const;
+    virtual SQLExpression *optimise();
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+    virtual void visitChildren(SQLExpressionVisitor &visitor);
+
+    /** By default only the operand can give an exception */
+    virtual bool canRaise() const;
+
+    /** Equal to an expression of the same class with an equal operand */
+    virtual unsigned long hash() const;
+    virtual bool equals(const SQLExpression *e) const;
+
+    SQLExpression *operand() const { return expr; }
 
 protected:
     virtual ~SQLUnaryExpression();
@@ -97,6 +260,30 @@ public:
     SQLBinaryExpression(SQLExpression *expr1, SQLExpression *expr2);
     virtual std::string asString() const;
     virtual const char *shortName() const;
+    virtual SQLExpression *optimise();
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+    virtual void visitChildren(SQLExpressionVisitor &visitor);
+
+    /**
+     * By default the operands are compared, which raises if either
+     * operand does or their types may not convert to each other.
+     */
+    virtual bool canRaise() const;
+
+    /** Equal to an expression of the same class with equal operands */
+    virtual unsigned long hash() const;
+    virtual bool equals(const SQLExpression *e) const;
+
+    /**
+     * Convert v2 to the type of v1 so they can be compared. If this is
+     * not possible the result of the expression is left in v1 and false
+     * is returned.
+     */
+    static bool matchSiblings(SQLValue &v1, SQLValue &v2);
+
+    SQLExpression *firstOperand() const { return expr1; }
+    SQLExpression *secondOperand() const { return expr2; }
 
 protected:
     virtual ~SQLBinaryExpression();
@@ -105,6 +292,11 @@ protected:
 
     bool evaluateSiblings(SQLContext &context,
 			  SQLValue &v1, SQLValue &v2);
+    int compileSiblings(SQLProgram &program, int op, int arg);
+    void preType();
+    bool checkTypes(std::vector<std::string> &errors);
+    SQLExpression *bindComparison(const SQLSchema &schema,
+				  std::vector<std::string> &errors, int test);
 };
 
 /**
@@ -129,6 +321,10 @@ public:
     virtual const char *shortName() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+    virtual SQLValueType resultType() const;
 };
 
 /**
@@ -143,6 +339,10 @@ public:
     virtual const char *shortName() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+    virtual SQLValueType resultType() const;
 };
 
 /**
@@ -157,6 +357,10 @@ public:
     virtual const char *shortName() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+    virtual SQLValueType resultType() const;
 };
 
 /**
@@ -171,6 +375,10 @@ public:
     virtual const char *shortName() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+    virtual SQLValueType resultType() const;
 };
 
 /**
@@ -185,6 +393,10 @@ public:
     virtual const char *shortName() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+    virtual SQLValueType resultType() const;
 };
 
 /**
@@ -199,6 +411,30 @@ public:
     virtual const char *shortName() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+    virtual SQLValueType resultType() const;
+};
+
+/**
+ * Subnet match SQLExpression. True if the IP address on the left lies
+ * within the subnet on the right.
+ */
+class SQLWithinExpression
+: public SQLBinaryExpression
+{
+public:
+    SQLWithinExpression(SQLExpression *expr1, SQLExpression *expr2)
+        : SQLBinaryExpression(expr1, expr2) { ; }
+    virtual const char *shortName() const;
+
+    SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+    virtual SQLValueType resultType() const;
+    virtual bool canRaise() const;
 };
 
 /**
@@ -213,6 +449,12 @@ public:
     virtual const char *shortName() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+    virtual SQLExpression *optimise();
+    virtual SQLValueType resultType() const;
+    virtual bool canRaise() const;
 };
 
 /**
@@ -227,6 +469,137 @@ public:
     virtual const char *shortName() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLExpression *optimise();
+    virtual SQLValueType resultType() const;
+    virtual bool canRaise() const;
+};
+
+/**
+ * 'AND' or 'OR' of a chain of predicates. The result is decided by the
+ * first operand that is false for 'AND' or true for 'OR', so the operands
+ * are tried in the order that is expected to cost the least. The cost and
+ * the rate at which each operand decides the result are sampled while
+ * evaluating and the operands reordered every so often.
+ *
+ * The result is the same as for the operands in the order they were
+ * written, including nulls. An operand is only moved ahead of operands
+ * that cannot give an exception, as told by canRaise(), so one that is
+ * tried early never hides an exception. Sampled evaluations try every
+ * operand in the written order, and once an operand has given an
+ * exception the chain is no longer reordered so exceptions are returned
+ * as they would have been.
+ */
+class SQLLogicChainExpression
+: public SQLExpression
+{
+public:
+    virtual SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLExpression *optimise();
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+    virtual SQLValueType resultType() const;
+    virtual bool canRaise() const;
+
+    /** Show the parse tree as a string. This is useful for debugging */
+    virtual std::string asString() const;
+
+    virtual void visitChildren(SQLExpressionVisitor &visitor);
+    virtual unsigned long hash() const;
+    virtual bool equals(const SQLExpression *e) const;
+
+    /** Return the operands in the order they were written */
+    int numOperands() const;
+    SQLExpression *operandNumber(int i) const;
+
+    /** Return the operand that is currently tried at position i */
+    int evaluationOrder(int i) const;
+
+    /**
+     * Clear the statistics and the compiled operands after the operands
+     * have changed. Visiting the operands does not do this, so a pass
+     * that replaces them must. It must not be called while the chain may
+     * be evaluated.
+     */
+    void reset();
+
+    enum
+    {
+	MAX_OPERANDS = 64,
+	/** One in this many evaluations is sampled */
+	SAMPLE_RATE = 16,
+	/** Reorder after this many samples */
+	REORDER_SAMPLES = 64
+    };
+
+protected:
+    SQLLogicChainExpression(bool decides);
+    ~SQLLogicChainExpression();
+
+    /** The value of an operand that decides the result */
+    bool decides;
+    std::vector<SQLExpression *> operands;
+    std::vector<SQLProgram *> programs;
+
+    struct Statistics
+    {
+	SQLAtomic<unsigned long> evaluations;
+	SQLAtomic<unsigned long> decisions;
+	/** Nanoseconds spent in the sampled evaluations */
+	SQLAtomic<unsigned long> cost;
+	/** Set if later operands must not be moved ahead of this one */
+	bool canRaise;
+    };
+
+    Statistics *statistics;
+    SQLAtomic<unsigned char> *order;
+    SQLAtomic<unsigned long> samples;
+    SQLAtomic<int> reordering;
+    /** Set once an operand raises an exception to keep the written order */
+    SQLAtomic<int> raised;
+
+    /** Add an operand, taking the operands of a chain of the same type */
+    void addOperand(SQLExpression *e, bool merge);
+    virtual bool canMerge(SQLExpression *e) const = 0;
+
+    void reorder();
+
+    SQLValue evaluateOperand(int i, SQLContext &context);
+    SQLValue evaluateSample(SQLContext &context);
+    SQLValue evaluateInOrder(SQLContext &context, SQLValue *values);
+};
+
+/**
+ * 'AND' of a chain of predicates.
+ */
+class SQLAndChainExpression
+: public SQLLogicChainExpression
+{
+public:
+    SQLAndChainExpression(SQLExpression *expr1, SQLExpression *expr2);
+    virtual const char *shortName() const;
+
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+
+protected:
+    virtual bool canMerge(SQLExpression *e) const;
+};
+
+/**
+ * 'OR' of a chain of predicates. Only the first operand of a chain can
+ * give an exception as the result so a chain on the right is not merged.
+ */
+class SQLOrChainExpression
+: public SQLLogicChainExpression
+{
+public:
+    SQLOrChainExpression(SQLExpression *expr1, SQLExpression *expr2);
+    virtual const char *shortName() const;
+
+protected:
+    virtual bool canMerge(SQLExpression *e) const;
 };
 
 /**
@@ -241,6 +614,10 @@ public:
     virtual const char *shortName() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLExpression *optimise();
+    virtual SQLValueType resultType() const;
+    virtual bool canRaise() const;
 };
 
 /**
@@ -257,6 +634,13 @@ public:
     virtual const char *shortName() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLValueType resultType() const;
+    virtual bool canRaise() const;
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+    virtual unsigned long hash() const;
+    virtual bool equals(const SQLExpression *e) const;
 protected:
     char op;
 };
@@ -273,6 +657,9 @@ public:
     virtual const char *shortName() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLExpression *optimise();
+    virtual SQLValueType resultType() const;
 };
 
 /**
@@ -287,6 +674,9 @@ public:
     virtual const char *shortName() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLValueType resultType() const;
+    virtual bool canRaise() const;
 };
 
 /**
@@ -297,21 +687,52 @@ class SQLInExpression
 {
 public:
     SQLInExpression(SQLExpression *expr, SQLExpressionList *list);
+    /** Test against the list of values bound to a parameter */
+    SQLInExpression(SQLExpression *expr, SQLParameterExpression *parameter);
 
     virtual SQLValue evaluate(SQLContext &context);
+    virtual SQLExpression *optimise();
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+    virtual SQLValueType resultType() const;
+    virtual bool canRaise() const;
+    virtual void visitChildren(SQLExpressionVisitor &visitor);
+    virtual unsigned long hash() const;
+    virtual bool equals(const SQLExpression *e) const;
 
     /** Show the parse tree as a string. This is useful for debugging */
     virtual std::string asString() const;
     virtual const char *shortName() const;
 
+    SQLExpression *operand() const { return expr; }
+    /** The list of values, which is empty if there is a parameter */
+    SQLExpressionList *getList() const { return list; }
+    SQLParameterExpression *getParameter() const { return parameter; }
+
 protected:
     ~SQLInExpression();
     SQLExpression *expr;
     SQLExpressionList *list;
+    SQLParameterExpression *parameter;
+
+    /**
+     * A list of constants is converted to each built in type and held in
+     * a set for that type when the expression is optimised or bound, so
+     * evaluate() only reads them. A type whose set could not be built
+     * searches the list in order.
+     */
+    SQLValueSet sets[SQLExceptionType];
+    bool setUsable[SQLExceptionType];
+
+    void buildSets();
 };
 
 /**
- * 'Like' SQLExpression.
+ * 'Like' SQLExpression. The pattern is classified when it is parsed so
+ * that exact, prefix, suffix and contains patterns are matched with a
+ * single comparison or search. Other patterns are split at each '%' and
+ * the pieces matched in turn without backtracking. As an extension the
+ * part of a pattern after the escape character is a regular expression.
  */
 class SQLLikeExpression
 : public SQLUnaryExpression
@@ -324,13 +745,49 @@ public:
     std::string asString() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual SQLValueType resultType() const;
+    virtual bool canRaise() const;
+    virtual unsigned long hash() const;
+    virtual bool equals(const SQLExpression *e) const;
+
+    const std::string &getPattern() const { return pattern; }
+
+    /** True if the pattern has a regular expression after the escape */
+    bool isRegex() const { return match == Regex; }
+
+    /** True if the string matches the pattern */
+    bool matches(const char *s, size_t len) const;
+
 protected:
     ~SQLLikeExpression();
+
+    enum Match { Exact, Prefix, Suffix, Contains, Wildcard, Regex };
+
+    std::string pattern;
+    Match match;
+
+    /** Pieces of the pattern between each '%' */
+    std::vector<std::string> segments;
+    bool anyStart;
+    bool anyEnd;
+
+    /**
+     * The regular expression is compiled both with and without case so
+     * either can be used as the string case sensitivity is set. If it
+     * does not compile evaluate() returns the error as an exception.
+     */
     regex_t regex;
+    regex_t regexIcase;
+    std::string regexError;
+
+    void compileRegex(const std::string &str, size_t escape_pos);
+    bool matchWildcard(const char *s, size_t len, bool icase) const;
 };
 
 /**
- * Function SQLExpression.
+ * Function SQLExpression. Functions declared in a SQLSchema are resolved
+ * when the expression is bound, others are looked up in the SQLContext
+ * each time they are called.
  */
 class SQLFunctionExpression
 : public SQLExpression
@@ -341,16 +798,39 @@ public:
 			  SQLExpressionList *list);
 
     virtual SQLValue evaluate(SQLContext &context);
+    virtual SQLExpression *optimise();
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+    virtual void visitChildren(SQLExpressionVisitor &visitor);
+    virtual SQLValueType resultType() const;
+
+    /**
+     * Calls to a function that is not pure are only equal to themselves.
+     * A function resolved through the SQLContext is only pure if it is
+     * one of the built in functions.
+     */
+    virtual unsigned long hash() const;
+    virtual bool equals(const SQLExpression *e) const;
 
     /** Show the parse tree as a string. This is useful for debugging */
     virtual std::string asString() const;
     virtual const char *shortName() const;
 
+    /** The name as it is written in an expression */
+    std::string name() const;
+
 protected:
     ~SQLFunctionExpression();
     std::string className;
     std::string memberName;
     SQLExpressionList *list;
+
+    /** The function declared in the schema, or 0 to use the SQLContext */
+    SQLFunction *function;
+
+    bool checkArgument(int i, SQLValueType type,
+		       std::vector<std::string> &errors);
+    bool isPure() const;
 };
 
 /**
@@ -365,6 +845,8 @@ public:
     virtual const char *shortName() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLValueType resultType() const;
 };
 
 /**
@@ -376,14 +858,76 @@ class SQLVariableExpression
 public:
     SQLVariableExpression(const std::string &class_name,
                           const std::string &member_name)
-        : className(class_name), memberName(member_name) { ; }
+        : className(class_name), memberName(member_name),
+	  type(SQLOtherType), slot(-1), slotContext(0) { ; }
     virtual const char *shortName() const;
     virtual std::string asString() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLExpression *bindSchema(const SQLSchema &schema,
+				      std::vector<std::string> &errors);
+    virtual SQLValueType resultType() const;
+    virtual bool canRaise() const;
+    virtual unsigned long hash() const;
+    virtual bool equals(const SQLExpression *e) const;
+
+    /**
+     * Find the slot of the variable in contexts like this one and return
+     * it as SQLContext::resolve() does
+     */
+    int resolve(const SQLContext &context);
+
+    const std::string &getClassName() const { return className; }
+    const std::string &getMemberName() const { return memberName; }
+
+    /** The name as it is written in an expression */
+    std::string name() const;
+
 protected:
     std::string className;
     std::string memberName;
+    /** Type declared by the schema */
+    SQLValueType type;
+
+    /** Slot in contexts of the class slotContext, if it is resolved */
+    int slot;
+    const std::type_info *slotContext;
+};
+
+/**
+ * Parameter SQLExpression. The value is bound after the expression is
+ * parsed so it can be evaluated many times with different values. The
+ * values set on the SQLContext are used if there are any, otherwise those
+ * bound with SQLParse.
+ */
+class SQLParameterExpression
+: public SQLTerminalExpression
+{
+public:
+    SQLParameterExpression(int index, const std::string &name,
+			   SQLParameters *parameters);
+    virtual const char *shortName() const;
+    virtual std::string asString() const;
+
+    SQLValue evaluate(SQLContext &context);
+    virtual bool canRaise() const;
+    virtual unsigned long hash() const;
+    virtual bool equals(const SQLExpression *e) const;
+
+    /** Return whether v is in the list bound to the parameter */
+    SQLValue contains(SQLContext &context, const SQLValue &v);
+
+    int getIndex() const { return index; }
+    const std::string &getName() const { return name; }
+
+protected:
+    ~SQLParameterExpression();
+    int index;
+    std::string name;
+    SQLParameters *parameters;
+
+    const SQLParameters &lookup(SQLContext &context) const;
 };
 
 /**
@@ -398,13 +942,169 @@ public:
     virtual std::string asString() const;
 
     SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLValueType resultType() const;
+    virtual bool isConstant() const;
+    virtual bool canRaise() const;
+    virtual unsigned long hash() const;
+    virtual bool equals(const SQLExpression *e) const;
+
+    /**
+     * Return the constant converted to the type of v2, or the constant
+     * itself if it cannot be converted or v2 has an application defined
+     * type. The conversions are made once when the expression is created
+     * so this does not change the expression.
+     */
+    const SQLValue &valueAsType(const SQLValue &v2) const
+    {
+	SQLValueType t = v2.type();
+
+	return t < SQLExceptionType ? typedValues[t] : value;
+    }
+
+    const SQLValue &getValue() const { return value; }
+
+protected:
+    SQLValue value;
+
+    /** The constant converted to each of the built in types */
+    SQLValue typedValues[SQLExceptionType];
+};
+
+/**
+ * Comparison of an expression with a constant of the type declared for
+ * the expression by a SQLSchema. Values of that type are compared
+ * directly without any type conversion.
+ */
+class SQLConstantCompareExpression
+: public SQLUnaryExpression
+{
+public:
+    /** test is a SQLProgram::Test */
+    SQLConstantCompareExpression(SQLExpression *expr,
+				 const SQLValue &constant, int test);
+    virtual const char *shortName() const;
+    virtual std::string asString() const;
+    virtual SQLValueType resultType() const;
+    virtual unsigned long hash() const;
+    virtual bool equals(const SQLExpression *e) const;
+
+    SQLValue evaluate(SQLContext &context);
+
+    /** True if comparisons of values of the type can be specialised */
+    static bool isSpecialised(SQLValueType type);
+
+    void setOperand(SQLExpression *e) { replace(expr, e); }
+    const SQLValue &constant() const { return value; }
+    int test() const { return test_; }
 
-    // Extension to allow caching the type conversions
-    SQLValue evaluateAsType(const SQLValue &v2);
+    /** Apply the test to a value that has the type of the constant */
+    bool matches(const SQLValue &v) const;
 
 protected:
     SQLValue value;
-    SQLValue typedValue;
+    int test_;
+};
+
+/**
+ * Lower and upper bound comparisons of the same variable against
+ * constants, as generated for 'between'. The variable is evaluated once
+ * and compared directly against both bounds.
+ */
+class SQLRangeExpression
+: public SQLAndExpression
+{
+public:
+    SQLRangeExpression(SQLConstantCompareExpression *lower,
+		       SQLConstantCompareExpression *upper);
+    virtual const char *shortName() const;
+    virtual std::string asString() const;
+
+    SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual void visitChildren(SQLExpressionVisitor &visitor);
+
+    /**
+     * Return a range if the comparisons are a lower and upper bound of the
+     * same variable, otherwise 0.
+     */
+    static SQLRangeExpression *create(SQLExpression *e1, SQLExpression *e2);
+
+    SQLConstantCompareExpression *lowerBound() const { return lower; }
+    SQLConstantCompareExpression *upperBound() const { return upper; }
+
+protected:
+    SQLConstantCompareExpression *lower;
+    SQLConstantCompareExpression *upper;
+};
+
+/**
+ * Values of the common sub-expressions evaluated so far for a row. The
+ * SQLCommonScopeExpression at the root of the expression sets this on the
+ * SQLContext while the row is evaluated.
+ */
+struct SQLMemo
+{
+    SQLValue *values;
+    /** Bit i is set once values[i] is evaluated */
+    unsigned long long filled;
+};
+
+/**
+ * A sub-expression that occurs more than once in an expression. Every
+ * occurrence is replaced by the same SQLCommonExpression, which keeps the
+ * value in a slot of the SQLMemo for the row so the sub-expression is
+ * evaluated at most once. Without a SQLMemo it is evaluated every time.
+ */
+class SQLCommonExpression
+: public SQLUnaryExpression
+{
+public:
+    SQLCommonExpression(SQLExpression *expr, int slot);
+    virtual const char *shortName() const;
+
+    /** The sub-expression is shown as if it were not shared */
+    virtual std::string asString() const;
+    virtual unsigned long hash() const;
+    virtual bool equals(const SQLExpression *e) const;
+
+    SQLValue evaluate(SQLContext &context);
+    virtual SQLValueType resultType() const;
+
+    int getSlot() const { return slot; }
+
+    /** A SQLMemo holds this many slots */
+    enum { MAX_SLOTS = 64 };
+
+protected:
+    int slot;
+};
+
+/**
+ * Root of an expression containing SQLCommonExpression nodes. This holds
+ * the SQLMemo for each row that is evaluated.
+ */
+class SQLCommonScopeExpression
+: public SQLUnaryExpression
+{
+public:
+    SQLCommonScopeExpression(SQLExpression *expr, int num_slots);
+    virtual const char *shortName() const;
+    virtual std::string asString() const;
+
+    SQLValue evaluate(SQLContext &context);
+    virtual int compile(SQLProgram &program);
+    virtual SQLValueType resultType() const;
+
+    int numSlots() const { return slots; }
+
+protected:
+    ~SQLCommonScopeExpression();
+
+    enum { SMALL_SLOTS = 4 };
+
+    int slots;
+    SQLProgram *program;
 };
 
 #endif
@@ -0,0 +1,124 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLFunction.cpp
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Native functions that expressions are bound to
+ */
+#include "SQLFunction.h"
+#include <math.h>
+
+SQLFunction::SQLFunction()
+: function_(0), returnType_(SQLOtherType), variadic_(false), pure_(true)
+{
+}
+
+SQLFunction::SQLFunction(const std::string &class_name,
+			 const std::string &member_name,
+			 SQLNativeFunction function,
+			 SQLValueType return_type)
+: className_(class_name), memberName_(member_name), function_(function),
+  returnType_(return_type), variadic_(false), pure_(true)
+{
+}
+
+SQLFunction & SQLFunction::addArgument(SQLValueType type)
+{
+    argumentTypes_.push_back(type);
+
+    return *this;
+}
+
+SQLFunction & SQLFunction::setVariadic(bool variadic)
+{
+    variadic_ = variadic;
+
+    return *this;
+}
+
+SQLFunction & SQLFunction::setPure(bool pure)
+{
+    pure_ = pure;
+
+    return *this;
+}
+
+std::string SQLFunction::name() const
+{
+    if (className_.empty())
+	return memberName_;
+    else
+	return className_ + "." + memberName_;
+}
+
+bool SQLFunction::acceptsArguments(int num_args) const
+{
+    if (variadic_)
+	return num_args >= numArguments();
+
+    return num_args == numArguments();
+}
+
+SQLFunctionRegistry::SQLFunctionRegistry()
+{
+}
+
+void SQLFunctionRegistry::addFunction(const SQLFunction &function)
+{
+    functions[function.name()] = function;
+}
+
+const SQLFunction *
+SQLFunctionRegistry::findFunction(const std::string &class_name,
+				  const std::string &member_name) const
+{
+    std::string name;
+    if (!class_name.empty())
+	name = class_name + ".";
+    name += member_name;
+
+    FunctionMap::const_iterator i = functions.find(name);
+    if (i == functions.end())
+	return 0;
+
+    return &i->second;
+}
+
+// The default functions of one real argument
+template <double (*f)(double)>
+static SQLValue realFunction(SQLContext &, int, SQLValue *args)
+{
+    return SQLValue::makeReal(f(args[0].asReal()));
+}
+
+static void addRealFunction(SQLFunctionRegistry &r, const char *name,
+			    SQLNativeFunction f)
+{
+    r.addFunction(SQLFunction("", name, f, SQLRealType).
+		  addArgument(SQLRealType));
+}
+
+static SQLFunctionRegistry makeBuiltins()
+{
+    SQLFunctionRegistry r;
+
+    addRealFunction(r, "abs", realFunction<fabs>);
+    addRealFunction(r, "atan", realFunction<atan>);
+    addRealFunction(r, "cos", realFunction<cos>);
+    addRealFunction(r, "exp", realFunction<exp>);
+    addRealFunction(r, "log", realFunction<log>);
+    addRealFunction(r, "sin", realFunction<sin>);
+    addRealFunction(r, "sqrt", realFunction<sqrt>);
+
+    return r;
+}
+
+const SQLFunctionRegistry & SQLFunctionRegistry::builtins()
+{
+    static const SQLFunctionRegistry registry = makeBuiltins();
+
+    return registry;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLFunction.h
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Native functions that expressions are bound to
+ */
+#ifndef SQLFUNCTION_H
+#define SQLFUNCTION_H
+
+#include "SQLValue.h"
+#include <map>
+#include <string>
+#include <vector>
+
+class SQLContext;
+
+/**
+ * A native function called with the values of its arguments. The values
+ * are not converted to the declared argument types, so use asReal() and
+ * the like to read them.
+ */
+typedef SQLValue (*SQLNativeFunction)(SQLContext &context,
+				      int num_args, SQLValue *args);
+
+/**
+ * Declaration of a native function. Functions called in an expression
+ * are resolved when it is bound to a SQLSchema so the function is called
+ * directly on each row rather than through SQLContext::functionLookup(),
+ * and calls with the wrong number or type of arguments are reported as
+ * errors when the expression is parsed.
+ */
+class SQLFunction
+{
+public:
+    SQLFunction();
+    SQLFunction(const std::string &class_name,
+		const std::string &member_name,
+		SQLNativeFunction function,
+		SQLValueType return_type = SQLOtherType);
+
+    /** Declare the type of the next argument. SQLOtherType accepts any */
+    SQLFunction &addArgument(SQLValueType type);
+
+    /** Accept any number of arguments after the declared ones */
+    SQLFunction &setVariadic(bool variadic = true);
+
+    /**
+     * A pure function depends only on its arguments so it is evaluated
+     * when the expression is parsed if they are constants, and a call
+     * repeated in an expression is evaluated once. Functions are pure
+     * unless declared otherwise.
+     */
+    SQLFunction &setPure(bool pure);
+
+    const std::string &className() const { return className_; }
+    const std::string &memberName() const { return memberName_; }
+
+    /** The name as it is written in an expression */
+    std::string name() const;
+
+    SQLValueType returnType() const { return returnType_; }
+    int numArguments() const { return argumentTypes_.size(); }
+    SQLValueType argumentType(int i) const { return argumentTypes_[i]; }
+    bool isVariadic() const { return variadic_; }
+    bool isPure() const { return pure_; }
+
+    /** True if the function can be called with this many arguments */
+    bool acceptsArguments(int num_args) const;
+
+    SQLValue call(SQLContext &context, int num_args, SQLValue *args) const
+    {
+	return function_(context, num_args, args);
+    }
+
+private:
+    std::string className_;
+    std::string memberName_;
+    SQLNativeFunction function_;
+    SQLValueType returnType_;
+    std::vector<SQLValueType> argumentTypes_;
+    bool variadic_;
+    bool pure_;
+};
+
+/**
+ * Set of native functions looked up by name.
+ */
+class SQLFunctionRegistry
+{
+public:
+    SQLFunctionRegistry();
+
+    /** Add a function, replacing any with the same name */
+    void addFunction(const SQLFunction &function);
+
+    /** Return the function or 0 if there is none with the name */
+    const SQLFunction *findFunction(const std::string &class_name,
+				    const std::string &member_name) const;
+
+    /** The default SQL functions such as abs() and sqrt() */
+    static const SQLFunctionRegistry &builtins();
+
+private:
+    typedef std::map<std::string, SQLFunction> FunctionMap;
+    FunctionMap functions;
+};
+
+#endif
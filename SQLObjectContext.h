@@ -0,0 +1,231 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLObjectContext.h
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Context that maps variables to the members of an object
+ */
+#ifndef SQLOBJECTCONTEXT_H
+#define SQLOBJECTCONTEXT_H
+
+#include "SQLContext.h"
+#include "SQLSchema.h"
+#include <string>
+#include <vector>
+
+#if __cplusplus >= 201103L
+#include <functional>
+#endif
+
+/**
+ * Context for the objects of a class T. Each variable is registered once
+ * as a pointer to a member or as a getter function and is read directly
+ * from the object when the expression is evaluated:
+ *
+ *   SQLObjectContext<Shift> context;
+ *   context.field("status", &Shift::status)
+ *          .field("hours", &Shift::hours)
+ *          .dateTimeField("start", &Shift::start);
+ *
+ *   parser.setSchema(&schema);      // after context.addFields(schema)
+ *   parser.setContext(&context);
+ *   ...
+ *   context.setObject(shift);
+ *   program->evaluate(context);
+ *
+ * When the parser is given the context the variables are resolved to the
+ * position of their field so no names are compared for each row. String
+ * members are borrowed rather than copied so the object must not change
+ * while the value is in use. Contexts of the same T that evaluate the
+ * same expression must register the same fields in the same order.
+ */
+template <class T>
+class SQLObjectContext
+: public SQLContext
+{
+public:
+    typedef SQLValue (*Getter)(const T &object);
+
+    /**
+     * Create a context for variables with no class or with the class
+     * name given.
+     */
+    SQLObjectContext(const std::string &class_name = "")
+    : className_(class_name), object_(0) { ; }
+
+    void setObject(const T *object) { object_ = object; }
+    const T *object() const { return object_; }
+
+    SQLObjectContext &field(const std::string &name, bool T::*member)
+    {
+	Field &f = addField(name, Boolean, SQLBooleanType);
+	f.member.b = member;
+	return *this;
+    }
+
+    SQLObjectContext &field(const std::string &name, int T::*member)
+    {
+	Field &f = addField(name, Integer, SQLIntegerType);
+	f.member.i = member;
+	return *this;
+    }
+
+    SQLObjectContext &field(const std::string &name, double T::*member)
+    {
+	Field &f = addField(name, Real, SQLRealType);
+	f.member.d = member;
+	return *this;
+    }
+
+    SQLObjectContext &field(const std::string &name,
+			    std::string T::*member)
+    {
+	Field &f = addField(name, String, SQLStringType);
+	f.member.s = member;
+	return *this;
+    }
+
+#if SQL_DATE_SUPPORT
+    /** A time_t member holding a date and time rather than an integer */
+    SQLObjectContext &dateTimeField(const std::string &name,
+				    time_t T::*member)
+    {
+	Field &f = addField(name, DateTime, SQLDateTimeType);
+	f.member.t = member;
+	return *this;
+    }
+#endif
+
+    /** A value computed from the object such as a null for a missing one */
+    SQLObjectContext &field(const std::string &name, Getter getter,
+			    SQLValueType type = SQLOtherType)
+    {
+	Field &f = addField(name, Function, type);
+	f.member.g = getter;
+	return *this;
+    }
+
+#if __cplusplus >= 201103L
+    /** A value computed by any callable, such as a lambda */
+    template <class F>
+    SQLObjectContext &field(const std::string &name, F getter,
+			    SQLValueType type = SQLOtherType)
+    {
+	addField(name, Callable, type);
+	callables_.back() = getter;
+	return *this;
+    }
+#endif
+
+    /** Declare the types of the fields so expressions can be bound */
+    void addFields(SQLSchema &schema) const
+    {
+	for (size_t i = 0; i < fields_.size(); i++)
+	{
+	    if (fields_[i].type == SQLOtherType)
+		continue;
+
+	    if (className_.empty())
+		schema.addField(fields_[i].name, fields_[i].type);
+	    else
+		schema.addField(className_, fields_[i].name, fields_[i].type);
+	}
+    }
+
+protected:
+    virtual int resolveSlot(const std::string &class_name,
+			    const std::string &member_name) const
+    {
+	if (class_name.empty() || class_name == className_)
+	{
+	    for (size_t i = 0; i < fields_.size(); i++)
+		if (fields_[i].name == member_name)
+		    return i;
+	}
+
+	return NEXT_IN_CHAIN;
+    }
+
+    virtual SQLValue fetchSlot(int slot) const
+    {
+	if (object_ == 0 || slot < 0 || slot >= (int)fields_.size())
+	    return SQLContext::fetchSlot(slot);
+
+	const Field &f = fields_[slot];
+	const T &o = *object_;
+
+	switch (f.kind)
+	{
+	case Boolean:
+	    return SQLValue::makeBoolean(o.*f.member.b);
+	case Integer:
+	    return SQLValue::makeInteger(o.*f.member.i);
+	case Real:
+	    return SQLValue::makeReal(o.*f.member.d);
+	case String:
+	    return SQLValue::makeBorrowedString(o.*f.member.s);
+#if SQL_DATE_SUPPORT
+	case DateTime:
+	    return SQLValue::makeDateTime(o.*f.member.t);
+#endif
+	case Function:
+	    return f.member.g(o);
+#if __cplusplus >= 201103L
+	case Callable:
+	    return callables_[slot](o);
+#endif
+	default:
+	    return SQLContext::fetchSlot(slot);
+	}
+    }
+
+private:
+    enum Kind { Boolean, Integer, Real, String, DateTime, Function,
+		Callable };
+
+    struct Field
+    {
+	std::string name;
+	Kind kind;
+	SQLValueType type;
+
+	union
+	{
+	    bool T::*b;
+	    int T::*i;
+	    double T::*d;
+	    std::string T::*s;
+#if SQL_DATE_SUPPORT
+	    time_t T::*t;
+#endif
+	    Getter g;
+	} member;
+    };
+
+    Field &addField(const std::string &name, Kind kind, SQLValueType type)
+    {
+	Field f;
+	f.name = name;
+	f.kind = kind;
+	f.type = type;
+	fields_.push_back(f);
+#if __cplusplus >= 201103L
+	callables_.resize(fields_.size());
+#endif
+
+	return fields_.back();
+    }
+
+    std::string className_;
+    const T *object_;
+    std::vector<Field> fields_;
+
+#if __cplusplus >= 201103L
+    std::vector<std::function<SQLValue(const T &)> > callables_;
+#endif
+};
+
+#endif
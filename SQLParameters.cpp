@@ -0,0 +1,181 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLParameters.cpp
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Values bound to the parameters of an expression
+ */
+#include "SQLParameters.h"
+#include "SQLExpression.h"
+#include <sstream>
+
+SQLParameters::Parameter::Parameter()
+: bound(false), isList(false)
+{
+}
+
+// The sets are not copied but built again when they are needed
+SQLParameters::Parameter::Parameter(const Parameter &p)
+: bound(p.bound), isList(p.isList), value(p.value), list(p.list)
+{
+}
+
+SQLParameters::Parameter &
+SQLParameters::Parameter::operator=(const Parameter &p)
+{
+    bound = p.bound;
+    isList = p.isList;
+    value = p.value;
+    list = p.list;
+
+    for (int t = 0; t < SQLExceptionType; t++)
+	setStates[t].store(SetUnbuilt);
+
+    return *this;
+}
+
+// Return the list converted to type t, building the set the first time it
+// is asked for. Returns 0 if the list has to be searched in order.
+const SQLValueSet * SQLParameters::Parameter::set(SQLValueType t) const
+{
+    if (t == SQLNullType || t >= SQLExceptionType)
+	return 0;
+
+    // The exchanges order the reads of the set after it was built
+    if (setStates[t].compareExchange(SetBuilt, SetBuilt))
+	return &sets[t];
+
+    if (!setStates[t].compareExchange(SetUnbuilt, SetBuilding))
+	return 0;
+
+    sets[t].clear();
+    bool usable = sets[t].assign(list, t);
+    setStates[t].compareExchange(SetBuilding,
+				 usable ? SetBuilt : SetUnusable);
+
+    return usable ? &sets[t] : 0;
+}
+
+SQLParameters::SQLParameters()
+: refCount(0)
+{
+}
+
+SQLParameters::Parameter & SQLParameters::parameter(int i)
+{
+    if (i >= (int)parameters.size())
+	parameters.resize(i + 1);
+
+    return parameters[i];
+}
+
+void SQLParameters::bind(int i, const SQLValue &v)
+{
+    Parameter &p = parameter(i);
+
+    p.bound = true;
+    p.isList = false;
+    p.value = v;
+    p.list.clear();
+}
+
+void SQLParameters::bindList(int i, const std::vector<SQLValue> &values)
+{
+    Parameter &p = parameter(i);
+
+    p.bound = true;
+    p.isList = true;
+    p.value = SQLValue();
+    p.list = values;
+
+    for (int t = 0; t < SQLExceptionType; t++)
+	p.setStates[t].store(SetUnbuilt);
+}
+
+void SQLParameters::clear()
+{
+    parameters.clear();
+}
+
+int SQLParameters::size() const
+{
+    return parameters.size();
+}
+
+static SQLValue unboundParameter(int i)
+{
+    std::stringstream s;
+    s << "Parameter " << i << " is not bound";
+
+    return SQLValue(new SQLExceptionValue(s.str()));
+}
+
+SQLValue SQLParameters::value(int i) const
+{
+    if (i < 0 || i >= (int)parameters.size() || !parameters[i].bound)
+	return unboundParameter(i);
+
+    const Parameter &p = parameters[i];
+    if (p.isList)
+    {
+	std::stringstream s;
+	s << "Parameter " << i << " is bound to a list";
+
+	return SQLValue(new SQLExceptionValue(s.str()));
+    }
+
+    return p.value;
+}
+
+SQLValue SQLParameters::contains(int i, const SQLValue &v) const
+{
+    if (i < 0 || i >= (int)parameters.size() || !parameters[i].bound)
+	return unboundParameter(i);
+
+    const Parameter &p = parameters[i];
+    const SQLValueSet *set = p.isList ? p.set(v.type()) : 0;
+    if (set != 0)
+    {
+	if (set->contains(v))
+	    return SQLExpression::SQLTrueValue;
+
+	return set->hasNull() ? SQLValue() : SQLExpression::SQLFalseValue;
+    }
+
+    // Search the list in order as 'in' does with a list of constants. A
+    // single value is searched as a list of one.
+    const SQLValue *values = &p.value;
+    size_t num_values = 1;
+    if (p.isList)
+    {
+	values = p.list.empty() ? 0 : &p.list[0];
+	num_values = p.list.size();
+    }
+
+    bool got_null = false;
+
+    for (size_t j = 0; j < num_values; j++)
+    {
+	SQLValue v2 = values[j];
+	if (v2.isException())
+	    return v2;
+
+	if (v2.isNull())
+	{
+	    got_null = true;
+	    continue;
+	}
+
+	if (!v2.typeConvert(v))
+	    return SQLValue(new SQLExceptionValue(
+				"Mismatched types in list expression:" +
+				v.asString() + " and " + v2.asString()));
+	if (v.compare(v2) == 0)
+	    return SQLExpression::SQLTrueValue;
+    }
+
+    return got_null ? SQLValue() : SQLExpression::SQLFalseValue;
+}
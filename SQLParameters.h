@@ -0,0 +1,121 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLParameters.h
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Values bound to the parameters of an expression
+ */
+#ifndef SQLPARAMETERS_H
+#define SQLPARAMETERS_H
+
+#include "SQLValue.h"
+#include "SQLValueSet.h"
+#include <string>
+#include <vector>
+
+/**
+ * Values bound to the '?' and ':name' parameters of an expression by
+ * parameter number. A parameter may be bound to a single value or, when
+ * it is the right hand side of 'in', to a list of values.
+ *
+ * The parameters of a parsed expression are shared by reference count
+ * between the parser and the parameter nodes so that they may be rebound
+ * for as long as the expression is in use.
+ */
+class SQLParameters
+{
+public:
+    SQLParameters();
+
+    void getRef() { refCount++; }
+    void releaseRef()
+    {
+        refCount--;
+
+        if (refCount <= 0)
+            delete this;
+    }
+
+    void bind(int i, const SQLValue &v);
+    void bindList(int i, const std::vector<SQLValue> &values);
+
+    /**
+     * Bind the contents of an application container. The elements may be
+     * SQLValue, bool, int, double or strings.
+     */
+    template <class Iterator>
+    void bindList(int i, Iterator begin, Iterator end)
+    {
+	std::vector<SQLValue> values;
+
+	for (; begin != end; ++begin)
+	    values.push_back(toValue(*begin));
+
+	bindList(i, values);
+    }
+
+    /** Remove all of the bound values */
+    void clear();
+
+    /** Return the number of parameters that have been bound */
+    int size() const;
+
+    /** Return the value of a parameter or an exception if it is not bound */
+    SQLValue value(int i) const;
+
+    /**
+     * Return whether v is in the list bound to a parameter with the same
+     * result as 'in' with a list of constants.
+     */
+    SQLValue contains(int i, const SQLValue &v) const;
+
+    static SQLValue toValue(const SQLValue &v) { return v; }
+    static SQLValue toValue(bool b) { return SQLValue::makeBoolean(b); }
+    static SQLValue toValue(int i) { return SQLValue::makeInteger(i); }
+    static SQLValue toValue(double d) { return SQLValue::makeReal(d); }
+    static SQLValue toValue(const std::string &s)
+    {
+	return SQLValue::makeString(s);
+    }
+    static SQLValue toValue(const char *s)
+    {
+	return SQLValue::makeString(s);
+    }
+
+private:
+    /** States of the set of a list converted to one built in type */
+    enum SetState { SetUnbuilt, SetBuilding, SetBuilt, SetUnusable };
+
+    struct Parameter
+    {
+	Parameter();
+	Parameter(const Parameter &p);
+	Parameter &operator=(const Parameter &p);
+
+	bool bound;
+	bool isList;
+	SQLValue value;
+	std::vector<SQLValue> list;
+
+	/**
+	 * The list converted to each built in type, built the first time
+	 * 'in' tests a value of that type. The set is built by one thread
+	 * while the others search the list in order, as they also do when
+	 * the list cannot be converted to the type.
+	 */
+	mutable SQLValueSet sets[SQLExceptionType];
+	mutable SQLAtomic<int> setStates[SQLExceptionType];
+
+	const SQLValueSet *set(SQLValueType t) const;
+    };
+
+    int refCount;
+    std::vector<Parameter> parameters;
+
+    Parameter &parameter(int i);
+};
+
+#endif
@@ -10,7 +10,10 @@
  */
 #include "SQLParse.h"
 #include "SQLExpression.h"
+#include "SQLProgram.h"
+#include "SQLSchema.h"
 #include <assert.h>
+#include <ctype.h>
 #include <sstream>
 
 // flex buffer interface
@@ -59,21 +62,49 @@ void SQLParseError::code(const std::string &c)
 }
 
 SQLParse::SQLParse()
-: expression_(0)
+: expression_(0), program_(0), schema_(0), context_(0),
+  parameters_(new SQLParameters), liftLiterals_(false), lifting_(false),
+  normaliseOnly_(false), ownParameters_(false)
 {
+    parameters_->getRef();
 }
 
 SQLParse::~SQLParse()
 {
     setExpression(0);
+
+    parameters_->releaseRef();
 }
 
 bool SQLParse::parse(const std::string &str)
+{
+    bool ok = parseText(str, liftLiterals_);
+
+    // A query with parameters of its own keeps its literals
+    if (liftLiterals_ && ownParameters_)
+	ok = parseText(str, false);
+
+    return ok;
+}
+
+bool SQLParse::parseText(const std::string &str, bool lift)
 {
     parse_string_ = str;
 
     setExpression(0);
 
+    // Expressions from an earlier parse keep their own parameters
+    parameters_->releaseRef();
+    parameters_ = new SQLParameters;
+    parameters_->getRef();
+    parameterNames_.clear();
+
+    lifting_ = lift;
+    ownParameters_ = false;
+    tokens_.clear();
+    liftedParameters_.clear();
+    liftedTypes_.clear();
+
     current_parser_ = this;
     clearErrors();
 
@@ -87,11 +118,416 @@ bool SQLParse::parse(const std::string &str)
     return numErrors() == 0;
 }
 
+bool SQLParse::normalise(const std::string &str)
+{
+    normaliseOnly_ = true;
+    bool ok = parse(str);
+    normaliseOnly_ = false;
+
+    return ok;
+}
+
+void SQLParse::setSchema(const SQLSchema *schema)
+{
+    schema_ = schema;
+}
+
+const SQLSchema * SQLParse::schema() const
+{
+    return schema_;
+}
+
+void SQLParse::setContext(const SQLContext *context)
+{
+    context_ = context;
+}
+
 void SQLParse::clearExpression()
 {
     setExpression(0);
 }
 
+int SQLParse::numParameters() const
+{
+    return parameterNames_.size();
+}
+
+std::string SQLParse::parameterName(int i) const
+{
+    if (i < 0 || i >= numParameters())
+	return "";
+
+    return parameterNames_[i];
+}
+
+int SQLParse::parameterIndex(const std::string &name) const
+{
+    if (name.empty())
+	return -1;
+
+    for (int i = 0; i < numParameters(); i++)
+	if (parameterNames_[i] == name)
+	    return i;
+
+    return -1;
+}
+
+bool SQLParse::bind(int i, const SQLValue &v)
+{
+    if (i < 0 || i >= numParameters())
+	return false;
+
+    parameters_->bind(i, v);
+    return true;
+}
+
+bool SQLParse::bind(const std::string &name, const SQLValue &v)
+{
+    return bind(parameterIndex(name), v);
+}
+
+bool SQLParse::bindList(int i, const std::vector<SQLValue> &values)
+{
+    if (i < 0 || i >= numParameters())
+	return false;
+
+    parameters_->bindList(i, values);
+    return true;
+}
+
+bool SQLParse::bindList(const std::string &name,
+			const std::vector<SQLValue> &values)
+{
+    return bindList(parameterIndex(name), values);
+}
+
+void SQLParse::clearParameters()
+{
+    parameters_->clear();
+}
+
+SQLParameters * SQLParse::parameters() const
+{
+    return parameters_;
+}
+
+// Named parameters used more than once share a number
+SQLParameterExpression * SQLParse::newParameter(const std::string &name)
+{
+    int i = parameterIndex(name);
+
+    if (i < 0)
+    {
+	i = parameterNames_.size();
+	parameterNames_.push_back(name);
+	liftedParameters_.push_back(false);
+    }
+
+    ownParameters_ = true;
+
+    return new SQLParameterExpression(i, name, parameters_);
+}
+
+SQLParameterExpression * SQLParse::newLiftedParameter()
+{
+    int i = parameterNames_.size();
+    parameterNames_.push_back("");
+    liftedParameters_.push_back(true);
+
+    return new SQLParameterExpression(i, "", parameters_);
+}
+
+void SQLParse::setLiftLiterals(bool lift)
+{
+    liftLiterals_ = lift;
+}
+
+int SQLParse::numLiftedLiterals() const
+{
+    int n = 0;
+    for (size_t i = 0; i < liftedParameters_.size(); i++)
+	if (liftedParameters_[i])
+	    n++;
+
+    return n;
+}
+
+SQLValueType SQLParse::liftedLiteralType(int i) const
+{
+    if (i < 0 || i >= (int)liftedTypes_.size())
+	return SQLOtherType;
+
+    return liftedTypes_[i];
+}
+
+std::string SQLParse::normalisedText() const
+{
+    std::string s;
+
+    for (size_t i = 0; i < tokens_.size(); i++)
+    {
+	const Token &t = tokens_[i];
+	if (t.use == Removed)
+	    continue;
+
+	if (!s.empty())
+	    s += ' ';
+	s += t.use == Lifted ? "?" : t.text;
+    }
+
+    return s;
+}
+
+// Called for each token read by the parser while lifting literals
+void SQLParse::addToken(const char *text, TokenKind kind, int line, int column)
+{
+    Token t;
+    t.text = text;
+    t.kind = kind;
+    t.line = line;
+    t.column = column;
+    t.use = Kept;
+
+    if (kind == KeywordToken)
+	for (size_t i = 0; i < t.text.length(); i++)
+	    t.text[i] = tolower((unsigned char)t.text[i]);
+
+    tokens_.push_back(t);
+}
+
+// Return the index of the token that starts at the location given, or -1.
+// The grammar finds the first token of an expression from its location.
+int SQLParse::findToken(int line, int column) const
+{
+    for (size_t i = tokens_.size(); i-- > 0; )
+	if (tokens_[i].line == line && tokens_[i].column == column)
+	    return i;
+
+    return -1;
+}
+
+namespace
+{
+    // Find whether an expression depends on the row being evaluated. The
+    // lifted literals are constant for a query.
+    class RowDependence
+    : public SQLExpressionVisitor
+    {
+    public:
+	RowDependence(const std::vector<bool> &lifted)
+	: found(false), lifted_(lifted) { ; }
+
+	virtual void visit(SQLExpression *&e)
+	{
+	    SQLParameterExpression *p =
+		dynamic_cast<SQLParameterExpression *>(e);
+
+	    if (p != 0)
+		found = found || !lifted_[p->getIndex()];
+	    else if (dynamic_cast<SQLVariableExpression *>(e) != 0 ||
+		     dynamic_cast<SQLFunctionExpression *>(e) != 0)
+		found = true;
+	    else
+		e->visitChildren(*this);
+	}
+
+	bool found;
+
+    private:
+	const std::vector<bool> &lifted_;
+    };
+
+    // Collect the places in a list that hold each expression
+    class ListSlots
+    : public SQLExpressionVisitor
+    {
+    public:
+	virtual void visit(SQLExpression *&e) { slots.push_back(&e); }
+
+	std::vector<SQLExpression **> slots;
+    };
+}
+
+bool SQLParse::dependsOnRow(SQLExpression *e) const
+{
+    RowDependence d(liftedParameters_);
+    d.visit(e);
+
+    return d.found;
+}
+
+// Replace a literal read by the lexer with a parameter bound to its value.
+// Only the literal rules give a SQLValueExpression while parsing, so one
+// that starts at a literal token is that literal. Returns 0 if the
+// expression is not such a literal.
+SQLParameterExpression * SQLParse::liftLiteral(SQLExpression *e, int token)
+{
+    if (token < 0 || tokens_[token].kind != LiteralToken ||
+	tokens_[token].use != Kept)
+	return 0;
+
+    SQLValueExpression *v = dynamic_cast<SQLValueExpression *>(e);
+    if (v == 0)
+	return 0;
+
+    SQLParameterExpression *p = newLiftedParameter();
+    parameters_->bind(p->getIndex(), v->getValue());
+    tokens_[token].use = Lifted;
+
+    return p;
+}
+
+// Lift a literal compared with an expression that depends on the row. The
+// expressions have not yet been referenced and start at the tokens given.
+void SQLParse::liftLiterals(SQLExpression *&e1, int token1,
+			    SQLExpression *&e2, int token2)
+{
+    if (!lifting_)
+	return;
+
+    bool row1 = dependsOnRow(e1);
+    bool row2 = dependsOnRow(e2);
+    if (row1 == row2)
+	return;
+
+    SQLExpression *&literal = row1 ? e2 : e1;
+    SQLParameterExpression *p = liftLiteral(literal, row1 ? token2 : token1);
+    if (p == 0)
+	return;
+
+    literal->getRef();
+    literal->releaseRef();
+    literal = p;
+}
+
+// Lift a list of literals tested with 'in' to a single parameter bound to
+// the list. A list that also has other expressions has its literals lifted
+// one by one. The list starts at the token open. Returns 0 if the list is
+// kept.
+SQLParameterExpression * SQLParse::liftList(SQLExpression *e,
+					    SQLExpressionList *list, int open)
+{
+    if (!lifting_ || open < 0 || !dependsOnRow(e))
+	return 0;
+
+    ListSlots l;
+    list->visitExpressions(l);
+
+    // Find the first token of each expression in the list
+    std::vector<int> starts;
+    int close = -1;
+    int depth = 0;
+    for (size_t t = open; t < tokens_.size() && close < 0; t++)
+    {
+	if (tokens_[t].kind != OtherToken)
+	    continue;
+
+	const std::string &text = tokens_[t].text;
+	if (text == "(")
+	{
+	    if (depth++ == 0)
+		starts.push_back(t + 1);
+	}
+	else if (text == ")")
+	{
+	    if (--depth == 0)
+		close = t;
+	}
+	else if (text == "," && depth == 1)
+	    starts.push_back(t + 1);
+    }
+
+    int n = l.slots.size();
+    if (close < 0 || (int)starts.size() != n)
+	return 0;
+
+    // A list of single literals is bound as one list
+    bool literals = close == open + 2 * n;
+    for (int i = 0; literals && i < n; i++)
+	literals = tokens_[starts[i]].kind == LiteralToken &&
+	    tokens_[starts[i]].use == Kept &&
+	    dynamic_cast<SQLValueExpression *>(*l.slots[i]) != 0;
+
+    if (!literals)
+    {
+	for (int i = 0; i < n; i++)
+	{
+	    SQLExpression *&slot = *l.slots[i];
+
+	    SQLParameterExpression *p = liftLiteral(slot, starts[i]);
+	    if (p != 0)
+	    {
+		p->getRef();
+		slot->releaseRef();
+		slot = p;
+	    }
+	}
+
+	return 0;
+    }
+
+    std::vector<SQLValue> values;
+    for (int i = 0; i < n; i++)
+	values.push_back(
+	    static_cast<SQLValueExpression *>(*l.slots[i])->getValue());
+
+    SQLParameterExpression *p = newLiftedParameter();
+    parameters_->bindList(p->getIndex(), values);
+
+    // The list and its brackets are written as one '?'
+    tokens_[open].use = Lifted;
+    for (int t = open + 1; t <= close; t++)
+	tokens_[t].use = Removed;
+
+    delete list;
+
+    return p;
+}
+
+namespace
+{
+    // Find the comparisons of an expression with a lifted literal
+    class LiftedTypes
+    : public SQLExpressionVisitor
+    {
+    public:
+	LiftedTypes(const std::vector<bool> &lifted,
+		    std::vector<SQLValueType> &types)
+	: lifted_(lifted), types_(types) { ; }
+
+	virtual void visit(SQLExpression *&e)
+	{
+	    SQLBinaryExpression *b = dynamic_cast<SQLBinaryExpression *>(e);
+	    SQLParameterExpression *p = b == 0 ? 0 :
+		dynamic_cast<SQLParameterExpression *>(b->secondOperand());
+
+	    if (p != 0 && lifted_[p->getIndex()])
+	    {
+		SQLValueType t = b->firstOperand()->resultType();
+		if (t != SQLNullType && t < SQLExceptionType)
+		    types_[p->getIndex()] = t;
+	    }
+
+	    e->visitChildren(*this);
+	}
+
+    private:
+	const std::vector<bool> &lifted_;
+	std::vector<SQLValueType> &types_;
+    };
+}
+
+// A constant compared with an expression of known type is converted to
+// that type when bound, so the lifted literals are converted to the same
+// type before they are used.
+void SQLParse::findLiftedTypes(SQLExpression *e)
+{
+    liftedTypes_.assign(liftedParameters_.size(), SQLOtherType);
+
+    LiftedTypes types(liftedParameters_, liftedTypes_);
+    types.visit(e);
+}
+
 SQLParse * SQLParse::current_parser_ = 0;
 
 void SQLParse::addError(const std::string &err, int line, int column)
@@ -173,16 +609,71 @@ std::string SQLParse::errorString() const
 
 void SQLParse::setExpression(SQLExpression *e)
 {
+    delete program_;
+    program_ = 0;
+
     if (expression_ != 0)
 	expression_->releaseRef();
 
+    if (e != 0 && normaliseOnly_)
+    {
+	// Only the text and the literals were wanted
+	e->getRef();
+	e->releaseRef();
+	e = 0;
+    }
+
     expression_ = e;
 
     if (expression_ != 0)
+    {
 	expression_->getRef();
+	SQLExpression::optimiseTree(expression_);
+
+	if (schema_ != 0)
+	{
+	    std::vector<std::string> errors;
+	    SQLExpression::bindTree(expression_, *schema_, errors);
+
+	    for (size_t i = 0; i < errors.size(); i++)
+		addError(errors[i], 0, 0);
+
+	    if (lifting_)
+		findLiftedTypes(expression_);
+	}
+
+	SQLExpression::eliminateCommon(expression_);
+
+	if (context_ != 0)
+	{
+	    std::vector<std::string> errors;
+	    SQLExpression::resolveVariables(expression_, *context_, errors);
+
+	    for (size_t i = 0; i < errors.size(); i++)
+		addError(errors[i], 0, 0);
+	}
+
+	program_ = new SQLProgram(expression_);
+    }
 }
 
 SQLExpression * SQLParse::expression() const
 {
     return expression_;
 }
+
+void SQLParse::pushDown(SQLPredicateHandler &handler)
+{
+    if (expression_ == 0)
+	return;
+
+    SQLExpression::pushDown(expression_, handler);
+
+    delete program_;
+    program_ = new SQLProgram(expression_);
+}
+
+SQLProgram * SQLParse::program() const
+{
+    return program_;
+}
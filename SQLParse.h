@@ -13,8 +13,16 @@
 
 #include <sys/types.h>
 #include <string>
+#include <vector>
+#include "SQLParameters.h"
 
+class SQLContext;
 class SQLExpression;
+class SQLExpressionList;
+class SQLParameterExpression;
+class SQLPredicateHandler;
+class SQLProgram;
+class SQLSchema;
 
 /**
  * Represent an error during parsing SQL.
@@ -54,9 +62,128 @@ public:
 
     bool parse(const std::string &str);
 
+    /**
+     * Check parsed expressions against the declared types of the
+     * variables and specialise them for those types. Type errors are
+     * reported as parse errors. The schema must remain valid while the
+     * parser is in use. Use 0 for no schema.
+     */
+    void setSchema(const SQLSchema *schema);
+    const SQLSchema *schema() const;
+
+    /**
+     * Resolve the variables of parsed expressions to slots of a context
+     * using SQLContext::resolve() so they are fetched without a lookup by
+     * name. Contexts used to evaluate the expressions should be of the
+     * same class and be chained to contexts of the same classes as this
+     * one, otherwise the variables are looked up by name. Variables that
+     * none of the contexts in the chain have are reported as parse errors.
+     * The context must remain valid while the parser is in use. Use 0 to
+     * look variables up by name.
+     */
+    void setContext(const SQLContext *context);
+
+    /**
+     * Return the parsed expression. Constant sub-expressions have been
+     * evaluated and redundant logic removed.
+     */
     SQLExpression *expression() const;
     void clearExpression();
 
+    /**
+     * Offer the predicates that every matching row must satisfy to the
+     * handler and keep only the rest of the expression, as
+     * SQLExpression::pushDown() does. The expression and program must
+     * then only be evaluated for rows the handler has selected.
+     */
+    void pushDown(SQLPredicateHandler &handler);
+
+    /**
+     * Return the expression compiled into a SQLProgram which evaluates to
+     * the same result faster. Returns 0 if there is no expression.
+     */
+    SQLProgram *program() const;
+
+    /**
+     * Parameters are written as '?' or ':name' in the expression and are
+     * numbered from 0 in the order they first appear. A name used more
+     * than once is the same parameter. Values can be bound and rebound at
+     * any time without parsing the expression again. Binding returns
+     * false if there is no such parameter.
+     */
+    int numParameters() const;
+    /** Return the name of a parameter or "" if it is a '?' */
+    std::string parameterName(int i) const;
+    /** Return the number of a named parameter or -1 if there is none */
+    int parameterIndex(const std::string &name) const;
+
+    bool bind(int i, const SQLValue &v);
+    bool bind(const std::string &name, const SQLValue &v);
+
+    /** Bind a list of values for a parameter used as 'expr in :name' */
+    bool bindList(int i, const std::vector<SQLValue> &values);
+    bool bindList(const std::string &name, const std::vector<SQLValue> &values);
+
+    /** Bind the contents of an application container to a list */
+    template <class Iterator>
+    bool bindList(int i, Iterator begin, Iterator end)
+    {
+	if (i < 0 || i >= numParameters())
+	    return false;
+
+	parameters_->bindList(i, begin, end);
+	return true;
+    }
+
+    template <class Iterator>
+    bool bindList(const std::string &name, Iterator begin, Iterator end)
+    {
+	return bindList(parameterIndex(name), begin, end);
+    }
+
+    /** Remove all of the bound values */
+    void clearParameters();
+
+    /**
+     * Parse the literals compared with a variable, and the lists of
+     * literals tested with 'in' against one, as parameters bound to their
+     * values so queries that differ only in those literals parse to the
+     * same expression. Other literals, such as those in arithmetic or
+     * compared with constants, and 'like' patterns are left in place so
+     * they are folded and checked as before. The literals of queries that
+     * have parameters of their own are not lifted.
+     */
+    void setLiftLiterals(bool lift);
+
+    /** Return the number of parameters that are lifted literals */
+    int numLiftedLiterals() const;
+
+    /**
+     * Return the type a lifted literal is converted to when the expression
+     * is bound to the schema, as it would be if it were left in place, or
+     * SQLOtherType if it is used as it is.
+     */
+    SQLValueType liftedLiteralType(int i) const;
+
+    /**
+     * Parse only as far as the normalised text and the values of the
+     * lifted literals. The expression is not kept.
+     */
+    bool normalise(const std::string &str);
+
+    /**
+     * Return the tokens of the last query parsed while lifting literals
+     * separated by single spaces, with keywords in lower case and the
+     * lifted literals as '?'.
+     */
+    std::string normalisedText() const;
+
+    /**
+     * The values bound to the parameters of the current expression. These
+     * are held by the expression so remain valid while it is in use.
+     */
+    SQLParameters *parameters() const;
+
     int numErrors() const;
     const SQLParseError *errorNumber(int i) const;
 
@@ -67,12 +194,50 @@ private:
     std::string parse_string_;
 
     SQLExpression *expression_;
-
+    SQLProgram *program_;
+    const SQLSchema *schema_;
+    const SQLContext *context_;
+    SQLParameters *parameters_;
+    std::vector<std::string> parameterNames_;
+
+    /** Support for lifting literals */
+    enum TokenKind { KeywordToken, LiteralToken, OtherToken };
+    enum TokenUse { Kept, Lifted, Removed };
+    struct Token
+    {
+	std::string text;
+	TokenKind kind;
+	/** Where the token starts, as the parser gives its location */
+	int line;
+	int column;
+	TokenUse use;
+    };
+
+    bool liftLiterals_;
+    bool lifting_;
+    bool normaliseOnly_;
+    bool ownParameters_;
+    std::vector<Token> tokens_;
+    std::vector<bool> liftedParameters_;
+    std::vector<SQLValueType> liftedTypes_;
+
+    bool parseText(const std::string &str, bool lift);
+    void addToken(const char *text, TokenKind kind, int line, int column);
+    int findToken(int line, int column) const;
+    bool dependsOnRow(SQLExpression *e) const;
+    SQLParameterExpression *liftLiteral(SQLExpression *e, int token);
+    void liftLiterals(SQLExpression *&e1, int token1,
+		      SQLExpression *&e2, int token2);
+    SQLParameterExpression *liftList(SQLExpression *e,
+				     SQLExpressionList *list, int open);
+    void findLiftedTypes(SQLExpression *e);
 
     /** Support routines for yacc */
     void addError(const std::string &err, int line, int column);
     static SQLParse *current_parser_;
     void setExpression(SQLExpression *e);
+    SQLParameterExpression *newParameter(const std::string &name);
+    SQLParameterExpression *newLiftedParameter();
 
     /** Support for error handling */
     int num_errors_;
@@ -84,6 +249,7 @@ private:
 
 friend void SimpleSQL_error(const char *err);
 friend int SimpleSQL_parse();
+friend int SimpleSQL_token();
 };
 
 #endif
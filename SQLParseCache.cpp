@@ -0,0 +1,325 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLParseCache.cpp
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Cache of parsed expressions shared between queries
+ */
+#include "SQLParseCache.h"
+#include "SQLAtomic.h"
+#include "SQLParse.h"
+#include "SQLParameters.h"
+#include "SQLProgram.h"
+#include "SQLContext.h"
+
+/**
+ * A parsed expression shared by the queries with the same normalised
+ * text. Queries hold a reference so it may outlive its place in the
+ * cache.
+ */
+struct SQLCachedQuery::Entry
+{
+    Entry(const std::string &key_) : key(key_), refCount(0) { ; }
+
+    std::string key;
+    SQLParse parser;
+
+    void getRef() { refCount.add(1); }
+    void releaseRef()
+    {
+	if (refCount.add(-1) == 0)
+	    delete this;
+    }
+
+private:
+    SQLAtomic<int> refCount;
+};
+
+SQLCachedQuery::SQLCachedQuery()
+: entry_(0), parameters_(0)
+{
+}
+
+SQLCachedQuery::~SQLCachedQuery()
+{
+    clear();
+}
+
+void SQLCachedQuery::clear()
+{
+    if (entry_ != 0)
+	entry_->releaseRef();
+    entry_ = 0;
+
+    if (parameters_ != 0)
+	parameters_->releaseRef();
+    parameters_ = 0;
+}
+
+bool SQLCachedQuery::valid() const
+{
+    return entry_ != 0 && entry_->parser.numErrors() == 0;
+}
+
+SQLExpression * SQLCachedQuery::expression() const
+{
+    return entry_ != 0 ? entry_->parser.expression() : 0;
+}
+
+SQLProgram * SQLCachedQuery::program() const
+{
+    return entry_ != 0 ? entry_->parser.program() : 0;
+}
+
+const SQLParameters * SQLCachedQuery::parameters() const
+{
+    return parameters_;
+}
+
+std::string SQLCachedQuery::errorString() const
+{
+    return entry_ != 0 ? entry_->parser.errorString() : "";
+}
+
+SQLValue SQLCachedQuery::evaluate(SQLContext &context) const
+{
+    SQLProgram *p = program();
+    if (p == 0)
+	return SQLValue();
+
+    const SQLParameters *old = context.getParameters();
+    if (parameters_ != 0)
+	context.setParameters(parameters_);
+
+    SQLValue v = p->evaluate(context);
+
+    context.setParameters(old);
+
+    return v;
+}
+
+// Parse a query with its literals lifted to find the key and the values
+// of the literals. The lexer is shared so this holds the parse lock.
+static bool normaliseQuery(const std::string &text, SQLParse &lifted)
+{
+    lifted.setLiftLiterals(true);
+
+    return lifted.normalise(text);
+}
+
+std::string SQLParseCache::normalise(const std::string &text)
+{
+    SQLParse lifted;
+
+    Lock lock(parseMutex_);
+    if (!normaliseQuery(text, lifted))
+	return text;
+
+    return lifted.normalisedText();
+}
+
+SQLParseCache::Mutex SQLParseCache::parseMutex_;
+
+SQLParseCache::SQLParseCache(size_t capacity)
+: capacity_(capacity), schema_(0), hits_(0), misses_(0), evictions_(0)
+{
+}
+
+SQLParseCache::~SQLParseCache()
+{
+    removeAll();
+}
+
+// Parse the text as an entry for the key. The errors of a query that does
+// not parse are those for the text as it was given.
+SQLCachedQuery::Entry * SQLParseCache::parseEntry(const std::string &key,
+						  const std::string &text,
+						  const SQLSchema *schema,
+						  bool lift, bool &parsed)
+{
+    SQLCachedQuery::Entry *entry = new SQLCachedQuery::Entry(key);
+    entry->getRef();
+
+    Lock lock(parseMutex_);
+    entry->parser.setSchema(schema);
+    entry->parser.setLiftLiterals(lift);
+    parsed = entry->parser.parse(text);
+
+    if (!parsed && lift)
+    {
+	entry->parser.setLiftLiterals(false);
+	entry->parser.parse(text);
+    }
+
+    return entry;
+}
+
+// Convert the literals to the types they would have been converted to had
+// they been left in the query. Returns false if one cannot be converted,
+// in which case the query would not have parsed.
+static bool convertLiterals(const SQLParse &shared, SQLParameters &literals)
+{
+    for (int i = 0; i < shared.numLiftedLiterals(); i++)
+    {
+	SQLValueType t = shared.liftedLiteralType(i);
+	if (t == SQLOtherType)
+	    continue;
+
+	SQLValue v = literals.value(i);
+	if (v.type() == t)
+	    continue;
+
+	if (!v.convertToType(t))
+	    return false;
+
+	literals.bind(i, v);
+    }
+
+    return true;
+}
+
+bool SQLParseCache::lookup(const std::string &text, SQLCachedQuery &query)
+{
+    query.clear();
+
+    SQLParse lifted;
+    bool normalised;
+    {
+	Lock lock(parseMutex_);
+	normalised = normaliseQuery(text, lifted);
+    }
+
+    std::string key = lifted.normalisedText();
+    const SQLSchema *schema;
+    SQLCachedQuery::Entry *entry = 0;
+
+    {
+	Lock lock(mutex_);
+	schema = schema_;
+
+	std::map<std::string, EntryList::iterator>::iterator i =
+	    normalised ? index_.find(key) : index_.end();
+	if (i != index_.end())
+	{
+	    entry = *i->second;
+	    entries_.splice(entries_.begin(), entries_, i->second);
+	    entry->getRef();
+	    hits_++;
+	}
+	else
+	    misses_++;
+    }
+
+    if (entry == 0)
+    {
+	bool parsed;
+	entry = parseEntry(key, text, schema, normalised, parsed);
+
+	if (!parsed)
+	{
+	    query.entry_ = entry;
+	    return query.valid();
+	}
+
+	Lock lock(mutex_);
+
+	// Another thread may have added the same query meanwhile
+	if (index_.find(key) == index_.end() && capacity_ > 0 &&
+	    schema == schema_)
+	{
+	    entries_.push_front(entry);
+	    index_[key] = entries_.begin();
+	    entry->getRef();
+
+	    while (entries_.size() > capacity_)
+	    {
+		SQLCachedQuery::Entry *old = entries_.back();
+		entries_.pop_back();
+		index_.erase(old->key);
+		old->releaseRef();
+		evictions_++;
+	    }
+	}
+    }
+
+    query.entry_ = entry;
+
+    if (lifted.numLiftedLiterals() > 0)
+    {
+	SQLParameters *p = lifted.parameters();
+	p->getRef();
+	query.parameters_ = p;
+
+	// A literal the schema rejects is reported as it would be had the
+	// query been parsed without the cache
+	if (!convertLiterals(entry->parser, *p))
+	{
+	    query.clear();
+
+	    bool parsed;
+	    query.entry_ = parseEntry(text, text, schema, false, parsed);
+	}
+    }
+
+    return query.valid();
+}
+
+void SQLParseCache::setSchema(const SQLSchema *schema)
+{
+    Lock lock(mutex_);
+
+    schema_ = schema;
+    removeAll();
+}
+
+void SQLParseCache::clear()
+{
+    Lock lock(mutex_);
+
+    removeAll();
+}
+
+void SQLParseCache::removeAll()
+{
+    for (EntryList::iterator i = entries_.begin(); i != entries_.end(); ++i)
+	(*i)->releaseRef();
+
+    entries_.clear();
+    index_.clear();
+}
+
+size_t SQLParseCache::size() const
+{
+    Lock lock(mutex_);
+
+    return entries_.size();
+}
+
+size_t SQLParseCache::capacity() const
+{
+    return capacity_;
+}
+
+unsigned long SQLParseCache::hits() const
+{
+    Lock lock(mutex_);
+
+    return hits_;
+}
+
+unsigned long SQLParseCache::misses() const
+{
+    Lock lock(mutex_);
+
+    return misses_;
+}
+
+unsigned long SQLParseCache::evictions() const
+{
+    Lock lock(mutex_);
+
+    return evictions_;
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLParseCache.h
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Cache of parsed expressions shared between queries
+ */
+#ifndef SQLPARSECACHE_H
+#define SQLPARSECACHE_H
+
+#include "SQLValue.h"
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#if __cplusplus >= 201103L
+#include <mutex>
+#else
+#include <pthread.h>
+#endif
+
+class SQLContext;
+class SQLExpression;
+class SQLParameters;
+class SQLProgram;
+class SQLSchema;
+
+/**
+ * A query found in a SQLParseCache. The expression is shared with every
+ * other query that has the same form and the literals of this query are
+ * its parameter values. The expression may be evaluated by several
+ * threads at once provided each uses its own SQLContext: constants are
+ * converted and 'in' sets built when it is parsed, values and expressions
+ * are shared by atomic reference counts and the only other state changed
+ * by evaluating is the atomic statistics of AND and OR chains. Functions
+ * and contexts supplied by the application must also allow this.
+ */
+class SQLCachedQuery
+{
+public:
+    SQLCachedQuery();
+    ~SQLCachedQuery();
+
+    /** True if the query parsed without errors */
+    bool valid() const;
+
+    SQLExpression *expression() const;
+    SQLProgram *program() const;
+
+    /**
+     * The literals of the query as values for the parameters of the
+     * expression. Returns 0 if the literals were not lifted because the
+     * query has parameters of its own.
+     */
+    const SQLParameters *parameters() const;
+
+    /** Return all of the parse errors as a string */
+    std::string errorString() const;
+
+    /** Evaluate the program with the literals of this query */
+    SQLValue evaluate(SQLContext &context) const;
+
+    /** Release the shared expression */
+    void clear();
+
+private:
+    struct Entry;
+
+    SQLCachedQuery(const SQLCachedQuery &);
+    void operator=(const SQLCachedQuery &);
+
+    Entry *entry_;
+    SQLParameters *parameters_;
+
+friend class SQLParseCache;
+};
+
+/**
+ * Least recently used cache of parsed expressions. Queries are looked up
+ * by the normalised text from SQLParse with the literals compared with
+ * variables lifted to parameters, so queries that differ only in those
+ * literals share one parsed and optimised expression. Other literals,
+ * such as LIKE patterns and those in arithmetic, are part of the key so
+ * every query gives the same results as it would parsed on its own.
+ * Lookups may be made from any thread. Finding the key uses the parser so
+ * is serialised with parsing.
+ */
+class SQLParseCache
+{
+public:
+    SQLParseCache(size_t capacity = 1000);
+    ~SQLParseCache();
+
+    /**
+     * Find or parse a query. Returns false if it does not parse, in which
+     * case the errors are those for the text as it was given.
+     */
+    bool lookup(const std::string &text, SQLCachedQuery &query);
+
+    /**
+     * Parse with the declared types of a schema. This empties the cache.
+     * The schema must remain valid while the cache is in use.
+     */
+    void setSchema(const SQLSchema *schema);
+
+    /** Remove all of the expressions. Queries using them are unaffected */
+    void clear();
+
+    size_t size() const;
+    size_t capacity() const;
+
+    unsigned long hits() const;
+    unsigned long misses() const;
+    unsigned long evictions() const;
+
+    /** Return the normalised form of a query used as the key */
+    static std::string normalise(const std::string &text);
+
+private:
+    SQLParseCache(const SQLParseCache &);
+    void operator=(const SQLParseCache &);
+
+    typedef std::list<SQLCachedQuery::Entry *> EntryList;
+
+    /** Most recently used first */
+    EntryList entries_;
+    std::map<std::string, EntryList::iterator> index_;
+
+    size_t capacity_;
+    const SQLSchema *schema_;
+
+    unsigned long hits_;
+    unsigned long misses_;
+    unsigned long evictions_;
+
+    class Mutex
+    {
+    public:
+#if __cplusplus >= 201103L
+	void lock() { mutex.lock(); }
+	void unlock() { mutex.unlock(); }
+    private:
+	std::mutex mutex;
+#else
+	Mutex() { pthread_mutex_init(&mutex, 0); }
+	~Mutex() { pthread_mutex_destroy(&mutex); }
+	void lock() { pthread_mutex_lock(&mutex); }
+	void unlock() { pthread_mutex_unlock(&mutex); }
+    private:
+	pthread_mutex_t mutex;
+#endif
+    };
+
+    class Lock
+    {
+    public:
+	Lock(Mutex &m) : mutex(m) { mutex.lock(); }
+	~Lock() { mutex.unlock(); }
+    private:
+	Mutex &mutex;
+    };
+
+    mutable Mutex mutex_;
+
+    /** The parser uses global state so one query is parsed at a time */
+    static Mutex parseMutex_;
+
+    static SQLCachedQuery::Entry *parseEntry(const std::string &key,
+					     const std::string &text,
+					     const SQLSchema *schema,
+					     bool lift, bool &parsed);
+    void removeAll();
+};
+
+#endif
@@ -0,0 +1,187 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLPool.cpp
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Memory pool for values created during evaluation
+ */
+#include "SQLPool.h"
+#include "SQLValue.h"
+#include <new>
+
+#if __cplusplus < 201103L
+#include <pthread.h>
+#endif
+
+// Blocks are rounded up to a multiple of the granularity and those larger
+// than the biggest size class come straight from the global allocator.
+enum { GRANULARITY = 16, NUM_CLASSES = 16 };
+
+namespace
+{
+    struct Block
+    {
+	Block *next;
+    };
+}
+
+// Free lists and statistics are per thread so no locking is needed. A block
+// released by a different thread to the one that allocated it just moves
+// to that thread's free list.
+static SQL_THREAD_LOCAL Block *freeLists[NUM_CLASSES];
+static SQL_THREAD_LOCAL unsigned long numGlobalAllocations;
+static SQL_THREAD_LOCAL unsigned long numPoolAllocations;
+
+// Set once the thread has arranged to trim its free lists when it exits,
+// and once it has done so
+static SQL_THREAD_LOCAL bool exitRegistered;
+static SQL_THREAD_LOCAL bool exited;
+
+static void threadExit()
+{
+    SQLPool::trim();
+
+    // Blocks released by later thread exit handlers are not pooled
+    exited = true;
+}
+
+#if __cplusplus >= 201103L
+namespace
+{
+    struct ThreadExit
+    {
+	~ThreadExit() { threadExit(); }
+    };
+}
+
+static thread_local ThreadExit threadExitHandler;
+
+static void registerThreadExit()
+{
+    // Using the object constructs it and registers its destructor
+    (void)&threadExitHandler;
+    exitRegistered = true;
+}
+#else
+static pthread_key_t threadExitKey;
+static pthread_once_t threadExitOnce = PTHREAD_ONCE_INIT;
+
+static void threadExitDestructor(void *)
+{
+    threadExit();
+}
+
+static void createThreadExitKey()
+{
+    pthread_key_create(&threadExitKey, threadExitDestructor);
+}
+
+static void registerThreadExit()
+{
+    pthread_once(&threadExitOnce, createThreadExitKey);
+
+    // The destructor is only called for a non-null value
+    pthread_setspecific(threadExitKey, &threadExitKey);
+    exitRegistered = true;
+}
+#endif
+
+void * SQLPool::allocate(size_t size)
+{
+    size_t c = (size + GRANULARITY - 1) / GRANULARITY;
+
+    // Large blocks are not pooled
+    if (c == 0 || c > NUM_CLASSES)
+    {
+	numGlobalAllocations++;
+	return ::operator new(size);
+    }
+
+    Block *b = freeLists[c - 1];
+    if (b != 0)
+    {
+	freeLists[c - 1] = b->next;
+	numPoolAllocations++;
+	return b;
+    }
+
+    numGlobalAllocations++;
+    return ::operator new(c * GRANULARITY);
+}
+
+void SQLPool::release(void *p, size_t size)
+{
+    if (p == 0)
+	return;
+
+    size_t c = (size + GRANULARITY - 1) / GRANULARITY;
+
+    if (c == 0 || c > NUM_CLASSES || exited)
+    {
+	::operator delete(p);
+	return;
+    }
+
+    if (!exitRegistered)
+	registerThreadExit();
+
+    Block *b = (Block *)p;
+    b->next = freeLists[c - 1];
+    freeLists[c - 1] = b;
+}
+
+void SQLPool::trim()
+{
+    for (int c = 0; c < NUM_CLASSES; c++)
+    {
+	while (freeLists[c] != 0)
+	{
+	    Block *b = freeLists[c];
+	    freeLists[c] = b->next;
+
+	    ::operator delete(b);
+	}
+    }
+}
+
+unsigned long SQLPool::globalAllocations()
+{
+    return numGlobalAllocations;
+}
+
+unsigned long SQLPool::poolAllocations()
+{
+    return numPoolAllocations;
+}
+
+// SQLValueArray definition
+SQLValueArray::SQLValueArray(int size)
+: size_(size), values_(0)
+{
+    if (size_ <= 0)
+	return;
+
+    values_ = (SQLValue *)SQLPool::allocate(size_ * sizeof(SQLValue));
+
+    for (int i = 0; i < size_; i++)
+	new (&values_[i]) SQLValue;
+}
+
+SQLValueArray::~SQLValueArray()
+{
+    if (values_ == 0)
+	return;
+
+    for (int i = 0; i < size_; i++)
+	values_[i].~SQLValue();
+
+    SQLPool::release(values_, size_ * sizeof(SQLValue));
+}
+
+SQLValue & SQLValueArray::operator[](int i)
+{
+    return values_[i];
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLPool.h
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Memory pool for values created during evaluation
+ */
+#ifndef SQLPOOL_H
+#define SQLPOOL_H
+
+#include <stddef.h>
+
+#if __cplusplus >= 201103L
+#define SQL_THREAD_LOCAL thread_local
+#else
+#define SQL_THREAD_LOCAL __thread
+#endif
+
+class SQLValue;
+
+/**
+ * Thread local size class allocator used for the SQLValueRep objects and
+ * argument arrays created while evaluating expressions. Released blocks
+ * are kept on a free list for their size class so once a query has run
+ * for a few objects further evaluation does not use the global allocator.
+ * The free lists of a thread are returned to the global allocator when
+ * the thread exits.
+ */
+class SQLPool
+{
+public:
+    static void *allocate(size_t size);
+    static void release(void *p, size_t size);
+
+    /**
+     * Return the cached blocks of this thread to the global allocator now
+     * rather than when the thread exits
+     */
+    static void trim();
+
+    /**
+     * Number of blocks this thread has obtained from the global allocator.
+     * This should not change while evaluating in the steady state.
+     */
+    static unsigned long globalAllocations();
+
+    /** Number of blocks this thread has obtained from the free lists */
+    static unsigned long poolAllocations();
+};
+
+/**
+ * Array of SQLValue objects allocated from the SQLPool.
+ */
+class SQLValueArray
+{
+public:
+    SQLValueArray(int size);
+    ~SQLValueArray();
+
+    SQLValue &operator[](int i);
+    SQLValue *values() { return values_; }
+
+private:
+    SQLValueArray(const SQLValueArray &);
+    void operator=(const SQLValueArray &);
+
+    int size_;
+    SQLValue *values_;
+};
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLPredicate.cpp
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Conditions of an expression offered to the data source
+ */
+#include "SQLPredicate.h"
+
+std::string SQLPredicate::name() const
+{
+    if (className.empty())
+	return memberName;
+    else
+	return className + "." + memberName;
+}
+
+const char * SQLPredicate::operatorName(Operator op)
+{
+    switch (op)
+    {
+    case Equals:
+	return "=";
+    case NotEquals:
+	return "!=";
+    case LessThan:
+	return "<";
+    case GreaterThan:
+	return ">";
+    case LessEquals:
+	return "<=";
+    case GreaterEquals:
+	return ">=";
+    case Within:
+	return "within";
+    case In:
+	return "in";
+    case Like:
+	return "like";
+    case IsNull:
+	return "is null";
+    default:
+	return "?";
+    }
+}
+
+std::string SQLPredicate::asString() const
+{
+    std::string s = name() + " " + operatorName(op);
+
+    if (op == In)
+    {
+	s += " (";
+	for (size_t i = 0; i < values.size(); i++)
+	{
+	    if (i > 0)
+		s += ", ";
+	    s += values[i].asString();
+	}
+	s += ")";
+    }
+    else if (!values.empty())
+	s += " " + values[0].asString();
+
+    if (caseInsensitive)
+    {
+	for (size_t i = 0; i < values.size(); i++)
+	{
+	    if (values[i].type() == SQLStringType)
+	    {
+		s += " ignoring case";
+		break;
+	    }
+	}
+    }
+
+    return s;
+}
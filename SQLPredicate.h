@@ -0,0 +1,90 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLPredicate.h
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Conditions of an expression offered to the data source
+ */
+#ifndef SQLPREDICATE_H
+#define SQLPREDICATE_H
+
+#include "SQLValue.h"
+#include <string>
+#include <vector>
+
+class SQLExpression;
+
+/**
+ * A condition on a single variable that must hold for a row to match an
+ * expression, such as "unit = 'Unit 1'" or "start < X". The constants are
+ * those written in the expression. When the expression has been bound to
+ * a SQLSchema they have been converted to the declared type of the
+ * variable.
+ */
+struct SQLPredicate
+{
+    enum Operator
+    {
+	/** The variable compared with values[0] */
+	Equals,
+	NotEquals,
+	LessThan,
+	GreaterThan,
+	LessEquals,
+	GreaterEquals,
+	/** The address is within the network values[0] */
+	Within,
+	/** The variable is equal to one of the values */
+	In,
+	/** The string matches the 'like' pattern values[0] */
+	Like,
+	/** The variable is null. There are no values */
+	IsNull
+    };
+
+    std::string className;
+    std::string memberName;
+    Operator op;
+    std::vector<SQLValue> values;
+
+    /**
+     * Set if strings were compared without case, as set with
+     * SQLStringValue::setCaseInsensitive(), when the predicate was
+     * offered. A handler that can only compare strings exactly must not
+     * accept a predicate on strings with this set.
+     */
+    bool caseInsensitive;
+
+    /** The condition as it appears in the expression */
+    SQLExpression *expression;
+
+    /** The name of the variable as it is written in an expression */
+    std::string name() const;
+
+    static const char *operatorName(Operator op);
+
+    /** Show the predicate as a string. This is useful for debugging */
+    std::string asString() const;
+};
+
+/**
+ * Implemented by an application that can select the rows matching some
+ * predicates itself, for example from an index. See
+ * SQLExpression::pushDown().
+ */
+class SQLPredicateHandler
+{
+public:
+    virtual ~SQLPredicateHandler() { ; }
+
+    /**
+     * Return true if the application will only pass rows for which the
+     * predicate is true to the rest of the expression.
+     */
+    virtual bool accept(const SQLPredicate &predicate) = 0;
+};
+
+#endif
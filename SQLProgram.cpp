@@ -0,0 +1,365 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLProgram.cpp
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Expression tree compiled to a list of instructions
+ */
+#include "SQLProgram.h"
+#include "SQLExpression.h"
+#include "SQLContext.h"
+#include <assert.h>
+#include <sstream>
+
+SQLProgram::SQLProgram(SQLExpression *e)
+: expression_(e), result_(0), numRegisters_(0), top_(0)
+{
+    if (expression_ == 0)
+	return;
+
+    // Hold the tree as the instructions refer to its nodes
+    expression_->getRef();
+
+    result_ = expression_->compile(*this);
+}
+
+SQLProgram::~SQLProgram()
+{
+    if (expression_ != 0)
+	expression_->releaseRef();
+}
+
+int SQLProgram::numInstructions() const
+{
+    return code_.size();
+}
+
+int SQLProgram::numRegisters() const
+{
+    return numRegisters_;
+}
+
+int SQLProgram::pushRegister()
+{
+    int r = top_++;
+
+    if (top_ > numRegisters_)
+	numRegisters_ = top_;
+
+    return r;
+}
+
+void SQLProgram::popRegister()
+{
+    assert(top_ > 0);
+
+    top_--;
+}
+
+int SQLProgram::emit(OpCode op, int a, int b, int arg, bool constant)
+{
+    Instruction i;
+    i.op = op;
+    i.arg = arg;
+    i.constant = constant;
+    i.a = a;
+    i.b = b;
+
+    code_.push_back(i);
+
+    return code_.size() - 1;
+}
+
+void SQLProgram::setJump(int instruction)
+{
+    code_[instruction].b = code_.size();
+}
+
+int SQLProgram::addConstant(SQLValueExpression *e)
+{
+    constants_.push_back(e);
+
+    return constants_.size() - 1;
+}
+
+int SQLProgram::addVariable(const std::string &class_name,
+			    const std::string &member_name,
+			    int slot, const std::type_info *context)
+{
+    Variable v;
+    v.className = class_name;
+    v.memberName = member_name;
+    v.slot = slot;
+    v.context = context;
+
+    variables_.push_back(v);
+
+    return variables_.size() - 1;
+}
+
+int SQLProgram::addNode(SQLExpression *e)
+{
+    nodes_.push_back(e);
+
+    return nodes_.size() - 1;
+}
+
+// Apply a Compare or Operation leaving the result in v1
+void SQLProgram::compare(const Instruction &i, SQLValue &v1,
+			 const SQLValue &value2)
+{
+    SQLValueType t = v1.type();
+
+    // Values of different types have to be converted first, as do values
+    // of application types, then compared as evaluateSiblings() does
+    SQLValue c;
+    bool converted = value2.type() != t || t == SQLOtherType;
+    if (converted)
+    {
+	c = value2;
+	if (!SQLBinaryExpression::matchSiblings(v1, c))
+	    return;
+    }
+    const SQLValue &v2 = converted ? c : value2;
+
+    if (i.op == Operation)
+    {
+	v1 = v1.binaryOperation(v2, i.arg);
+	return;
+    }
+
+    bool res;
+    switch (i.arg)
+    {
+    case Equals:
+	res = v1.compare(v2) == 0;
+	break;
+    case NotEquals:
+	res = v1.compare(v2) != 0;
+	break;
+    case LessThan:
+	res = v1.compare(v2) < 0;
+	break;
+    case GreaterThan:
+	res = v1.compare(v2) > 0;
+	break;
+    case LessEquals:
+	res = v1.compare(v2) <= 0;
+	break;
+    case GreaterEquals:
+	res = v1.compare(v2) >= 0;
+	break;
+    case Within:
+	if (v1.type() != SQLIPAddressType)
+	{
+	    v1 = SQLValue(new SQLExceptionValue(
+			      "Subnet match on a value that is not an IP address: " +
+			      v1.asString()));
+	    return;
+	}
+	res = v1.isWithin(v2);
+	break;
+    default:
+	assert(0);
+	res = false;
+    }
+
+    v1 = res ? SQLExpression::SQLTrueValue : SQLExpression::SQLFalseValue;
+}
+
+SQLValue SQLProgram::evaluate(SQLContext &context)
+{
+    SQLValue result;
+
+    if (expression_ == 0)
+	return result;
+
+    // Most expressions need only a few registers so avoid the pool
+    SQLValue small[SMALL_REGISTERS];
+    SQLValueArray registers(numRegisters_ > SMALL_REGISTERS ?
+			    numRegisters_ : 0);
+    SQLValue *r = numRegisters_ > SMALL_REGISTERS ?
+	registers.values() : small;
+
+    const Instruction *code = &code_[0];
+    int size = code_.size();
+
+    for (int pc = 0; pc < size; pc++)
+    {
+	const Instruction &i = code[pc];
+	SQLValue &v = r[i.a];
+
+	switch (i.op)
+	{
+	case LoadConstant:
+	    v = constants_[i.b]->getValue();
+	    break;
+	case LoadVariable:
+	{
+	    const Variable &var = variables_[i.b];
+
+	    if (var.context != 0 && typeid(context) == *var.context)
+		v = context.fetch(var.slot);
+	    else
+		v = context.variableLookup(var.className, var.memberName);
+	    break;
+	}
+	case Evaluate:
+	    v = nodes_[i.b]->evaluate(context);
+	    break;
+	case JumpIfNull:
+	    if (v.isNull() || v.isException())
+		pc = i.b - 1;
+	    break;
+	case JumpIfFalse:
+	    if (v.isException() || (!v.isNull() && !v.asBoolean()))
+		pc = i.b - 1;
+	    break;
+	case JumpIfTrue:
+	    if (v.isException() || v.asBoolean())
+		pc = i.b - 1;
+	    break;
+	case Compare:
+	case Operation:
+	    if (i.constant)
+		// Constants keep the conversion to the variable type
+		compare(i, v, constants_[i.b]->valueAsType(v));
+	    else
+		compare(i, v, r[i.b]);
+	    break;
+	case And:
+	{
+	    SQLValue &v2 = r[i.b];
+
+	    if (!v2.asBoolean() || v2.isNull())
+		v.swap(v2);
+	    break;
+	}
+	case Or:
+	{
+	    SQLValue &v2 = r[i.b];
+
+	    if (v2.asBoolean() || v2.isNull())
+		v.swap(v2);
+	    break;
+	}
+	case Xor:
+	{
+	    SQLValue &v2 = r[i.b];
+
+	    if (v.isException())
+		break;
+	    if (v2.isException())
+		v.swap(v2);
+	    else if (v.asBoolean() ^ v2.asBoolean())
+		v = SQLExpression::SQLTrueValue;
+	    else
+		v = SQLExpression::SQLFalseValue;
+	    break;
+	}
+	case Not:
+	    if (!v.isNull() && !v.isException())
+		v = v.asBoolean() ?
+		    SQLExpression::SQLFalseValue : SQLExpression::SQLTrueValue;
+	    break;
+	case Negate:
+	    v = v.unaryOperation('-');
+	    break;
+	case IsNull:
+	    if (!v.isException())
+		v = v.isNull() ?
+		    SQLExpression::SQLTrueValue : SQLExpression::SQLFalseValue;
+	    break;
+	default:
+	    assert(0);
+	}
+    }
+
+    result.swap(r[result_]);
+
+    return result;
+}
+
+static const char *opCodeName(int op)
+{
+    static const char *names[] =
+    {
+	"LoadConstant", "LoadVariable", "Evaluate", "JumpIfNull",
+	"JumpIfFalse", "JumpIfTrue", "Compare", "Operation", "And", "Or",
+	"Xor", "Not", "Negate", "IsNull"
+    };
+
+    return names[op];
+}
+
+const char * SQLProgram::testName(int test)
+{
+    static const char *names[] =
+    {
+	"Equals", "NotEquals", "LessThan", "GreaterThan", "LessEquals",
+	"GreaterEquals", "Within"
+    };
+
+    return names[test];
+}
+
+// Show the instructions as a string. This is useful for debugging
+std::string SQLProgram::asString() const
+{
+    std::stringstream s;
+
+    for (size_t pc = 0; pc < code_.size(); pc++)
+    {
+	const Instruction &i = code_[pc];
+
+	s << pc << ": " << opCodeName(i.op) << " r" << i.a;
+
+	switch (i.op)
+	{
+	case LoadConstant:
+	    s << ", " << constants_[i.b]->asString();
+	    break;
+	case LoadVariable:
+	    if (!variables_[i.b].className.empty())
+		s << ", " << variables_[i.b].className << ".";
+	    else
+		s << ", ";
+	    s << variables_[i.b].memberName;
+	    break;
+	case Evaluate:
+	    s << ", " << nodes_[i.b]->asString();
+	    break;
+	case JumpIfNull:
+	case JumpIfFalse:
+	case JumpIfTrue:
+	    s << ", " << i.b;
+	    break;
+	case Compare:
+	case Operation:
+	    if (i.op == Compare)
+		s << " " << testName(i.arg);
+	    else
+		s << " " << (char)i.arg;
+
+	    if (i.constant)
+		s << " " << constants_[i.b]->asString();
+	    else
+		s << " r" << i.b;
+	    break;
+	case And:
+	case Or:
+	case Xor:
+	    s << ", r" << i.b;
+	    break;
+	default:
+	    break;
+	}
+
+	s << "\n";
+    }
+
+    return s.str();
+}
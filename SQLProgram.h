@@ -0,0 +1,142 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLProgram.h
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Expression tree compiled to a list of instructions
+ */
+#ifndef SQLPROGRAM_H
+#define SQLPROGRAM_H
+
+#include "SQLValue.h"
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+class SQLContext;
+class SQLExpression;
+class SQLValueExpression;
+
+/**
+ * An expression tree lowered into a flat list of instructions working on
+ * an array of registers. Evaluating the program gives the same result as
+ * evaluating the tree but runs as a single loop rather than a recursive
+ * walk of virtual calls. Nodes that have no instructions of their own are
+ * evaluated as a tree by the Evaluate instruction.
+ */
+class SQLProgram
+{
+public:
+    SQLProgram(SQLExpression *e);
+    ~SQLProgram();
+
+    SQLValue evaluate(SQLContext &context);
+
+    /** Show the instructions as a string. This is useful for debugging */
+    std::string asString() const;
+
+    int numInstructions() const;
+    int numRegisters() const;
+
+    enum OpCode
+    {
+	/** r[a] = constant b */
+	LoadConstant,
+	/** r[a] = variable b */
+	LoadVariable,
+	/** r[a] = node b evaluated as a tree */
+	Evaluate,
+	/** Jump to b if r[a] is null or an exception */
+	JumpIfNull,
+	/** Jump to b if r[a] is an exception or is false and not null */
+	JumpIfFalse,
+	/** Jump to b if r[a] is an exception or is true */
+	JumpIfTrue,
+	/** r[a] = r[a] arg r[b], or constant b if constant is set */
+	Compare,
+	Operation,
+	/** r[a] = r[a] arg r[b] for the logical operators */
+	And,
+	Or,
+	Xor,
+	/** r[a] = arg r[a] */
+	Not,
+	Negate,
+	IsNull
+    };
+
+    /** The arg of a Compare instruction */
+    enum Test
+    {
+	Equals,
+	NotEquals,
+	LessThan,
+	GreaterThan,
+	LessEquals,
+	GreaterEquals,
+	Within
+    };
+
+    /** Return the name of a Test */
+    static const char *testName(int test);
+
+    /**
+     * Interface for SQLExpression::compile(). Registers are used as a stack
+     * so each expression leaves its result in the register it pushed.
+     */
+    int pushRegister();
+    void popRegister();
+
+    /** Add an instruction and return its index */
+    int emit(OpCode op, int a, int b = 0, int arg = 0, bool constant = false);
+
+    /** Make the jump instruction go to the next instruction added */
+    void setJump(int instruction);
+
+    int addConstant(SQLValueExpression *e);
+    /** Add a variable, with its slot if it was resolved for a context */
+    int addVariable(const std::string &class_name,
+		    const std::string &member_name,
+		    int slot = -1, const std::type_info *context = 0);
+    int addNode(SQLExpression *e);
+
+private:
+    SQLProgram(const SQLProgram &);
+    void operator=(const SQLProgram &);
+
+    struct Instruction
+    {
+	unsigned char op;
+	unsigned char arg;
+	bool constant;
+	int a;
+	int b;
+    };
+
+    struct Variable
+    {
+	std::string className;
+	std::string memberName;
+	int slot;
+	const std::type_info *context;
+    };
+
+    enum { SMALL_REGISTERS = 4 };
+
+    SQLExpression *expression_;
+    std::vector<Instruction> code_;
+    std::vector<SQLValueExpression *> constants_;
+    std::vector<Variable> variables_;
+    std::vector<SQLExpression *> nodes_;
+
+    int result_;
+    int numRegisters_;
+    int top_;
+
+    void compare(const Instruction &i, SQLValue &v1, const SQLValue &v2);
+};
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLReferences.cpp
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Variables and functions that an expression depends on
+ */
+#include "SQLReferences.h"
+
+std::string SQLVariableReference::name() const
+{
+    if (className.empty())
+	return memberName;
+    else
+	return className + "." + memberName;
+}
+
+SQLReferences::SQLReferences()
+{
+}
+
+const SQLVariableReference *
+SQLReferences::findVariable(const std::string &class_name,
+			    const std::string &member_name) const
+{
+    for (size_t i = 0; i < variables_.size(); i++)
+	if (variables_[i].className == class_name &&
+	    variables_[i].memberName == member_name)
+	    return &variables_[i];
+
+    return 0;
+}
+
+bool SQLReferences::referencesFunction(const std::string &name) const
+{
+    for (size_t i = 0; i < functions_.size(); i++)
+	if (functions_[i] == name)
+	    return true;
+
+    return false;
+}
+
+void SQLReferences::addVariable(const std::string &class_name,
+				const std::string &member_name, int usage)
+{
+    for (size_t i = 0; i < variables_.size(); i++)
+    {
+	if (variables_[i].className == class_name &&
+	    variables_[i].memberName == member_name)
+	{
+	    variables_[i].usage |= usage;
+	    return;
+	}
+    }
+
+    SQLVariableReference v;
+    v.className = class_name;
+    v.memberName = member_name;
+    v.usage = usage;
+
+    variables_.push_back(v);
+}
+
+void SQLReferences::addFunction(const std::string &name)
+{
+    if (!referencesFunction(name))
+	functions_.push_back(name);
+}
+
+void SQLReferences::clear()
+{
+    variables_.clear();
+    functions_.clear();
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLReferences.h
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Variables and functions that an expression depends on
+ */
+#ifndef SQLREFERENCES_H
+#define SQLREFERENCES_H
+
+#include <string>
+#include <vector>
+
+/**
+ * A variable referenced by an expression and the ways it is used.
+ */
+struct SQLVariableReference
+{
+    /** Bits of usage */
+    enum Usage
+    {
+	/** Compared for equality or inequality, or tested with 'in' */
+	Equality = 1,
+	/** Compared with <, <=, > or >=, or tested with 'between' */
+	Range = 2,
+	/** Matched against a 'like' pattern */
+	Pattern = 4,
+	/** Used in any other way such as an argument to a function */
+	Other = 8
+    };
+
+    std::string className;
+    std::string memberName;
+    int usage;
+
+    /** The name as it is written in an expression */
+    std::string name() const;
+};
+
+/**
+ * The variables and functions referenced by an expression, as found by
+ * SQLExpression::findReferences(). An application can use this to load
+ * only the fields that a filter needs, or to fetch them in bulk before it
+ * is evaluated. Each variable and function is listed once in the order
+ * it is first seen.
+ */
+class SQLReferences
+{
+public:
+    SQLReferences();
+
+    const std::vector<SQLVariableReference> &variables() const
+    {
+	return variables_;
+    }
+
+    /** Names of the functions called as they are written */
+    const std::vector<std::string> &functions() const { return functions_; }
+
+    /** Return the variable or 0 if the expression does not reference it */
+    const SQLVariableReference *findVariable(const std::string &class_name,
+					     const std::string &member_name)
+	const;
+
+    bool referencesFunction(const std::string &name) const;
+
+    void addVariable(const std::string &class_name,
+		     const std::string &member_name, int usage);
+    void addFunction(const std::string &name);
+
+    void clear();
+
+private:
+    std::vector<SQLVariableReference> variables_;
+    std::vector<std::string> functions_;
+};
+
+#endif
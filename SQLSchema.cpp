@@ -0,0 +1,63 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLSchema.cpp
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Declared types of the variables of a context
+ */
+#include "SQLSchema.h"
+
+SQLSchema::SQLSchema()
+{
+}
+
+void SQLSchema::addField(const std::string &member_name, SQLValueType type)
+{
+    addField("", member_name, type);
+}
+
+void SQLSchema::addField(const std::string &class_name,
+			 const std::string &member_name,
+			 SQLValueType type)
+{
+    fields[fieldName(class_name, member_name)] = type;
+}
+
+SQLValueType SQLSchema::fieldType(const std::string &class_name,
+				  const std::string &member_name) const
+{
+    FieldMap::const_iterator i = fields.find(fieldName(class_name,
+							member_name));
+    if (i == fields.end())
+	return SQLOtherType;
+
+    return i->second;
+}
+
+void SQLSchema::addFunction(const SQLFunction &function)
+{
+    functions.addFunction(function);
+}
+
+const SQLFunction * SQLSchema::findFunction(const std::string &class_name,
+					    const std::string &member_name) const
+{
+    const SQLFunction *f = functions.findFunction(class_name, member_name);
+    if (f != 0)
+	return f;
+
+    return SQLFunctionRegistry::builtins().findFunction(class_name,
+							member_name);
+}
+
+std::string SQLSchema::fieldName(const std::string &class_name,
+				 const std::string &member_name)
+{
+    if (class_name.empty())
+	return member_name;
+    else
+	return class_name + "." + member_name;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLSchema.h
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Declared types of the variables of a context
+ */
+#ifndef SQLSCHEMA_H
+#define SQLSCHEMA_H
+
+#include "SQLValue.h"
+#include "SQLFunction.h"
+#include <map>
+#include <string>
+
+/**
+ * The types of the variables that a SQLContext will return. When a schema
+ * is given to SQLParse the expression is checked against it once when it
+ * is parsed and comparisons are replaced with versions that work directly
+ * on values of the declared types. Variables that are not declared are
+ * handled as before. Functions are also declared here so they are
+ * resolved when the expression is bound.
+ */
+class SQLSchema
+{
+public:
+    SQLSchema();
+
+    /** Declare the type of a variable optionally in a class */
+    void addField(const std::string &member_name, SQLValueType type);
+    void addField(const std::string &class_name,
+		  const std::string &member_name,
+		  SQLValueType type);
+
+    /**
+     * Return the declared type of the variable or SQLOtherType if it has
+     * not been declared.
+     */
+    SQLValueType fieldType(const std::string &class_name,
+			   const std::string &member_name) const;
+
+    /**
+     * Declare a native function. Calls to functions that are not declared
+     * are passed to SQLContext::functionLookup() when evaluated.
+     */
+    void addFunction(const SQLFunction &function);
+
+    /**
+     * Return the declared function, or the default function of the name,
+     * or 0 if there is neither.
+     */
+    const SQLFunction *findFunction(const std::string &class_name,
+				    const std::string &member_name) const;
+
+private:
+    typedef std::map<std::string, SQLValueType> FieldMap;
+    FieldMap fields;
+    SQLFunctionRegistry functions;
+
+    static std::string fieldName(const std::string &class_name,
+				 const std::string &member_name);
+};
+
+#endif
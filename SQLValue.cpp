@@ -10,40 +10,80 @@
  */
 #include "SQLValue.h"
 #include <string.h>
+#include <limits.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <locale.h>
+#include <errno.h>
 #include <sstream>
 
-#define USE_BOOST 0
-
-#if USE_BOOST
-#include <boost/lexical_cast.hpp>
+#if SQL_IP_SUPPORT
+#include <arpa/inet.h>
 #endif
 
-#if DEBUG_TIME
-#include <stdio.h>
+// Use the C++17 locale independent number conversions when available
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#define HAVE_CHARCONV 1
+#if defined(__cpp_lib_to_chars)
+#define HAVE_FLOAT_CHARCONV 1
+#endif
+#endif
 #endif
 
-SQLNullValue * SQLValue::nullRep_ = 0;
+// Skip the leading white space and plus sign that iostreams would accept
+static const char *skipNumberPrefix(const char *p, const char *end)
+{
+    while (p < end && isspace((unsigned char)*p))
+	p++;
 
-SQLValue::SQLValue()
+    if (p + 1 < end && p[0] == '+' && p[1] != '-')
+	p++;
+
+    return p;
+}
+
+// Copy a string into the callers buffer truncating it to fit
+static size_t copyString(const char *s, size_t len, char *buf, size_t size)
 {
-    if (nullRep_ == 0)
-    {
-	nullRep_ = new SQLNullValue;
-	// Bump the reference count so it will not be destroyed.
-	nullRep_->refCount_++;
-    }
+    if (size == 0)
+	return 0;
+
+    if (len > size - 1)
+	len = size - 1;
+
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+
+    return len;
+}
 
-    setRep(nullRep_);
+#if SQL_COUNT_REFERENCES
+SQL_THREAD_LOCAL unsigned long SQLValue::numReferenceOperations;
+#endif
+
+SQLValue::SQLValue()
+: type_(SQLNullType), heap_(false), borrowed_(false), length_(0), owner_(0)
+{
 }
 
 SQLValue::SQLValue(const SQLValue &v)
+: type_(v.type_), heap_(false), borrowed_(v.borrowed_), length_(v.length_),
+  owner_(0), value_(v.value_)
 {
-    setRep(v.rep_);
+    if (v.heap_)
+        setRep(v.value_.rep);
+    if (v.owner_ != 0)
+        setOwner(v.owner_);
 }
 
 SQLValue::SQLValue(SQLValueRep *rep)
+: type_(SQLNullType), heap_(false), borrowed_(false), length_(0), owner_(0)
 {
-    setRep(rep);
+    if (rep != 0)
+        assign(rep);
 }
 
 SQLValue::~SQLValue()
@@ -53,33 +93,351 @@ SQLValue::~SQLValue()
 
 const SQLValue & SQLValue::operator=(const SQLValue &v)
 {
+    if (this == &v)
+        return *this;
+
+    clearRep();
+
+    type_ = v.type_;
+    borrowed_ = v.borrowed_;
+    length_ = v.length_;
+    value_ = v.value_;
+
+    if (v.heap_)
+        setRep(v.value_.rep);
+    if (v.owner_ != 0)
+        setOwner(v.owner_);
+
+    return *this;
+}
+
+#if __cplusplus >= 201103L
+SQLValue::SQLValue(SQLValue &&v) noexcept
+: type_(v.type_), heap_(v.heap_), borrowed_(v.borrowed_), length_(v.length_),
+  owner_(v.owner_), value_(v.value_)
+{
+    v.type_ = SQLNullType;
+    v.heap_ = false;
+    v.borrowed_ = false;
+    v.owner_ = 0;
+}
+
+const SQLValue & SQLValue::operator=(SQLValue &&v) noexcept
+{
+    if (this == &v)
+        return *this;
+
     clearRep();
 
-    setRep(v.rep_);
+    type_ = v.type_;
+    heap_ = v.heap_;
+    borrowed_ = v.borrowed_;
+    length_ = v.length_;
+    owner_ = v.owner_;
+    value_ = v.value_;
+
+    v.type_ = SQLNullType;
+    v.heap_ = false;
+    v.borrowed_ = false;
+    v.owner_ = 0;
 
     return *this;
 }
+#endif
+
+void SQLValue::swap(SQLValue &v)
+{
+    SQLValue t;
+
+    // Copy the raw fields so the rep changes hands without being counted
+    t.type_ = type_;
+    t.heap_ = heap_;
+    t.borrowed_ = borrowed_;
+    t.length_ = length_;
+    t.owner_ = owner_;
+    t.value_ = value_;
+
+    type_ = v.type_;
+    heap_ = v.heap_;
+    borrowed_ = v.borrowed_;
+    length_ = v.length_;
+    owner_ = v.owner_;
+    value_ = v.value_;
+
+    v.type_ = t.type_;
+    v.heap_ = t.heap_;
+    v.borrowed_ = t.borrowed_;
+    v.length_ = t.length_;
+    v.owner_ = t.owner_;
+    v.value_ = t.value_;
+
+    // t no longer owns anything
+    t.heap_ = false;
+    t.owner_ = 0;
+}
+
+// Take the value from the given rep. The built in types are copied inline
+// but the rep is still referenced as the caller may share it.
+void SQLValue::assign(SQLValueRep *rep)
+{
+    type_ = rep->typeId();
+
+    switch (type_)
+    {
+    case SQLNullType:
+	break;
+    case SQLBooleanType:
+	value_.boolean = ((SQLBooleanValue *)rep)->getValue();
+	break;
+    case SQLIntegerType:
+	value_.integer = ((SQLIntegerValue *)rep)->getValue();
+	break;
+    case SQLRealType:
+	value_.real = ((SQLRealValue *)rep)->getValue();
+	break;
+#if SQL_DATE_SUPPORT
+    case SQLDateTimeType:
+	value_.dateTime = ((SQLDateTimeValue *)rep)->getValue();
+	break;
+#endif
+#if SQL_IP_SUPPORT
+    case SQLIPAddressType:
+	value_.ipAddress = ((SQLIPAddressValue *)rep)->getValue();
+	break;
+#endif
+    case SQLStringType:
+    {
+	const std::string &s = ((SQLStringValue *)rep)->getValue();
+
+	if (s.length() <= MAX_SHORT_STRING)
+	{
+	    setString(s.data(), s.length());
+	    break;
+	}
+
+	// Long strings stay on the heap
+	setRep(rep);
+	return;
+    }
+    default:
+	// Exceptions and application types stay on the heap.
+	setRep(rep);
+	return;
+    }
+
+    setOwner(rep);
+}
+
+// Set the value to the given string. Short strings are stored inline.
+void SQLValue::setString(const char *s, size_t len)
+{
+    if (len <= MAX_SHORT_STRING)
+    {
+	clearRep();
+
+	type_ = SQLStringType;
+	length_ = len;
+	memcpy(value_.string, s, len);
+	value_.string[len] = '\0';
+    }
+    else
+    {
+	SQLValueRep *rep = new SQLStringValue(std::string(s, len));
+
+	clearRep();
+
+	type_ = SQLStringType;
+	setRep(rep);
+    }
+}
+
+SQLValue SQLValue::makeBoolean(bool b)
+{
+    SQLValue v;
+
+    v.type_ = SQLBooleanType;
+    v.value_.boolean = b;
+
+    return v;
+}
+
+SQLValue SQLValue::makeInteger(int i)
+{
+    SQLValue v;
+
+    v.type_ = SQLIntegerType;
+    v.value_.integer = i;
+
+    return v;
+}
+
+SQLValue SQLValue::makeReal(double d)
+{
+    SQLValue v;
+
+    v.type_ = SQLRealType;
+    v.value_.real = d;
+
+    return v;
+}
+
+SQLValue SQLValue::makeString(const std::string &s)
+{
+    SQLValue v;
+
+    v.setString(s.data(), s.length());
+
+    return v;
+}
+
+SQLValue SQLValue::makeBorrowedString(const char *s, size_t len)
+{
+    SQLValue v;
+
+    v.type_ = SQLStringType;
+    v.borrowed_ = true;
+    v.value_.borrowed.data = s;
+    v.value_.borrowed.length = len;
+
+    return v;
+}
+
+SQLValue SQLValue::makeBorrowedString(const std::string &s)
+{
+    return makeBorrowedString(s.data(), s.length());
+}
+
+#if SQL_DATE_SUPPORT
+SQLValue SQLValue::makeDateTime(time_t t)
+{
+    SQLValue v;
+
+    v.type_ = SQLDateTimeType;
+    v.value_.dateTime = t;
+
+    return v;
+}
+#endif
+
+#if SQL_IP_SUPPORT
+SQLValue SQLValue::makeIPAddress(const struct in_addr &a)
+{
+    SQLIPAddress ip;
+
+    ip.setIPv4(a);
+
+    return makeIPAddress(ip);
+}
+
+SQLValue SQLValue::makeIPAddress(const SQLIPAddress &a)
+{
+    SQLValue v;
+
+    v.type_ = SQLIPAddressType;
+    v.value_.ipAddress = a;
+
+    return v;
+}
+#endif
+
+// Return true for the types that numericConvert() can handle
+static inline bool isNumericType(SQLValueType type)
+{
+    return type == SQLBooleanType || type == SQLIntegerType ||
+	type == SQLRealType || type == SQLDateTimeType;
+}
 
 std::string SQLValue::asString() const
 {
     std::string str;
 
-    rep_->toString(str);
+    switch (type_)
+    {
+    case SQLNullType:
+	SQLNullValue().toString(str);
+	break;
+    case SQLBooleanType:
+	SQLBooleanValue(value_.boolean).toString(str);
+	break;
+    case SQLIntegerType:
+	SQLIntegerValue(value_.integer).toString(str);
+	break;
+    case SQLRealType:
+	SQLRealValue(value_.real).toString(str);
+	break;
+#if SQL_DATE_SUPPORT
+    case SQLDateTimeType:
+	SQLDateTimeValue(value_.dateTime).toString(str);
+	break;
+#endif
+#if SQL_IP_SUPPORT
+    case SQLIPAddressType:
+	SQLIPAddressValue(value_.ipAddress).toString(str);
+	break;
+#endif
+    case SQLStringType:
+    {
+	size_t len;
+	const char *s = stringData(len);
+
+	str.assign(s, len);
+	break;
+    }
+    default:
+	value_.rep->toString(str);
+	break;
+    }
 
     return str;
 }
 
+size_t SQLValue::toString(char *buf, size_t size) const
+{
+    switch (type_)
+    {
+    case SQLIntegerType:
+	return SQLIntegerValue::format(value_.integer, buf, size);
+    case SQLRealType:
+	return SQLRealValue::format(value_.real, buf, size);
+    case SQLStringType:
+    {
+	size_t len;
+	const char *s = stringData(len);
+
+	return copyString(s, len, buf, size);
+    }
+#if SQL_DATE_SUPPORT
+    case SQLDateTimeType:
+	return SQLDateTimeValue::format(value_.dateTime, buf, size);
+#endif
+#if SQL_IP_SUPPORT
+    case SQLIPAddressType:
+	return value_.ipAddress.format(buf, size);
+#endif
+    default:
+	break;
+    }
+
+    std::string str = asString();
+
+    return copyString(str.data(), str.length(), buf, size);
+}
+
 bool SQLValue::asBoolean() const
 {
-    SQLBooleanValue bool_rep;
+    if (type_ == SQLBooleanType)
+	return value_.boolean;
 
-    if (rep_->isSameType(&bool_rep))
+    if (isNumericType(type_))
     {
-        SQLBooleanValue *brep = (SQLBooleanValue *)rep_;
+	SQLValue v(*this);
 
-	return brep->getValue();
+	if (v.numericConvert(SQLBooleanType))
+	    return v.value_.boolean;
     }
 
+    SQLBooleanValue bool_rep;
+
     std::string str = asString();
 
     bool_rep.fromString(str);
@@ -89,15 +447,19 @@ bool SQLValue::asBoolean() const
 
 int SQLValue::asInteger() const
 {
-    SQLIntegerValue int_rep;
+    if (type_ == SQLIntegerType)
+	return value_.integer;
 
-    if (rep_->isSameType(&int_rep))
+    if (isNumericType(type_))
     {
-        SQLIntegerValue *irep = (SQLIntegerValue *)rep_;
+	SQLValue v(*this);
 
-	return irep->getValue();
+	if (v.numericConvert(SQLIntegerType))
+	    return v.value_.integer;
     }
 
+    SQLIntegerValue int_rep;
+
     std::string str = asString();
 
     int_rep.fromString(str);
@@ -107,15 +469,19 @@ int SQLValue::asInteger() const
 
 double SQLValue::asReal() const
 {
-    SQLRealValue real_rep;
+    if (type_ == SQLRealType)
+	return value_.real;
 
-    if (rep_->isSameType(&real_rep))
+    if (isNumericType(type_))
     {
-        SQLRealValue *rrep = (SQLRealValue *)rep_;
+	SQLValue v(*this);
 
-	return rrep->getValue();
+	if (v.numericConvert(SQLRealType))
+	    return v.value_.real;
     }
 
+    SQLRealValue real_rep;
+
     std::string str = asString();
 
     real_rep.fromString(str);
@@ -126,15 +492,19 @@ double SQLValue::asReal() const
 #if SQL_DATE_SUPPORT
 time_t SQLValue::asDateTime() const
 {
-    SQLDateTimeValue datetime_rep;
+    if (type_ == SQLDateTimeType)
+	return value_.dateTime;
 
-    if (rep_->isSameType(&datetime_rep))
+    if (isNumericType(type_))
     {
-        SQLDateTimeValue *rrep = (SQLDateTimeValue *)rep_;
+	SQLValue v(*this);
 
-	return rrep->getValue();
+	if (v.numericConvert(SQLDateTimeType))
+	    return v.value_.dateTime;
     }
 
+    SQLDateTimeValue datetime_rep;
+
     std::string str = asString();
 
     datetime_rep.fromString(str);
@@ -145,26 +515,211 @@ time_t SQLValue::asDateTime() const
 
 bool SQLValue::fromString(const std::string &str)
 {
-    return rep_->fromString(str);
+    if (type_ == SQLExceptionType || type_ == SQLOtherType)
+	return value_.rep->fromString(str);
+
+    return parseAs(type_, str);
 }
 
-bool SQLValue::isSameType(const SQLValue &v) const
+// Parse the string as the given built in type and store it in this. The
+// value is unchanged if the string cannot be converted.
+bool SQLValue::parseAs(SQLValueType type, const std::string &str)
 {
-    return rep_->isSameType(v.rep_);
+    switch (type)
+    {
+    case SQLNullType:
+	clearRep();
+	type_ = SQLNullType;
+	return true;
+    case SQLBooleanType:
+    {
+	SQLBooleanValue rep;
+	if (!rep.fromString(str))
+	    return false;
+
+	clearRep();
+	type_ = SQLBooleanType;
+	value_.boolean = rep.getValue();
+	return true;
+    }
+    case SQLIntegerType:
+    {
+	SQLIntegerValue rep;
+	if (!rep.fromString(str))
+	    return false;
+
+	clearRep();
+	type_ = SQLIntegerType;
+	value_.integer = rep.getValue();
+	return true;
+    }
+    case SQLRealType:
+    {
+	SQLRealValue rep;
+	if (!rep.fromString(str))
+	    return false;
+
+	clearRep();
+	type_ = SQLRealType;
+	value_.real = rep.getValue();
+	return true;
+    }
+    case SQLStringType:
+	setString(str.data(), str.length());
+	return true;
+#if SQL_DATE_SUPPORT
+    case SQLDateTimeType:
+    {
+	SQLDateTimeValue rep;
+	if (!rep.fromString(str))
+	    return false;
+
+	clearRep();
+	type_ = SQLDateTimeType;
+	value_.dateTime = rep.getValue();
+	return true;
+    }
+#endif
+#if SQL_IP_SUPPORT
+    case SQLIPAddressType:
+    {
+	SQLIPAddress a;
+	if (!a.parse(str.data(), str.length()))
+	    return false;
+
+	clearRep();
+	type_ = SQLIPAddressType;
+	value_.ipAddress = a;
+	return true;
+    }
+#endif
+    default:
+	return false;
+    }
 }
 
-// Return true if the object is of void type
-bool SQLValue::isNull() const 
+// Convert between the numeric types (Boolean, Integer, Real and DateTime)
+// directly rather than by formatting and parsing a string. Booleans are 0
+// or 1, DateTimes are seconds since the epoch and Reals are truncated
+// towards zero. Returns false if the value is out of range of the target.
+bool SQLValue::numericConvert(SQLValueType type)
 {
-    return nullRep_ == 0 || rep_->isSameType(nullRep_);
+    long long l = 0;
+    double d = 0.0;
+    bool is_real = false;
+
+    switch (type_)
+    {
+    case SQLBooleanType:
+	l = value_.boolean;
+	break;
+    case SQLIntegerType:
+	l = value_.integer;
+	break;
+    case SQLRealType:
+	d = value_.real;
+	is_real = true;
+	break;
+#if SQL_DATE_SUPPORT
+    case SQLDateTimeType:
+	l = value_.dateTime;
+	break;
+#endif
+    default:
+	return false;
+    }
+
+    switch (type)
+    {
+    case SQLBooleanType:
+	value_.boolean = is_real ? (d != 0.0) : (l != 0);
+	break;
+    case SQLIntegerType:
+	if (is_real)
+	{
+	    if (!(d > INT_MIN - 1.0 && d < INT_MAX + 1.0))
+		return false;
+	    value_.integer = int(d);
+	}
+	else
+	{
+	    if (l < INT_MIN || l > INT_MAX)
+		return false;
+	    value_.integer = int(l);
+	}
+	break;
+    case SQLRealType:
+	value_.real = is_real ? d : double(l);
+	break;
+#if SQL_DATE_SUPPORT
+    case SQLDateTimeType:
+	if (is_real)
+	{
+	    if (!(d > -9.2e18 && d < 9.2e18))
+		return false;
+	    value_.dateTime = time_t(d);
+	}
+	else
+	    value_.dateTime = time_t(l);
+	break;
+#endif
+    default:
+	return false;
+    }
+
+    type_ = type;
+
+    return true;
 }
 
-// Return true if the object is of void type
-bool SQLValue::isException() const
+const char * SQLValue::stringData(size_t &len) const
 {
-    SQLExceptionValue e("");
+    if (type_ != SQLStringType)
+    {
+	len = 0;
+	return 0;
+    }
+
+    if (borrowed_)
+    {
+	len = value_.borrowed.length;
+	return value_.borrowed.data;
+    }
+    else if (heap_)
+    {
+	const std::string &s = ((SQLStringValue *)value_.rep)->getValue();
+
+	len = s.length();
+	return s.data();
+    }
+    else
+    {
+	len = length_;
+	return value_.string;
+    }
+}
 
-    return rep_->isSameType(&e);
+const char * SQLValue::typeAsString() const
+{
+    switch (type_)
+    {
+    case SQLNullType:
+	return "Null";
+    case SQLBooleanType:
+	return "Boolean";
+    case SQLIntegerType:
+	return "Integer";
+    case SQLRealType:
+	return "Real";
+    case SQLStringType:
+	return "String";
+    case SQLDateTimeType:
+	return "DateTime";
+    case SQLIPAddressType:
+	return "IPAddress";
+    default:
+	return value_.rep->typeAsString();
+    }
 }
 
 // Change the type of this to match the type of the given value.
@@ -173,19 +728,22 @@ bool SQLValue::typeConvert(const SQLValue &v)
     if (isSameType(v))
         return true;
 
-    SQLValueRep *old_rep = rep_;
+    // Conversions between the numeric types do not need a string
+    if (isNumericType(type_) && isNumericType(v.type_))
+	return numericConvert(v.type_);
+
+    std::string val = asString();
+
+    if (!v.heap_ || v.type_ == SQLStringType)
+	return parseAs(v.type_, val);
 
     // Construct a new object of the correct type
-    SQLValueRep *rep = v.rep_->clone();
+    SQLValueRep *rep = v.value_.rep->clone();
 
     if (rep == 0)
         return false;
 
     // Now copy the value of the old rep into the new one.
-    std::string val;
-
-    old_rep->toString(val);
-
     if (!rep->fromString(val))
     {
 	delete rep;
@@ -193,40 +751,321 @@ bool SQLValue::typeConvert(const SQLValue &v)
     }
 
     clearRep();
+    type_ = v.type_;
     setRep(rep);
 
     return true;
 }
 
-int SQLValue::compare(SQLValue v)
+bool SQLValue::convertToType(SQLValueType type)
+{
+    if (type == SQLNullType || type == SQLExceptionType ||
+	type == SQLOtherType)
+	return false;
+
+    if (type_ == type)
+	return true;
+
+    if (isNumericType(type_) && isNumericType(type))
+	return numericConvert(type);
+
+    return parseAs(type, asString());
+}
+
+int SQLValue::compare(const SQLValue &v) const
+{
+    // Null values and exceptions always compare as unequal
+    if (type_ == SQLNullType || type_ == SQLExceptionType)
+	return 1;
+
+    assert(isSameType(v));
+
+    switch (type_)
+    {
+    case SQLBooleanType:
+	return value_.boolean - v.value_.boolean;
+    case SQLIntegerType:
+	if (value_.integer < v.value_.integer)
+	    return -1;
+	else if (value_.integer > v.value_.integer)
+	    return 1;
+	else
+	    return 0;
+    case SQLRealType:
+	if (value_.real < v.value_.real)
+	    return -1;
+	else if (value_.real > v.value_.real)
+	    return 1;
+	else
+	    return 0;
+    case SQLStringType:
+    {
+	size_t l1, l2;
+	const char *s1 = stringData(l1);
+	const char *s2 = v.stringData(l2);
+
+	return SQLStringValue::compareStrings(s1, l1, s2, l2);
+    }
+#if SQL_DATE_SUPPORT
+    case SQLDateTimeType:
+	if (value_.dateTime < v.value_.dateTime)
+	    return -1;
+	else if (value_.dateTime > v.value_.dateTime)
+	    return 1;
+	else
+	    return 0;
+#endif
+#if SQL_IP_SUPPORT
+    case SQLIPAddressType:
+	return value_.ipAddress.compare(v.value_.ipAddress);
+#endif
+    default:
+	return value_.rep->compare(v.value_.rep);
+    }
+}
+
+// Mix the bits of an integer so nearby values spread over a hash table
+static inline size_t hashInteger(unsigned long long k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+
+    return (size_t)k;
+}
+
+// FNV-1a hash of the characters folded to lower case so it does not
+// depend on SQLStringValue::setCaseInsensitive()
+static size_t hashString(const char *s, size_t len)
+{
+    unsigned long long h = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < len; i++)
+    {
+	h ^= (unsigned char)tolower((unsigned char)s[i]);
+	h *= 1099511628211ULL;
+    }
+
+    return (size_t)h;
+}
+
+size_t SQLValue::hash() const
+{
+    switch (type_)
+    {
+    case SQLBooleanType:
+	return hashInteger(value_.boolean);
+    case SQLIntegerType:
+	return hashInteger(value_.integer);
+    case SQLRealType:
+    {
+	// 0.0 and -0.0 compare as equal
+	double d = value_.real == 0 ? 0 : value_.real;
+	unsigned long long bits;
+	memcpy(&bits, &d, sizeof(bits));
+
+	return hashInteger(bits);
+    }
+    case SQLStringType:
+    {
+	size_t len;
+	const char *s = stringData(len);
+
+	return hashString(s, len);
+    }
+#if SQL_DATE_SUPPORT
+    case SQLDateTimeType:
+	return hashInteger(value_.dateTime);
+#endif
+#if SQL_IP_SUPPORT
+    case SQLIPAddressType:
+	return hashInteger(value_.ipAddress.high ^
+			   hashInteger(value_.ipAddress.low) ^
+			   value_.ipAddress.prefix);
+#endif
+    default:
+	// Application types do not define a hash consistent with compare
+	return 0;
+    }
+}
+
+bool SQLValue::isWithin(const SQLValue &v) const
 {
-    return rep_->compare(v.rep_);
+#if SQL_IP_SUPPORT
+    if (type_ == SQLIPAddressType && v.type_ == SQLIPAddressType)
+	return value_.ipAddress.isWithin(v.value_.ipAddress);
+#endif
+
+    return false;
 }
 
-bool SQLValue::operator==(SQLValue v)
+bool SQLValue::operator==(const SQLValue &v) const
 {
     return compare(v) == 0;
 }
 
-bool SQLValue::operator!=(SQLValue v)
+bool SQLValue::operator!=(const SQLValue &v) const
 {
     return compare(v) != 0;
 }
 
+#if SQL_COUNT_REFERENCES
+unsigned long SQLValue::referenceOperations()
+{
+    return numReferenceOperations;
+}
+#endif
+
+SQLValue SQLValue::illegalOperation(char op) const
+{
+    std::string ops(&op, 1);
+
+    return SQLValue(new SQLExceptionValue(std::string("Illegal ") +
+					  typeAsString() +
+					  "operation '" + ops + "'"));
+}
+
 // Perform the given arithmetic operation and return the result
-SQLValue SQLValue::binaryOperation(SQLValue v2, char op)
+SQLValue SQLValue::binaryOperation(const SQLValue &v2, char op)
 {
-    return rep_->binaryOperation(v2.rep_, op);
+    switch (type_)
+    {
+    case SQLNullType:
+    case SQLExceptionType:
+	// Any operation applied to a null or exception will yield itself
+	return *this;
+    case SQLBooleanType:
+	switch (op)
+	{
+	case '+':
+	    return makeBoolean(value_.boolean | v2.value_.boolean);
+	case '*':
+	    return makeBoolean(value_.boolean & v2.value_.boolean);
+	default:
+	    return illegalOperation(op);
+	}
+    case SQLIntegerType:
+	switch (op)
+	{
+	case '+':
+	    return makeInteger(value_.integer + v2.value_.integer);
+	case '-':
+	    return makeInteger(value_.integer - v2.value_.integer);
+	case '*':
+	    return makeInteger(value_.integer * v2.value_.integer);
+	case '/':
+	    if (v2.value_.integer == 0)
+		return SQLValue(new SQLExceptionValue("Division by zero"));
+	    // The quotient does not fit and the division would trap
+	    if (v2.value_.integer == -1 && value_.integer == INT_MIN)
+		return SQLValue(new SQLExceptionValue(
+				    "Integer overflow in division"));
+	    return makeInteger(value_.integer / v2.value_.integer);
+	default:
+	    return illegalOperation(op);
+	}
+    case SQLRealType:
+	switch (op)
+	{
+	case '+':
+	    return makeReal(value_.real + v2.value_.real);
+	case '-':
+	    return makeReal(value_.real - v2.value_.real);
+	case '*':
+	    return makeReal(value_.real * v2.value_.real);
+	case '/':
+	    return makeReal(value_.real / v2.value_.real);
+	default:
+	    return illegalOperation(op);
+	}
+    case SQLStringType:
+	if (op == '+')
+	{
+	    size_t l1, l2;
+	    const char *s1 = stringData(l1);
+	    const char *s2 = v2.stringData(l2);
+
+	    std::string s;
+	    s.reserve(l1 + l2);
+	    s.append(s1, l1);
+	    s.append(s2, l2);
+
+	    return makeString(s);
+	}
+	else
+	    return illegalOperation(op);
+#if SQL_DATE_SUPPORT
+    case SQLDateTimeType:
+	switch (op)
+	{
+	case '+':
+	    return makeDateTime(value_.dateTime + v2.value_.dateTime);
+	case '-':
+	    return makeDateTime(value_.dateTime - v2.value_.dateTime);
+	case '*':
+	    return makeDateTime(value_.dateTime * v2.value_.dateTime);
+	case '/':
+	    if (v2.value_.dateTime == 0)
+		return SQLValue(new SQLExceptionValue("Division by zero"));
+	    return makeDateTime(value_.dateTime / v2.value_.dateTime);
+	default:
+	    return illegalOperation(op);
+	}
+#endif
+    case SQLOtherType:
+	if (v2.heap_)
+	    return value_.rep->binaryOperation(v2.value_.rep, op);
+	else
+	    return illegalOperation(op);
+    default:
+	return illegalOperation(op);
+    }
 }
 
 SQLValue SQLValue::unaryOperation(char op)
 {
-    return rep_->unaryOperation(op);
+    switch (type_)
+    {
+    case SQLNullType:
+    case SQLExceptionType:
+	// Any operation applied to a null or exception will yield itself
+	return *this;
+    case SQLBooleanType:
+	if (op == '-')
+	    return makeBoolean(!value_.boolean);
+	else
+	    return illegalOperation(op);
+    case SQLIntegerType:
+	if (op == '-')
+	    return makeInteger(-value_.integer);
+	else
+	    return illegalOperation(op);
+    case SQLRealType:
+	if (op == '-')
+	    return makeReal(-value_.real);
+	else
+	    return illegalOperation(op);
+    case SQLOtherType:
+	return value_.rep->unaryOperation(op);
+    default:
+	return illegalOperation(op);
+    }
 }
 
 // SQLValueRep definition.
 SQLValueRep::SQLValueRep()
-: refCount_(0)
+: refCount_(0), typeId_(SQLOtherType)
+{
+}
+
+SQLValueRep::SQLValueRep(SQLValueType type_id)
+: refCount_(0), typeId_(type_id)
+{
+}
+
+// A copy is not yet referenced by any value
+SQLValueRep::SQLValueRep(const SQLValueRep &rep)
+: refCount_(0), typeId_(rep.typeId_)
 {
 }
 
@@ -238,8 +1077,12 @@ bool SQLValueRep::isSameType(SQLValueRep *rep) const
 {
     if (this == rep)
 	return true;
+    else if (typeId_ != rep->typeId_)
+	return false;
+    else if (typeId_ != SQLOtherType)
+	return true;
     else
-	return typeAsString() == rep->typeAsString();
+	return strcmp(typeAsString(), rep->typeAsString()) == 0;
 }
 
 SQLValueRep * SQLValueRep::illegalOperation(char op)
@@ -252,6 +1095,11 @@ SQLValueRep * SQLValueRep::illegalOperation(char op)
 
 
 // Derived variable classes
+SQLNullValue::SQLNullValue()
+: SQLValueRep(SQLNullType)
+{
+}
+
 bool SQLNullValue::fromString(const std::string &)
 {
     return true;
@@ -296,12 +1144,12 @@ SQLValueRep * SQLNullValue::unaryOperation(char op)
 
 // Definition of the boolean type
 SQLBooleanValue::SQLBooleanValue()
-: value(false)
+: SQLValueRep(SQLBooleanType), value(false)
 {
 }
 
 SQLBooleanValue::SQLBooleanValue(bool value_)
-: value(value_)
+: SQLValueRep(SQLBooleanType), value(value_)
 {
 }
 
@@ -397,30 +1245,62 @@ SQLValueRep * SQLBooleanValue::unaryOperation(char op)
 
 // Definition of the integer type
 SQLIntegerValue::SQLIntegerValue()
-: value(0)
+: SQLValueRep(SQLIntegerType), value(0)
 {
 }
 
 SQLIntegerValue::SQLIntegerValue(int value_)
-: value(value_)
+: SQLValueRep(SQLIntegerType), value(value_)
 {
 }
 
 bool SQLIntegerValue::fromString(const std::string &s)
 {
-    std::stringstream ss(s);
+    return parse(s.data(), s.length(), value);
+}
 
-    long v;
+void SQLIntegerValue::toString(std::string &s)
+{
+    char buf[MAX_NUMBER_STRING];
 
-    if (!(ss >> v))
+    s.assign(buf, format(value, buf, sizeof(buf)));
+}
+
+bool SQLIntegerValue::parse(const char *s, size_t len, int &value)
+{
+    const char *end = s + len;
+    const char *p = skipNumberPrefix(s, end);
+
+    int v;
+#if HAVE_CHARCONV
+    std::from_chars_result r = std::from_chars(p, end, v);
+    if (r.ec == std::errc::result_out_of_range)
+	return false;
+    bool ok = (r.ec == std::errc());
+#else
+    std::string str(p, end);
+    char *e;
+    errno = 0;
+    long l = strtol(str.c_str(), &e, 10);
+    if (errno == ERANGE || l < INT_MIN || l > INT_MAX)
+	return false;
+    bool ok = (e != str.c_str());
+    v = int(l);
+#endif
+
+    if (!ok)
     {
 	// Try to convert using floating point
 	double d;
 
-	if (!(ss >> d))
+	if (!SQLRealValue::parse(p, end - p, d))
+	    return false;
+
+	d += 0.5;
+	if (!(d > INT_MIN - 1.0 && d < INT_MAX + 1.0))
 	    return false;
 
-	v = long(d + 0.5);
+	v = int(d);
     }
 
     value = v;
@@ -428,16 +1308,16 @@ bool SQLIntegerValue::fromString(const std::string &s)
     return true;
 }
 
-void SQLIntegerValue::toString(std::string &s)
+size_t SQLIntegerValue::format(int value, char *buf, size_t size)
 {
-#if USE_BOOST
-    s = boost::lexical_cast<std::string>(value);
+    char num[MAX_NUMBER_STRING];
+#if HAVE_CHARCONV
+    size_t len = std::to_chars(num, num + sizeof(num), value).ptr - num;
 #else
-    std::stringstream ss;
-    ss << value;
-
-    s = ss.str();
+    size_t len = snprintf(num, sizeof(num), "%d", value);
 #endif
+
+    return copyString(num, len, buf, size);
 }
 
 const char * SQLIntegerValue::typeAsString() const
@@ -512,40 +1392,71 @@ SQLValueRep * SQLIntegerValue::unaryOperation(char op)
 
 // Definition of the Real type
 SQLRealValue::SQLRealValue()
-: value(0.0)
+: SQLValueRep(SQLRealType), value(0.0)
 {
 }
 
 SQLRealValue::SQLRealValue(double value)
-: value(value)
+: SQLValueRep(SQLRealType), value(value)
 {
 }
 
 bool SQLRealValue::fromString(const std::string &s)
 {
+    return parse(s.data(), s.length(), value);
+}
+
+void SQLRealValue::toString(std::string &s)
+{
+    char buf[MAX_NUMBER_STRING];
+
+    s.assign(buf, format(value, buf, sizeof(buf)));
+}
+
+bool SQLRealValue::parse(const char *s, size_t len, double &value)
+{
+    const char *end = s + len;
+    const char *p = skipNumberPrefix(s, end);
+
     double v;
-    std::stringstream ss(s);
+#if HAVE_FLOAT_CHARCONV
+    if (std::from_chars(p, end, v).ec != std::errc())
+	return false;
+#else
+    // strtod depends on the C locale so use a classic locale stream
+    std::istringstream ss(std::string(p, end));
+    ss.imbue(std::locale::classic());
 
     if (!(ss >> v))
 	return false;
+#endif
 
     value = v;
 
     return true;
 }
 
-void SQLRealValue::toString(std::string &s)
+size_t SQLRealValue::format(double value, char *buf, size_t size)
 {
-    // Standard C++11 could just do the following
-    // s = std::to_string(value);
-#if USE_BOOST
-    s = boost::lexical_cast<std::string>(value);
+    // Match the default iostream formatting of six significant digits
+    char num[MAX_NUMBER_STRING];
+#if HAVE_FLOAT_CHARCONV
+    size_t len = std::to_chars(num, num + sizeof(num), value,
+			       std::chars_format::general, 6).ptr - num;
 #else
-    std::stringstream ss;
-    ss << value;
+    size_t len = snprintf(num, sizeof(num), "%g", value);
 
-    s = ss.str();
+    // Undo any locale specific decimal point
+    char point = localeconv()->decimal_point[0];
+    if (point != '.')
+    {
+	char *p = strchr(num, point);
+	if (p != 0)
+	    *p = '.';
+    }
 #endif
+
+    return copyString(num, len, buf, size);
 }
 
 const char * SQLRealValue::typeAsString() const
@@ -625,11 +1536,12 @@ SQLValueRep * SQLRealValue::unaryOperation(char op)
 
 // Definition of the string type
 SQLStringValue::SQLStringValue()
+: SQLValueRep(SQLStringType)
 {
 }
 
 SQLStringValue::SQLStringValue(const std::string &value_)
-: value(value_)
+: SQLValueRep(SQLStringType), value(value_)
 {
 }
 
@@ -673,16 +1585,35 @@ int SQLStringValue::compare(SQLValueRep *rep) const
 
     SQLStringValue *r = (SQLStringValue *)rep;
 
+    return compareStrings(value.data(), value.length(),
+			  r->value.data(), r->value.length());
+}
+
+int SQLStringValue::compareStrings(const char *s1, size_t l1,
+				   const char *s2, size_t l2)
+{
+    size_t len = l1 < l2 ? l1 : l2;
+    int res;
+
     if (caseInsensitive)
     {
 #ifdef __WIN32__
-	return stricmp(value.c_str(), r->value.c_str());
+	res = strnicmp(s1, s2, len);
 #else
-	return strcasecmp(value.c_str(), r->value.c_str());
+	res = strncasecmp(s1, s2, len);
 #endif
     }
     else
-	return strcmp(value.c_str(), r->value.c_str());
+	res = memcmp(s1, s2, len);
+
+    if (res != 0)
+	return res;
+    else if (l1 < l2)
+	return -1;
+    else if (l1 > l2)
+	return 1;
+    else
+	return 0;
 }
 
 const std::string & SQLStringValue::getValue() const
@@ -713,28 +1644,314 @@ SQLValueRep * SQLStringValue::unaryOperation(char op)
 }
 
 #if SQL_DATE_SUPPORT
-std::string SQLDateTimeValue::format = "%Y-%m-%d %H:%M:%S";
+// Rewrite a strptime() format for SQLDateTimeValue::parseFast(). The result
+// only contains literal characters and the conversions %Y, %m, %d, %e, %H,
+// %M, %S and %%. An empty string is returned if the format uses anything
+// else, in which case strptime() is used. padded is set if the format has
+// strftime() padding modifiers.
+static std::string compileDateFormat(const std::string &format, bool &padded)
+{
+    std::string out;
+
+    padded = false;
+
+    for (const char *f = format.c_str(); *f != '\0'; f++)
+    {
+	if (*f != '%')
+	{
+	    out += *f;
+	    continue;
+	}
+
+	f++;
+
+	// strptime() ignores the strftime() padding modifiers
+	while (*f == '-' || *f == '_' || *f == '0' || *f == '^' || *f == '#')
+	{
+	    padded = true;
+	    f++;
+	}
+
+	switch (*f)
+	{
+	case 'Y':
+	case 'm':
+	case 'd':
+	case 'e':
+	case 'H':
+	case 'M':
+	case 'S':
+	case '%':
+	    out += '%';
+	    out += *f;
+	    break;
+	case 'T':
+	    out += "%H:%M:%S";
+	    break;
+	case 'R':
+	    out += "%H:%M";
+	    break;
+	case 'F':
+	    out += "%Y-%m-%d";
+	    break;
+	default:
+	    return "";
+	}
+    }
+
+    return out;
+}
+
+// Read a number the way strptime() does. Leading white space is skipped
+// and at most width digits are used, stopping early if another digit would
+// take the value past max.
+static const char *parseDateNumber(const char *p, int min, int max, int width,
+				   int &val)
+{
+    while (isspace((unsigned char)*p))
+	p++;
+
+    if (*p < '0' || *p > '9')
+	return 0;
+
+    val = 0;
+    do
+    {
+	val = val * 10 + (*p++ - '0');
+    } while (--width > 0 && val * 10 <= max && *p >= '0' && *p <= '9');
+
+    if (val < min || val > max)
+	return 0;
+
+    return p;
+}
+
+// Number of days from 1970-01-01 to the given date in the proleptic
+// Gregorian calendar. Out of range days roll over into the neighbouring
+// months as they do for mktime().
+static long long daysFromCivil(long long y, int m, int d)
+{
+    y -= m <= 2;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    long long yoe = y - era * 400;
+    long long doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+namespace
+{
+    // Offset of local time from UTC for a day as mktime() sees it
+    struct DayOffset
+    {
+	long long day;
+	long long offset;
+	unsigned generation;
+    };
+}
+
+// The offsets are cached per thread so converting a local time is
+// arithmetic rather than a call to mktime() which locks the time zone.
+enum { DAY_OFFSET_CACHE_SIZE = 64 };
+
+static SQL_THREAD_LOCAL DayOffset dayOffsets[DAY_OFFSET_CACHE_SIZE];
+static unsigned timeZoneGeneration = 1;
+
+static bool localDayOffset(long long day, long long &offset)
+{
+    DayOffset &d = dayOffsets[(unsigned long long)day % DAY_OFFSET_CACHE_SIZE];
+
+    if (d.generation != timeZoneGeneration || d.day != day)
+    {
+	// Ask for midnight as strptime() would leave it, with tm_isdst 0
+	struct tm tmbuf;
+	memset(&tmbuf, 0, sizeof(tmbuf));
+	tmbuf.tm_year = 70;
+	tmbuf.tm_mday = 1 + (int)day;
+
+	time_t t = mktime(&tmbuf);
+	if (t == -1)
+	    return false;
+
+	d.day = day;
+	d.offset = day * 86400 - (long long)t;
+	d.generation = timeZoneGeneration;
+    }
+
+    offset = d.offset;
+
+    return true;
+}
+
+namespace
+{
+    // The local date of the day last formatted and the last value
+    struct DateFormatCache
+    {
+	unsigned generation;
+	bool dayValid;
+	time_t dayStart;
+	struct tm day;
+	bool lastValid;
+	time_t last;
+	size_t lastLength;
+	char lastString[64];
+    };
+}
+
+static SQL_THREAD_LOCAL DateFormatCache dateFormatCache;
+static unsigned formatGeneration = 1;
+
+// Find the broken down local time for t. Days where the offset from UTC
+// does not change are cached so only the time of day has to be worked out.
+static bool localTime(DateFormatCache &c, time_t t, struct tm &tmbuf)
+{
+    if (c.dayValid && t >= c.dayStart && t - c.dayStart < 86400)
+    {
+	int secs = (int)(t - c.dayStart);
+
+	tmbuf = c.day;
+	tmbuf.tm_hour = secs / 3600;
+	tmbuf.tm_min = secs / 60 % 60;
+	tmbuf.tm_sec = secs % 60;
+
+	return true;
+    }
+
+    if (localtime_r(&t, &tmbuf) == 0)
+	return false;
+
+    // Only cache the day if it starts at midnight and ends 24 hours later
+    time_t start = t - (tmbuf.tm_hour * 3600 + tmbuf.tm_min * 60 + tmbuf.tm_sec);
+    time_t end = start + 86399;
+    struct tm s, e;
+    c.dayValid = localtime_r(&start, &s) != 0 && localtime_r(&end, &e) != 0 &&
+	s.tm_mday == tmbuf.tm_mday && e.tm_mday == tmbuf.tm_mday &&
+	s.tm_hour == 0 && s.tm_min == 0 && s.tm_sec == 0 &&
+	e.tm_hour == 23 && e.tm_min == 59 && e.tm_sec == 59;
+
+    if (c.dayValid)
+    {
+	c.dayStart = start;
+	c.day = s;
+    }
+
+    return true;
+}
+
+// Write a number zero or space padded to width digits
+static char *formatDateNumber(char *p, int val, int width, char pad)
+{
+    for (int i = width - 1; i >= 0; i--)
+    {
+	p[i] = (i == width - 1 || val != 0) ? '0' + val % 10 : pad;
+	val /= 10;
+    }
+
+    return p + width;
+}
+
+std::string SQLDateTimeValue::formatString = "%Y-%m-%d %H:%M:%S";
+bool SQLDateTimeValue::fastOutput = true;
+std::string SQLDateTimeValue::fastFormat = compileDateFormat(formatString,
+							     fastOutput);
 
 SQLDateTimeValue::SQLDateTimeValue()
- : value(0)
+ : SQLValueRep(SQLDateTimeType), value(0)
 {
 }
 
 SQLDateTimeValue::SQLDateTimeValue(time_t value_)
- : value(value_)
+ : SQLValueRep(SQLDateTimeType), value(value_)
+{
+}
+
+// Parse s with the compiled format accepting the same input as strptime()
+// followed by mktime() would.
+bool SQLDateTimeValue::parseFast(const char *s, time_t &t)
 {
+    // Fields not in the format keep the values of a zeroed struct tm
+    int year = 1900;
+    int month = 1;
+    int mday = 0;
+    int hour = 0;
+    int min = 0;
+    int sec = 0;
+
+    const char *p = s;
+    for (const char *f = fastFormat.c_str(); *f != '\0'; f++)
+    {
+	if (isspace((unsigned char)*f))
+	{
+	    while (isspace((unsigned char)*p))
+		p++;
+	    continue;
+	}
+
+	if (*f != '%')
+	{
+	    if (*p++ != *f)
+		return false;
+	    continue;
+	}
+
+	switch (*++f)
+	{
+	case 'Y':
+	    p = parseDateNumber(p, 0, 9999, 4, year);
+	    break;
+	case 'm':
+	    p = parseDateNumber(p, 1, 12, 2, month);
+	    break;
+	case 'd':
+	case 'e':
+	    p = parseDateNumber(p, 1, 31, 2, mday);
+	    break;
+	case 'H':
+	    p = parseDateNumber(p, 0, 23, 2, hour);
+	    break;
+	case 'M':
+	    p = parseDateNumber(p, 0, 59, 2, min);
+	    break;
+	case 'S':
+	    p = parseDateNumber(p, 0, 61, 2, sec);
+	    break;
+	default:
+	    if (*p++ != '%')
+		return false;
+	    break;
+	}
+
+	if (p == 0)
+	    return false;
+    }
+
+    long long day = daysFromCivil(year, month, mday);
+    long long offset;
+    if (!localDayOffset(day, offset))
+	return false;
+
+    t = (time_t)(day * 86400 + hour * 3600 + min * 60 + sec - offset);
+
+    return true;
 }
 
 bool SQLDateTimeValue::fromString(const std::string &s)
 {
+    // The common numeric formats are parsed directly. Anything the fast
+    // parser rejects is given to strptime() in case it is more lenient.
+    if (!fastFormat.empty() && parseFast(s.c_str(), value))
+	return (value != -1);
+
     struct tm tmbuf;
     memset(&tmbuf, 0, sizeof(tmbuf));
-    char *p = strptime(s.c_str(), format.c_str(), &tmbuf);
+    char *p = strptime(s.c_str(), formatString.c_str(), &tmbuf);
     if (p == 0)
     {
 #if DEBUG_TIME
         printf("strptime failed for '%s' with format '%s'\n",
-	       s.c_str(), format.c_str());
+	       s.c_str(), formatString.c_str());
 #endif
         return false;
     }
@@ -750,14 +1967,10 @@ bool SQLDateTimeValue::fromString(const std::string &s)
 
 void SQLDateTimeValue::toString(std::string &s)
 {
-    struct tm tmbuf;
-    if (localtime_r(&value, &tmbuf) == 0)
-        s = "";
-
     char buf[2048];
-    strftime(buf, sizeof(buf), format.c_str(), &tmbuf);
+    size_t len = format(value, buf, sizeof(buf));
 
-    s = buf;
+    s.assign(buf, len);
 }
 
 const char * SQLDateTimeValue::typeAsString() const
@@ -788,9 +2001,124 @@ time_t SQLDateTimeValue::getValue() const
     return value;
 }
 
+size_t SQLDateTimeValue::format(time_t value, char *buf, size_t size)
+{
+    if (size == 0)
+	return 0;
+
+    DateFormatCache &c = dateFormatCache;
+
+    if (c.generation != formatGeneration)
+    {
+	c.generation = formatGeneration;
+	c.dayValid = false;
+	c.lastValid = false;
+    }
+
+    // The same value is often formatted several times in a row
+    if (c.lastValid && c.last == value && c.lastLength < size)
+    {
+	memcpy(buf, c.lastString, c.lastLength + 1);
+	return c.lastLength;
+    }
+
+    struct tm tmbuf;
+    if (!localTime(c, value, tmbuf))
+    {
+	buf[0] = '\0';
+	return 0;
+    }
+
+    char out[sizeof(c.lastString)];
+    size_t len = 0;
+
+    // Numeric formats are written directly. Years outside four digits
+    // and formats that could overflow the buffer are left to strftime().
+    int year = tmbuf.tm_year + 1900;
+    if (fastOutput && year >= 1000 && year <= 9999 &&
+	fastFormat.length() * 2 < sizeof(out))
+    {
+	char *p = out;
+
+	for (const char *f = fastFormat.c_str(); *f != '\0'; f++)
+	{
+	    if (*f != '%')
+	    {
+		*p++ = *f;
+		continue;
+	    }
+
+	    switch (*++f)
+	    {
+	    case 'Y':
+		p = formatDateNumber(p, year, 4, '0');
+		break;
+	    case 'm':
+		p = formatDateNumber(p, tmbuf.tm_mon + 1, 2, '0');
+		break;
+	    case 'd':
+		p = formatDateNumber(p, tmbuf.tm_mday, 2, '0');
+		break;
+	    case 'e':
+		p = formatDateNumber(p, tmbuf.tm_mday, 2, ' ');
+		break;
+	    case 'H':
+		p = formatDateNumber(p, tmbuf.tm_hour, 2, '0');
+		break;
+	    case 'M':
+		p = formatDateNumber(p, tmbuf.tm_min, 2, '0');
+		break;
+	    case 'S':
+		p = formatDateNumber(p, tmbuf.tm_sec, 2, '0');
+		break;
+	    default:
+		*p++ = '%';
+		break;
+	    }
+	}
+
+	*p = '\0';
+	len = p - out;
+    }
+    else
+    {
+	len = strftime(out, sizeof(out), formatString.c_str(), &tmbuf);
+
+	// Long output is not memoised
+	if (len == 0)
+	{
+	    char big[2048];
+	    len = strftime(big, sizeof(big), formatString.c_str(), &tmbuf);
+	    big[len] = '\0';
+
+	    c.lastValid = false;
+	    return copyString(big, len, buf, size);
+	}
+    }
+
+    c.lastValid = true;
+    c.last = value;
+    c.lastLength = len;
+    memcpy(c.lastString, out, len + 1);
+
+    return copyString(out, len, buf, size);
+}
+
 void SQLDateTimeValue::setFormat(const std::string &format_)
 {
-    format = format_;
+    bool padded;
+
+    formatString = format_;
+    fastFormat = compileDateFormat(formatString, padded);
+    fastOutput = !fastFormat.empty() && !padded;
+    formatGeneration++;
+}
+
+void SQLDateTimeValue::resetTimeZone()
+{
+    tzset();
+    timeZoneGeneration++;
+    formatGeneration++;
 }
 
 // Perform the given arithmetic operation and return the result
@@ -827,30 +2155,160 @@ SQLValueRep * SQLDateTimeValue::unaryOperation(char op)
 #endif
 
 #if SQL_IP_SUPPORT
+void SQLIPAddress::setIPv4(const struct in_addr &a, int bits)
+{
+    high = 0;
+    low = 0xffff00000000ULL | ntohl(a.s_addr);
+    prefix = 96 + bits;
+    v4 = true;
+}
 
-#include <arpa/inet.h>
+void SQLIPAddress::setIPv6(const struct in6_addr &a, int bits)
+{
+    const unsigned char *b = a.s6_addr;
+
+    high = 0;
+    low = 0;
+    for (int i = 0; i < 8; i++)
+    {
+	high = (high << 8) | b[i];
+	low = (low << 8) | b[i + 8];
+    }
+    prefix = bits;
+    v4 = false;
+}
+
+bool SQLIPAddress::parse(const char *s, size_t len)
+{
+    char buf[MAX_IP_ADDRESS_STRING];
+    if (len >= sizeof(buf))
+	return false;
+
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+
+    // Split off the prefix length
+    int bits = -1;
+    char *slash = strchr(buf, '/');
+    if (slash != 0)
+    {
+	*slash = '\0';
+
+	const char *p = slash + 1;
+	if (*p == '\0')
+	    return false;
+
+	for (bits = 0; *p != '\0'; p++)
+	{
+	    if (*p < '0' || *p > '9' || bits > 128)
+		return false;
+	    bits = bits * 10 + *p - '0';
+	}
+    }
+
+    if (strchr(buf, ':') != 0)
+    {
+	struct in6_addr a;
+	if (inet_pton(AF_INET6, buf, &a) != 1 || bits > 128)
+	    return false;
+
+	setIPv6(a, bits < 0 ? 128 : bits);
+    }
+    else
+    {
+	struct in_addr a;
+	if (inet_aton(buf, &a) == 0 || bits > 32)
+	    return false;
+
+	setIPv4(a, bits < 0 ? 32 : bits);
+    }
+
+    return true;
+}
+
+size_t SQLIPAddress::format(char *buf, size_t size) const
+{
+    char out[MAX_IP_ADDRESS_STRING];
+    int bits = prefix;
+
+    if (v4)
+    {
+	struct in_addr a;
+	a.s_addr = htonl((unsigned long)(low & 0xffffffffULL));
+	inet_ntop(AF_INET, &a, out, sizeof(out));
+	bits -= 96;
+    }
+    else
+    {
+	struct in6_addr a;
+	for (int i = 0; i < 8; i++)
+	{
+	    a.s6_addr[i] = (unsigned char)(high >> (56 - 8 * i));
+	    a.s6_addr[i + 8] = (unsigned char)(low >> (56 - 8 * i));
+	}
+	inet_ntop(AF_INET6, &a, out, sizeof(out));
+    }
+
+    size_t len = strlen(out);
+
+    // Single addresses are written without a prefix length
+    if (prefix < 128)
+	len += snprintf(out + len, sizeof(out) - len, "/%d", bits);
+
+    return copyString(out, len, buf, size);
+}
+
+int SQLIPAddress::compare(const SQLIPAddress &a) const
+{
+    if (high != a.high)
+	return high < a.high ? -1 : 1;
+    if (low != a.low)
+	return low < a.low ? -1 : 1;
+
+    return (int)prefix - (int)a.prefix;
+}
 
 SQLIPAddressValue::SQLIPAddressValue()
+: SQLValueRep(SQLIPAddressType)
+{
+    memset(&value, 0, sizeof(value));
+}
+
+SQLIPAddressValue::SQLIPAddressValue(const struct in_addr &value_)
+: SQLValueRep(SQLIPAddressType)
+{
+    value.setIPv4(value_);
+}
+
+SQLIPAddressValue::SQLIPAddressValue(const struct in6_addr &value_)
+: SQLValueRep(SQLIPAddressType)
+{
+    value.setIPv6(value_);
+}
+
+SQLIPAddressValue::SQLIPAddressValue(const SQLIPAddress &value_)
+: SQLValueRep(SQLIPAddressType), value(value_)
 {
 }
 
 SQLIPAddressValue::SQLIPAddressValue(const std::string &s)
+: SQLValueRep(SQLIPAddressType)
 {
+    memset(&value, 0, sizeof(value));
     fromString(s);
 }
 
 bool SQLIPAddressValue::fromString(const std::string &s)
 {
-    bool res = inet_aton(s.c_str(), &value) != 0;
-
-    //printf("value = %08x addr = %s\n", value.s_addr, s.c_str());
-
-    return res;
+    return value.parse(s.data(), s.length());
 }
 
 void SQLIPAddressValue::toString(std::string &s)
 {
-    s = inet_ntoa(value);
+    char buf[MAX_IP_ADDRESS_STRING];
+    size_t len = value.format(buf, sizeof(buf));
+
+    s.assign(buf, len);
 }
 
 const char * SQLIPAddressValue::typeAsString() const
@@ -867,21 +2325,18 @@ SQLValueRep * SQLIPAddressValue::clone() const
     return v;
 }
 
+const SQLIPAddress & SQLIPAddressValue::getValue() const
+{
+    return value;
+}
+
 int SQLIPAddressValue::compare(SQLValueRep *rep) const
 {
     assert(isSameType(rep));
 
     SQLIPAddressValue *r = (SQLIPAddressValue *)rep;
 
-    unsigned long l1 = ntohl(value.s_addr);
-    unsigned long l2 = ntohl(r->value.s_addr);
-
-    if (l1 < l2)
-        return -1;
-    else if (l1 > l2)
-        return 1;
-    else
-        return 0;
+    return value.compare(r->value);
 }
 
 // Perform the given arithmetic operation and return the result
@@ -899,7 +2354,7 @@ SQLValueRep * SQLIPAddressValue::unaryOperation(char op)
 
 // Exception Value class
 SQLExceptionValue::SQLExceptionValue(std::string exception)
-: exception_(exception)
+: SQLValueRep(SQLExceptionType), exception_(exception)
 {
 }
 
@@ -13,14 +13,96 @@
 
 #include <string>
 #include <assert.h>
+#include "SQLAtomic.h"
+#include "SQLPool.h"
 
 #if SQL_DATE_SUPPORT
 #include <time.h>
 #endif
 
+#if SQL_IP_SUPPORT
+#include <netinet/in.h>
+#endif
+
 class SQLValueRep;
 class SQLNullValue;
 
+/** Buffer size that will hold any formatted Integer or Real value */
+enum { MAX_NUMBER_STRING = 32 };
+
+#if SQL_IP_SUPPORT
+/** Buffer size that will hold any formatted IP address and prefix */
+enum { MAX_IP_ADDRESS_STRING = 64 };
+
+/**
+ * An IPv4 or IPv6 address and the prefix length of the subnet it names.
+ * IPv4 addresses are held as IPv4 mapped IPv6 addresses so both kinds
+ * compare in one address space. The 128 bits are kept as two host order
+ * integers so a subnet match is a masked compare.
+ */
+struct SQLIPAddress
+{
+    unsigned long long high;
+    unsigned long long low;
+    /** Number of leading bits of the 128 bit address that are significant */
+    unsigned char prefix;
+    /** Written in IPv4 notation */
+    bool v4;
+
+    void setIPv4(const struct in_addr &a, int bits = 32);
+    void setIPv6(const struct in6_addr &a, int bits = 128);
+
+    /**
+     * Parse an IPv4 or IPv6 address with an optional /bits prefix length.
+     * Returns false if the string is not an address.
+     */
+    bool parse(const char *s, size_t len);
+
+    /** Write the address into buf in the form parse() accepts */
+    size_t format(char *buf, size_t size) const;
+
+    int compare(const SQLIPAddress &a) const;
+
+    /**
+     * Return true if this address or subnet lies within the subnet net,
+     * including when it is the same subnet.
+     */
+    bool isWithin(const SQLIPAddress &net) const
+    {
+        unsigned p = net.prefix;
+
+        if (prefix < p)
+            return false;
+
+        // Shifting by 64 or more is undefined so the masks are split
+        unsigned long long high_mask =
+            p == 0 ? 0 : p >= 64 ? ~0ULL : ~0ULL << (64 - p);
+        unsigned long long low_mask =
+            p <= 64 ? 0 : ~0ULL << (128 - p);
+
+        return ((high ^ net.high) & high_mask) == 0 &&
+            ((low ^ net.low) & low_mask) == 0;
+    }
+};
+#endif
+
+/**
+ * Identify the type held in a SQLValue.
+ */
+enum SQLValueType
+{
+    SQLNullType,
+    SQLBooleanType,
+    SQLIntegerType,
+    SQLRealType,
+    SQLStringType,
+    SQLDateTimeType,
+    SQLIPAddressType,
+    SQLExceptionType,
+    /** Application defined SQLValueRep */
+    SQLOtherType
+};
+
 /**
  * Implementation of the SQL variable types
  */
@@ -29,8 +111,23 @@ class SQLValueRep
 friend class SQLValue;
 public:
     SQLValueRep();
+    SQLValueRep(SQLValueType type_id);
+    SQLValueRep(const SQLValueRep &rep);
     virtual ~SQLValueRep();
 
+    /** Reps are allocated from the SQLPool */
+    static void *operator new(size_t size) { return SQLPool::allocate(size); }
+    static void operator delete(void *p, size_t size)
+    {
+        SQLPool::release(p, size);
+    }
+
+    /**
+     * Return the type identifier. Application defined reps are all
+     * SQLOtherType and are distinguished by typeAsString().
+     */
+    SQLValueType typeId() const { return typeId_; }
+
     /** Sets the variable from the given string. */
     virtual bool fromString(const std::string &s) = 0;
 
@@ -62,25 +159,88 @@ protected:
     SQLValueRep *illegalOperation(char op);
 
 private:
-    int refCount_;
+    void operator=(const SQLValueRep &);
+
+    /** Values of a shared expression may be copied by several threads */
+    SQLAtomic<int> refCount_;
+    SQLValueType typeId_;
 };
 
 /**
  * Represent the different SQL value types.
  *
+ * The built in scalar types and short strings are held inline so creating
+ * and copying them does not touch the heap. Long strings, exceptions and
+ * application defined types are held in a shared reference counted
+ * SQLValueRep.
  */
 class SQLValue
 {
 public:
     SQLValue();
     SQLValue(const SQLValue &v);
+
+    /**
+     * Hold a reference to the given rep, which is deleted when the last
+     * value holding it is destroyed. The value of a built in type is also
+     * copied inline so reading it does not go through the rep.
+     */
     SQLValue(SQLValueRep *rep);
     ~SQLValue();
 
     const SQLValue &operator=(const SQLValue &v);
 
+#if __cplusplus >= 201103L
+    /** Take the value from v leaving it Null. Reference counts are unchanged. */
+    SQLValue(SQLValue &&v) noexcept;
+    const SQLValue &operator=(SQLValue &&v) noexcept;
+#endif
+
+    /** Exchange the values of this and v without changing reference counts */
+    void swap(SQLValue &v);
+
+    /** Construct values of the built in types without a heap allocation */
+    static SQLValue makeBoolean(bool b);
+    static SQLValue makeInteger(int i);
+    static SQLValue makeReal(double d);
+    static SQLValue makeString(const std::string &s);
+
+    /**
+     * Construct a string value that refers to the callers memory rather
+     * than copying it. The memory must remain valid and unchanged for as
+     * long as the value or any copy of it is in use, which for a value
+     * returned from SQLContext::variableLookup() is the evaluation of the
+     * expression for the current object.
+     */
+    static SQLValue makeBorrowedString(const char *s, size_t len);
+    static SQLValue makeBorrowedString(const std::string &s);
+#if SQL_DATE_SUPPORT
+    static SQLValue makeDateTime(time_t t);
+#endif
+#if SQL_IP_SUPPORT
+    static SQLValue makeIPAddress(const struct in_addr &a);
+    static SQLValue makeIPAddress(const SQLIPAddress &a);
+#endif
+
+    /** Return the type of the value */
+    SQLValueType type() const { return type_; }
+
     /** Return the value as some common types */
     std::string asString() const;
+
+    /**
+     * Write the value as a null terminated string into buf, truncating it
+     * to fit in size bytes. Returns the length written. Numeric values are
+     * formatted without any allocation.
+     */
+    size_t toString(char *buf, size_t size) const;
+
+    /**
+     * Return the characters of a string value without copying them and
+     * set len to their number. The characters are not necessarily null
+     * terminated. Returns 0 if the value is not a string.
+     */
+    const char *stringData(size_t &len) const;
     bool asBoolean() const;
     int asInteger() const;
     double asReal() const;
@@ -89,16 +249,33 @@ public:
     time_t asDateTime() const;
 #endif
 
+    /**
+     * Return the value of a built in type without any conversion. The
+     * value must already be of that type.
+     */
+    int integerValue() const { return value_.integer; }
+    double realValue() const { return value_.real; }
+#if SQL_DATE_SUPPORT
+    time_t dateTimeValue() const { return value_.dateTime; }
+#endif
+
     bool fromString(const std::string &str);
 
     /** Return true if the objects are of the same type */
-    bool isSameType(const SQLValue &v) const;
+    bool isSameType(const SQLValue &v) const
+    {
+        if (type_ != v.type_)
+            return false;
+
+        // Application types need to be checked by the rep
+        return type_ != SQLOtherType || value_.rep->isSameType(v.value_.rep);
+    }
 
     /** Return true if the object is void */
-    bool isNull() const;
+    bool isNull() const { return type_ == SQLNullType; }
 
     /** Return true if the object is an exception */
-    bool isException() const;
+    bool isException() const { return type_ == SQLExceptionType; }
 
     /**
      * Compare this with argument and return
@@ -106,35 +283,143 @@ public:
      *      0 if this == v
      *      1 if this > v
      */
-    int compare(SQLValue v);
+    int compare(const SQLValue &v) const;
+
+    bool operator==(const SQLValue &v) const;
+    bool operator!=(const SQLValue &v) const;
+
+    /**
+     * Return a hash of the value. Values of the same type that compare as
+     * equal have the same hash, whether or not strings are compared case
+     * insensitively.
+     */
+    size_t hash() const;
 
-    bool operator==(SQLValue v);
-    bool operator!=(SQLValue v);
+    /**
+     * Return true if this is an IP address or subnet within the subnet
+     * given by v. Always false for values that are not IP addresses.
+     */
+    bool isWithin(const SQLValue &v) const;
 
     /** Change the type of this to match the type of the given value. */
     bool typeConvert(const SQLValue &v);
 
+    /**
+     * Change the type of this to one of the built in types in the same way
+     * as typeConvert(). Returns false if it cannot be converted.
+     */
+    bool convertToType(SQLValueType type);
+
     /** Perform the given arithmetic operation and return the result */
-    SQLValue binaryOperation(SQLValue v2, char op);
+    SQLValue binaryOperation(const SQLValue &v2, char op);
     SQLValue unaryOperation(char op);
 
+#if SQL_COUNT_REFERENCES
+    /**
+     * Number of reference count changes this thread has made on values
+     * held on the heap. Used to measure the cost of copying values. The
+     * whole library and its users must be built with SQL_COUNT_REFERENCES.
+     */
+    static unsigned long referenceOperations();
+#endif
+
 private:
-    SQLValueRep *rep_;
-    static SQLNullValue *nullRep_;
+    /** Longest string that is stored inline */
+    enum { MAX_SHORT_STRING = 23 };
+
+    SQLValueType type_;
+    /** Value is held in value_.rep */
+    bool heap_;
+    /** String value refers to application memory in value_.borrowed */
+    bool borrowed_;
+    /** Length of an inline string */
+    unsigned char length_;
+    /**
+     * Rep passed to SQLValue(SQLValueRep *) whose value was copied inline.
+     * A reference is held on it for as long as the value so the caller may
+     * share it between values just as with a rep that stays on the heap.
+     */
+    SQLValueRep *owner_;
+
+    union
+    {
+        bool boolean;
+        int integer;
+        double real;
+#if SQL_DATE_SUPPORT
+        time_t dateTime;
+#endif
+#if SQL_IP_SUPPORT
+        SQLIPAddress ipAddress;
+#endif
+        char string[MAX_SHORT_STRING + 1];
+        struct
+        {
+            const char *data;
+            size_t length;
+        } borrowed;
+        SQLValueRep *rep;
+    } value_;
+
+    void assign(SQLValueRep *rep);
+    void setString(const char *s, size_t len);
+    bool parseAs(SQLValueType type, const std::string &str);
+    bool numericConvert(SQLValueType type);
+    const char *typeAsString() const;
+    SQLValue illegalOperation(char op) const;
+
+#if SQL_COUNT_REFERENCES
+    static SQL_THREAD_LOCAL unsigned long numReferenceOperations;
+#endif
 
     void setRep(SQLValueRep *rep)
     {
-        rep_ = rep;
+        value_.rep = rep;
+        heap_ = true;
 
-        rep_->refCount_++;
+        rep->refCount_.add(1);
+#if SQL_COUNT_REFERENCES
+        numReferenceOperations++;
+#endif
+    }
+
+    static void releaseRep(SQLValueRep *rep)
+    {
+        assert(rep->refCount_.load() > 0);
+
+#if SQL_COUNT_REFERENCES
+        numReferenceOperations++;
+#endif
+        if (rep->refCount_.add(-1) == 0)
+            delete rep;
+    }
+
+    void setOwner(SQLValueRep *rep)
+    {
+        owner_ = rep;
+
+        rep->refCount_.add(1);
+#if SQL_COUNT_REFERENCES
+        numReferenceOperations++;
+#endif
     }
 
     void clearRep()
     {
-        assert(rep_->refCount_ > 0);
+        borrowed_ = false;
+
+        if (owner_ != 0)
+        {
+            releaseRep(owner_);
+            owner_ = 0;
+        }
+
+        if (!heap_)
+            return;
 
-        if (--rep_->refCount_ == 0)
-            delete rep_;
+        releaseRep(value_.rep);
+
+        heap_ = false;
     }
 };
 
@@ -144,6 +429,8 @@ private:
 class SQLNullValue : public SQLValueRep
 {
 public:
+    SQLNullValue();
+
     virtual bool fromString(const std::string &s);
     virtual void toString(std::string &s);
 
@@ -199,6 +486,14 @@ public:
 
     int getValue() const;
 
+    /**
+     * Convert to and from strings without iostreams. format() writes at
+     * most size bytes including the terminating null into buf and returns
+     * the length written.
+     */
+    static bool parse(const char *s, size_t len, int &value);
+    static size_t format(int value, char *buf, size_t size);
+
 private:
     int value;
 };
@@ -223,6 +518,15 @@ public:
     virtual SQLValueRep *unaryOperation(char op);
 
     double getValue() const;
+
+    /**
+     * Convert to and from strings without iostreams. format() writes at
+     * most size bytes including the terminating null into buf and returns
+     * the length written.
+     */
+    static bool parse(const char *s, size_t len, double &value);
+    static size_t format(double value, char *buf, size_t size);
+
 private:
     double value;
 };
@@ -249,6 +553,14 @@ public:
     const std::string &getValue() const;
 
     static void setCaseInsensitive(bool s);
+    static bool isCaseInsensitive() { return caseInsensitive; }
+
+    /**
+     * Compare two strings of the given lengths honouring the case
+     * sensitivity setting.
+     */
+    static int compareStrings(const char *s1, size_t l1,
+			      const char *s2, size_t l2);
 private:
     std::string value;
 
@@ -277,18 +589,35 @@ public:
 
     time_t getValue() const;
 
+    /**
+     * Write value in the current format without an allocation. Writes at
+     * most size bytes including the terminating null into buf and returns
+     * the length written. The local date is cached per thread so only the
+     * time of day is worked out for further values on the same day.
+     */
+    static size_t format(time_t value, char *buf, size_t size);
+
     static void setFormat(const std::string &fmt);
+
+    /**
+     * Forget the cached local time offsets. Call this after changing the
+     * TZ environment variable.
+     */
+    static void resetTimeZone();
 private:
-    static std::string format;
+    static std::string formatString;
+    /** Format rewritten for parseFast() or empty if strptime is needed */
+    static std::string fastFormat;
+    /** True if format() can write fastFormat without using strftime */
+    static bool fastOutput;
+
+    static bool parseFast(const char *s, time_t &t);
 
     time_t value;
 };
 #endif
 
 #if SQL_IP_SUPPORT
-
-#include <netinet/in.h>
-
 /**
  * Represent the SQL IP address value.
  */
@@ -298,6 +627,9 @@ class SQLIPAddressValue
 public:
     SQLIPAddressValue();
     SQLIPAddressValue(const std::string &s);
+    SQLIPAddressValue(const struct in_addr &value);
+    SQLIPAddressValue(const struct in6_addr &value);
+    SQLIPAddressValue(const SQLIPAddress &value);
 
     virtual bool fromString(const std::string &s);
     virtual void toString(std::string &s);
@@ -308,9 +640,9 @@ public:
     virtual SQLValueRep *binaryOperation(SQLValueRep *v2, char op);
     virtual SQLValueRep *unaryOperation(char op);
 
-    time_t getValue() const;
+    const SQLIPAddress &getValue() const;
 private:
-    struct in_addr value;
+    SQLIPAddress value;
 };
 #endif
 
@@ -0,0 +1,128 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLValueSet.cpp
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Set of values of one type for membership tests
+ */
+#include "SQLValueSet.h"
+
+SQLValueSet::SQLValueSet()
+: mask_(0), hasNull_(false)
+{
+}
+
+void SQLValueSet::clear()
+{
+    values_.clear();
+    hashes_.clear();
+    slots_.clear();
+    mask_ = 0;
+    hasNull_ = false;
+}
+
+bool SQLValueSet::assign(const std::vector<SQLValue> &values,
+			 SQLValueType type)
+{
+    clear();
+
+    for (size_t i = 0; i < values.size(); i++)
+    {
+	if (values[i].isNull())
+	{
+	    hasNull_ = true;
+	    continue;
+	}
+
+	SQLValue v(values[i]);
+	if (!v.convertToType(type))
+	{
+	    clear();
+	    return false;
+	}
+
+	insert(v);
+    }
+
+    return true;
+}
+
+bool SQLValueSet::hasNull() const
+{
+    return hasNull_;
+}
+
+int SQLValueSet::size() const
+{
+    return values_.size();
+}
+
+void SQLValueSet::insert(const SQLValue &v)
+{
+    if (contains(v))
+	return;
+
+    values_.push_back(v);
+    hashes_.push_back(v.hash());
+
+    if (values_.size() <= SMALL_SET)
+	return;
+
+    // Keep the table at most half full
+    if (values_.size() * 2 > slots_.size())
+	rehash();
+    else
+	addSlot(values_.size() - 1);
+}
+
+bool SQLValueSet::contains(const SQLValue &v) const
+{
+    int n = values_.size();
+
+    if (n <= SMALL_SET)
+    {
+	for (int i = 0; i < n; i++)
+	    if (values_[i].compare(v) == 0)
+		return true;
+
+	return false;
+    }
+
+    size_t h = v.hash();
+
+    for (size_t s = h & mask_; slots_[s] != 0; s = (s + 1) & mask_)
+    {
+	int i = slots_[s] - 1;
+
+	if (hashes_[i] == h && values_[i].compare(v) == 0)
+	    return true;
+    }
+
+    return false;
+}
+
+void SQLValueSet::addSlot(int i)
+{
+    size_t s = hashes_[i] & mask_;
+
+    while (slots_[s] != 0)
+	s = (s + 1) & mask_;
+
+    slots_[s] = i + 1;
+}
+
+void SQLValueSet::rehash()
+{
+    size_t size = 16;
+    while (size < values_.size() * 2)
+	size *= 2;
+
+    slots_.assign(size, 0);
+    mask_ = size - 1;
+
+    for (size_t i = 0; i < values_.size(); i++)
+	addSlot(i);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright   : (c) 2010 by Open Source Solutions Pty Ltd.  All Rights Reserved
+ * Project     : Core Libraries
+ * File        : SQLValueSet.h
+ *
+ * Author      : Denis Dowling
+ * Created     : 1/12/2010
+ *
+ * Description : Set of values of one type for membership tests
+ */
+#ifndef SQLVALUESET_H
+#define SQLVALUESET_H
+
+#include "SQLValue.h"
+#include <vector>
+
+/**
+ * Set of values that all have the same built in type. Small sets are
+ * searched in order, larger ones through an open addressing hash table
+ * so the cost of contains() does not grow with the size of the set.
+ */
+class SQLValueSet
+{
+public:
+    SQLValueSet();
+
+    void clear();
+
+    /**
+     * Replace the contents with the values converted to type. Null values
+     * are left out and reported by hasNull(). Returns false and leaves the
+     * set empty if any value cannot be converted.
+     */
+    bool assign(const std::vector<SQLValue> &values, SQLValueType type);
+
+    /** True if a null value was given to assign() */
+    bool hasNull() const;
+
+    /** Add a value to the set. The value must not be null or an exception */
+    void insert(const SQLValue &v);
+
+    /** True if the set holds a value equal to v, which must be of the
+     * same type as the values in the set */
+    bool contains(const SQLValue &v) const;
+
+    int size() const;
+
+private:
+    enum { SMALL_SET = 8 };
+
+    std::vector<SQLValue> values_;
+    std::vector<size_t> hashes_;
+
+    /** Index plus one of the value in each slot, or 0 if it is empty */
+    std::vector<int> slots_;
+    size_t mask_;
+    bool hasNull_;
+
+    void addSlot(int i);
+    void rehash();
+};
+
+#endif
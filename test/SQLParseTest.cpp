@@ -120,7 +120,7 @@ int main()
     t("-a", "Negate(a)");
     t("f(a, b, c, d)", "Function(f, {a, b, c, d})");
     t("ip.addr = '192.168.44.1' and ip.port in (80, 443) and http.host = 'www.example.com'",
-      "And(And(Equals(ip.addr, 192.168.44.1), In(ip.port, {80, 443})), Equals(http.host, www.example.com))");
+      "And(Equals(ip.addr, 192.168.44.1), In(ip.port, {80, 443}), Equals(http.host, www.example.com))");
 
     // Parse an empty expression
     t("", "");
@@ -181,6 +181,37 @@ int main()
     t("\"\"", "");
     t("'\\n\\t\\r'", "\n\t\r");
 
+    // Constant folding and simplification
+    t("1 + 2 * 3", "7");
+    t("width * 2 > 100 * 6",
+      "GreaterThan(Operation(width * 2), 600)");
+    t("a in (1 + 1, 3)", "In(a, {2, 3})");
+    t("2 in (1 + 1, 3)", "True");
+    t("sqrt(16) < a", "LessThan(4, a)");
+    t("f(1, 2)", "Function(f, {1, 2})");
+    t("10 = '10'", "True");
+    t("1 = 'x'", "Equals(1, x)");
+    t("1 / 0", "Operation(1 / 0)");
+    t("(a < b) = 'true'", "Equals(LessThan(a, b), True)");
+    t("not not (a = b)", "Equals(a, b)");
+    t("not not a", "Not(Not(a))");
+    t("a and true", "a");
+    t("a or false", "a");
+    t("true and a = b", "Equals(a, b)");
+    t("true and a", "And(True, a)");
+    t("false and a", "False");
+    t("true or a", "True");
+    t("false or a", "Or(False, a)");
+    t("a and 1 = 1", "a");
+
+    // Parameters are numbered in order and are never folded
+    t("a = ?", "Equals(a, ?0)");
+    t("a = ? and b < ?", "And(Equals(a, ?0), LessThan(b, ?1))");
+    t("a = :low or b = :low", "Or(Equals(a, :low), Equals(b, :low))");
+    t("1 + ? > 2", "GreaterThan(Operation(1 + ?0), 2)");
+    t("a in :codes", "In(a, :codes)");
+    t("a not in ?", "Not(In(a, ?0))");
+
     // Now add some syntax errors
     t("a b", "", true);
     t("( b c )", "", true);
@@ -9,11 +9,66 @@
  * Description : Test the value class and the type conversion operators
  */
 #include "SQLValue.h"
+#include "SQLValueSet.h"
 #include <iostream>
 #include <assert.h>
+#include <utility>
+#include <string.h>
+#include <pthread.h>
+#include <new>
+#include <stdlib.h>
 
 using namespace std;
 
+// Count the blocks returned to the global allocator. Every form of the
+// allocator that is used is replaced so the blocks come from malloc().
+static volatile unsigned long num_deletes;
+
+void *operator new(size_t size)
+{
+    void *p = malloc(size);
+    if (p == 0)
+	throw bad_alloc();
+
+    return p;
+}
+
+void operator delete(void *p) throw()
+{
+    if (p != 0)
+	__sync_add_and_fetch(&num_deletes, 1);
+    free(p);
+}
+
+#if __cpp_sized_deallocation
+void operator delete(void *p, size_t) throw()
+{
+    operator delete(p);
+}
+#endif
+
+// An integer rep that records when it is deleted
+static int num_shared_deleted;
+
+class SharedInteger : public SQLIntegerValue
+{
+public:
+    SharedInteger(int value) : SQLIntegerValue(value) { ; }
+    ~SharedInteger() { num_shared_deleted++; }
+};
+
+static const int num_thread_values = 50;
+
+// Leave blocks on the free lists of a thread that then exits
+void *fill_pool(void *)
+{
+    SQLValue values[num_thread_values];
+    for (int i = 0; i < num_thread_values; i++)
+	values[i] = SQLValue(new SQLExceptionValue("Pooled"));
+
+    return 0;
+}
+
 int main()
 {
     // NULL TESTS
@@ -218,6 +273,294 @@ int main()
     // Test the exception class
     SQLValue v18(new SQLExceptionValue("Test error"));
     cout << "v18 is " << v18.asString() << endl;
+    assert(v18.isException());
+    assert(v18.asString() == "Test error");
+
+    //
+    // INLINE VALUE TESTS
+    //
+    SQLValue v19 = SQLValue::makeInteger(10);
+    assert(v19.isSameType(v5));
+    assert(v19.compare(v5) == 0);
+    assert(v19.asString() == "10");
+
+    SQLValue v20 = SQLValue::makeReal(10.33);
+    assert(v20.isSameType(v15));
+    assert(v20.compare(v15) == 0);
+
+    SQLValue v21 = SQLValue::makeBoolean(true);
+    assert(v21.isSameType(v1));
+    assert(v21 == v1);
+
+    // Short strings are held inline and long strings on the heap but both
+    // must behave as the same type.
+    string long_str(100, 'x');
+    SQLValue v22 = SQLValue::makeString("Hello");
+    SQLValue v23 = SQLValue::makeString(long_str);
+    SQLValue v24(new SQLStringValue(long_str));
+    assert(v22.isSameType(v8));
+    assert(v22 == v8);
+    assert(v23.isSameType(v22));
+    assert(v23 == v24);
+    assert(v23.asString() == long_str);
+    assert(v22.compare(v23) < 0);
+
+    SQLValue v25 = v22.binaryOperation(v23, '+');
+    assert(v25.asString() == "Hello" + long_str);
+
+    // A rep passed in is shared by the values holding it even though its
+    // value is copied inline, and is deleted with the last of them
+    SharedInteger *shared = new SharedInteger(5);
+    {
+	SQLValue s1(shared);
+	SQLValue s2(shared);
+	assert(s1.asInteger() == 5 && s2.asInteger() == 5);
+
+	s1 = SQLValue::makeInteger(6);
+	assert(shared->getValue() == 5);
+	assert(num_shared_deleted == 0);
+
+	SQLValue s3 = s2;
+	s2 = s1;
+	assert(s3.asInteger() == 5 && shared->getValue() == 5);
+	assert(num_shared_deleted == 0);
+    }
+    assert(num_shared_deleted == 1);
+
+    // Integer division by zero is an exception rather than a trap
+    assert(v19.binaryOperation(SQLValue::makeInteger(0), '/').isException());
+
+    // Copies are independent of the original
+    SQLValue v26 = v19;
+    assert(v26.fromString("20"));
+    assert(v26.asInteger() == 20);
+    assert(v19.asInteger() == 10);
+
+    SQLValue v27 = SQLValue::makeString("42");
+    assert(v27.typeConvert(v19));
+    assert(v27.isSameType(v19));
+    assert(v27.asInteger() == 42);
+
+    // Type identifiers
+    assert(void1.type() == SQLNullType);
+    assert(v1.type() == SQLBooleanType);
+    assert(v5.type() == SQLIntegerType);
+    assert(v8.type() == SQLStringType);
+    assert(v15.type() == SQLRealType);
+    assert(v18.type() == SQLExceptionType);
+    assert(v23.type() == SQLStringType);
+
+    SQLStringValue sv1("abc");
+    SQLIntegerValue iv1(1);
+    assert(sv1.typeId() == SQLStringType);
+    assert(!sv1.isSameType(&iv1));
+
+    // Direct conversions between the numeric types
+    SQLValue n1 = SQLValue::makeReal(3.7);
+    assert(n1.typeConvert(v5));
+    assert(n1.type() == SQLIntegerType);
+    assert(n1.asInteger() == 3);
+
+    SQLValue n2 = SQLValue::makeBoolean(true);
+    assert(n2.typeConvert(v5));
+    assert(n2.asInteger() == 1);
+
+    SQLValue n3 = SQLValue::makeInteger(7);
+    assert(n3.typeConvert(v15));
+    assert(n3.type() == SQLRealType);
+    assert(n3.asReal() == 7.0);
+    assert(n3.typeConvert(v1));
+    assert(n3.asBoolean() == true);
+
+    SQLValue n4 = SQLValue::makeReal(1.0e12);
+    assert(!n4.typeConvert(v5));
+    assert(n4.type() == SQLRealType);
+
+    // Number parsing and formatting
+    SQLValue p1 = SQLValue::makeInteger(0);
+    assert(p1.fromString(" +42"));
+    assert(p1.asInteger() == 42);
+    assert(p1.fromString("-17xyz"));
+    assert(p1.asInteger() == -17);
+    assert(!p1.fromString("abc"));
+    assert(!p1.fromString("99999999999"));
+    assert(p1.asInteger() == -17);
+
+    SQLValue p2 = SQLValue::makeReal(0.0);
+    assert(p2.fromString("2.5e3"));
+    assert(p2.asReal() == 2500.0);
+    assert(p2.asString() == "2500");
+    assert(!p2.fromString("x1"));
+
+    char buf[MAX_NUMBER_STRING];
+    assert(SQLValue::makeInteger(-12345).toString(buf, sizeof(buf)) == 6);
+    assert(string(buf) == "-12345");
+    assert(SQLValue::makeReal(3.14159265).toString(buf, sizeof(buf)) == 7);
+    assert(string(buf) == "3.14159");
+    assert(SQLValue::makeReal(1.0e20).toString(buf, sizeof(buf)) == 5);
+    assert(string(buf) == "1e+20");
+    assert(SQLValue::makeString("Hello").toString(buf, 4) == 3);
+    assert(string(buf) == "Hel");
+
+    // Borrowed strings refer to the callers memory
+    const char *hello_world = "Hello World";
+    SQLValue b1 = SQLValue::makeBorrowedString(hello_world, 5);
+    size_t b1_len;
+    assert(b1.stringData(b1_len) == hello_world);
+    assert(b1_len == 5);
+    assert(b1.isSameType(v8));
+    assert(b1 == v8);
+    assert(b1.asString() == "Hello");
+    assert(b1.compare(SQLValue::makeString("Hello World")) < 0);
+    SQLValue b2 = b1.binaryOperation(SQLValue::makeBorrowedString(long_str), '+');
+    assert(b2.asString() == "Hello" + long_str);
+    SQLValue b3 = b1;
+    assert(b3.fromString("Changed"));
+    assert(b1.asString() == "Hello");
+    assert(v5.stringData(b1_len) == 0);
+
+    // Swapping and moving hand over heap values without reference counting
+    SQLValue s1 = SQLValue::makeString(long_str);
+    SQLValue s2 = SQLValue::makeInteger(7);
+#if SQL_COUNT_REFERENCES
+    unsigned long references = SQLValue::referenceOperations();
+#endif
+    s1.swap(s2);
+    assert(s1.asInteger() == 7);
+    assert(s2.asString() == long_str);
+#if __cplusplus >= 201103L
+    SQLValue s3(std::move(s2));
+    assert(s2.isNull());
+    s1 = std::move(s3);
+    assert(s3.isNull());
+    assert(s1.asString() == long_str);
+#endif
+#if SQL_COUNT_REFERENCES
+    assert(SQLValue::referenceOperations() == references);
+#endif
+
+    // Reps are recycled through the SQLPool
+    SQLValue(new SQLExceptionValue("Warm up"));
+    unsigned long global_allocations = SQLPool::globalAllocations();
+    for (int i = 0; i < 100; i++)
+    {
+	SQLValue e(new SQLExceptionValue("Pooled"));
+	assert(e.isException());
+    }
+    assert(SQLPool::globalAllocations() == global_allocations);
+    assert(SQLPool::poolAllocations() >= 100);
+
+    // The free lists of a thread are released when it exits
+    unsigned long deletes = num_deletes;
+    pthread_t thread;
+    pthread_create(&thread, 0, fill_pool, 0);
+    pthread_join(thread, 0);
+    assert(num_deletes - deletes >= (unsigned long)num_thread_values);
+
+#if SQL_DATE_SUPPORT
+    SQLValue n5 = SQLValue::makeDateTime(86400);
+    assert(n5.asInteger() == 86400);
+    SQLValue n6 = SQLValue::makeInteger(3600);
+    assert(n6.typeConvert(n5));
+    assert(n6.type() == SQLDateTimeType);
+    assert(n6.asDateTime() == 3600);
+
+    // The fast date parser must agree with strptime() and mktime()
+    const char *formats[] = { "%Y-%m-%d %H:%M:%S", "%H:%M %d/%m/%Y", "%F %T" };
+    const char *dates[] = { "2010-12-01 12:00:00", "10:30 1/7/2010",
+			    "2010-02-31 1:2:3", " 2010-03-28  02:30:00",
+			    "2010-13-01 00:00:00", "2010-06-15 garbage" };
+    for (int f = 0; f < 3; f++)
+    {
+	SQLDateTimeValue::setFormat(formats[f]);
+
+	for (int d = 0; d < 6; d++)
+	{
+	    struct tm tmbuf;
+	    memset(&tmbuf, 0, sizeof(tmbuf));
+	    bool ok = strptime(dates[d], formats[f], &tmbuf) != 0;
+	    time_t t = mktime(&tmbuf);
+
+	    SQLDateTimeValue dt;
+	    assert(dt.fromString(dates[d]) == ok);
+	    assert(!ok || dt.getValue() == t);
+	}
+    }
+
+    // Cached formatting must agree with localtime_r() and strftime()
+    const char *out_formats[] = { "%Y-%m-%d %H:%M:%S", "%e/%m/%Y %R",
+				  "%-d %b %Y %I:%M %p" };
+    for (int f = 0; f < 3; f++)
+    {
+	SQLDateTimeValue::setFormat(out_formats[f]);
+
+	for (time_t t = 1262304000; t < 1262304000 + 86400 * 3; t += 4999)
+	{
+	    struct tm tmbuf;
+	    localtime_r(&t, &tmbuf);
+	    char expected[64];
+	    strftime(expected, sizeof(expected), out_formats[f], &tmbuf);
+
+	    char buf[64];
+	    assert(SQLDateTimeValue::format(t, buf, sizeof(buf)) ==
+		   strlen(expected));
+	    assert(strcmp(buf, expected) == 0);
+	    assert(SQLValue::makeDateTime(t).asString() == expected);
+	}
+    }
+    SQLDateTimeValue::setFormat("%Y-%m-%d %H:%M:%S");
+#endif
+
+#if SQL_IP_SUPPORT
+    // IP addresses and subnets are written back as they were parsed
+    const char *addresses[] = { "192.168.0.1", "10.0.0.0/8", "::1",
+				"2001:db8::/32", "::ffff:1.2.3.4" };
+    for (int i = 0; i < 5; i++)
+    {
+	SQLIPAddress ip;
+	assert(ip.parse(addresses[i], strlen(addresses[i])));
+
+	char buf[MAX_IP_ADDRESS_STRING];
+	ip.format(buf, sizeof(buf));
+	assert(strcmp(buf, addresses[i]) == 0);
+	assert(SQLValue::makeIPAddress(ip).asString() == addresses[i]);
+    }
+
+    SQLIPAddress host, net;
+    assert(host.parse("172.16.5.4", 10));
+    assert(net.parse("172.16.0.0/12", 13));
+    assert(host.isWithin(net));
+    assert(!net.isWithin(host));
+    assert(net.parse("172.32.0.0/12", 13));
+    assert(!host.isWithin(net));
+    assert(!net.parse("172.16.0.0/33", 13));
+    assert(!net.parse("2001:db8::/129", 14));
+    assert(!net.parse("10.0.0.0/", 9));
+#endif
+
+    // Values that compare as equal have the same hash
+    assert(SQLValue::makeInteger(42).hash() == v19.binaryOperation(
+	       SQLValue::makeInteger(32), '+').hash());
+    assert(SQLValue::makeReal(0.0).hash() == SQLValue::makeReal(-0.0).hash());
+    assert(v23.hash() == v24.hash());
+    assert(v23.hash() == SQLValue::makeBorrowedString(long_str).hash());
+    assert(SQLValue::makeString("Hello").hash() ==
+	   SQLValue::makeString("hELLO").hash());
+
+    SQLValueSet set;
+    for (int i = 0; i < 100; i += 3)
+	set.insert(SQLValue::makeInteger(i));
+    set.insert(SQLValue::makeInteger(99));
+    assert(set.size() == 34);
+    for (int i = 0; i < 100; i++)
+	assert(set.contains(SQLValue::makeInteger(i)) == (i % 3 == 0));
+
+    SQLValueSet small_set;
+    small_set.insert(v22);
+    small_set.insert(v23);
+    assert(small_set.contains(SQLValue::makeString("Hello")));
+    assert(small_set.contains(v24));
+    assert(!small_set.contains(SQLValue::makeString("Hello!")));
 
     return 0;
 }
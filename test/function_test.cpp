@@ -12,6 +12,8 @@
 #include "SQLParse.h"
 #include "SQLExpression.h"
 #include "SQLContext.h"
+#include "SQLProgram.h"
+#include "SQLSchema.h"
 
 #include <iostream>
 
@@ -22,8 +24,24 @@ class TaskContext
 : public SQLContext
 {
 public:
+    TaskContext() : functionLookups(0), nextCalls(0) { ; }
+
     virtual SQLValue variableLookup(const string &class_name,
 				    const string &member_name) const;
+    virtual SQLValue functionLookup(const string &class_name,
+				    const string &member_name,
+				    int num_args, SQLValue *args)
+    {
+	functionLookups++;
+	if (class_name.empty() && member_name == "next")
+	    return SQLValue::makeInteger(++nextCalls);
+
+	return SQLContext::functionLookup(class_name, member_name,
+					  num_args, args);
+    }
+
+    int functionLookups;
+    int nextCalls;
 };
 
 SQLValue TaskContext::variableLookup(const string &class_name,
@@ -74,6 +92,173 @@ run_expression(const string &s, double v2)
 	cout << "Error should have been '" << v2 << "'" << endl;
 	total_errors++;
     }
+
+    // The compiled program must agree with the tree
+    SQLValue pval = parser.program()->evaluate(sc);
+    if (pval.type() != val.type() || pval.asString() != val.asString())
+    {
+	cout << "Program evaluated to '" << pval.asString() << "'" << endl;
+	total_errors++;
+    }
+}
+
+static SQLValue hypotFunction(SQLContext &, int, SQLValue *args)
+{
+    return SQLValue::makeReal(hypot(args[0].asReal(), args[1].asReal()));
+}
+
+static int counter = 0;
+
+static SQLValue counterFunction(SQLContext &, int, SQLValue *)
+{
+    return SQLValue::makeInteger(++counter);
+}
+
+static SQLSchema schema;
+
+// Parse with the functions declared in the schema
+void run_bound(const string &s, double v2, const string &tree)
+{
+    SQLParse parser;
+    parser.setSchema(&schema);
+
+    if (!parser.parse(s))
+    {
+	cout << "Could not parse the expression '" << s << "' : "
+	     << parser.errorString() << endl;
+	total_errors++;
+	return;
+    }
+
+    TaskContext sc;
+    SQLValue val = parser.expression()->evaluate(sc);
+    SQLValue pval = parser.program()->evaluate(sc);
+
+    cout << "expression '" << s << "' bound as "
+	 << parser.expression()->asString() << " evaluated to '"
+	 << val.asString() << "'" << endl;
+
+    if (fabs(val.asReal() - v2) > 0.0001 ||
+	fabs(pval.asReal() - v2) > 0.0001)
+    {
+	cout << "Error should have been '" << v2 << "'" << endl;
+	total_errors++;
+    }
+
+    if (parser.expression()->asString() != tree)
+    {
+	cout << "Should be bound as " << tree << endl;
+	total_errors++;
+    }
+
+    // Declared functions are called without the context
+    if (sc.functionLookups != 0)
+    {
+	cout << "Function looked up in the context" << endl;
+	total_errors++;
+    }
+}
+
+// Check that the calls are rejected when they are bound
+void run_bound_error(const string &s, const string &error)
+{
+    SQLParse parser;
+    parser.setSchema(&schema);
+
+    bool parsed = parser.parse(s);
+
+    cout << "expression '" << s << "' has errors: "
+	 << parser.errorString() << endl;
+
+    if (parsed || parser.errorString().find(error) == string::npos)
+    {
+	cout << "Should have the error " << error << endl;
+	total_errors++;
+    }
+}
+
+void test_registry()
+{
+    schema.addField("x", SQLIntegerType);
+    schema.addField("y", SQLIntegerType);
+    schema.addFunction(SQLFunction("", "hypot", hypotFunction, SQLRealType).
+		       addArgument(SQLRealType).addArgument(SQLRealType));
+    schema.addFunction(SQLFunction("", "counter", counterFunction,
+				   SQLIntegerType).
+		       addArgument(SQLOtherType).setPure(false));
+    schema.addFunction(SQLFunction("math", "hypot", hypotFunction,
+				   SQLRealType).
+		       addArgument(SQLRealType).addArgument(SQLRealType).
+		       setVariadic());
+
+    run_bound("hypot(x, y)", 5, "Function(hypot, {x, y})");
+    run_bound("sqrt(x*x + y*y)", 5,
+	      "Function(sqrt, {Operation(Operation(x * x) + Operation(y * y))})");
+
+    // Pure functions of constants are evaluated when parsed
+    run_bound("hypot(3, 4)", 5, "5");
+    run_bound("sqrt(16) + x", 7, "Operation(4 + x)");
+
+    // The declared return type lets comparisons be specialised
+    run_bound("sqrt(x * 3) = 3", 1, "RealEquals(Function(sqrt, "
+	      "{Operation(x * 3)}), 3)");
+
+    // Other calls are evaluated each time and not shared
+    SQLParse impure;
+    impure.setSchema(&schema);
+    impure.parse("counter(x) + counter(x)");
+
+    TaskContext sc;
+    counter = 0;
+    SQLValue v1 = impure.expression()->evaluate(sc);
+    SQLValue v2 = impure.program()->evaluate(sc);
+
+    cout << "expression 'counter(x) + counter(x)' evaluated to '"
+	 << v1.asString() << "' then '" << v2.asString() << "'" << endl;
+
+    if (v1.asInteger() != 3 || v2.asInteger() != 7)
+    {
+	cout << "Error should have been '3' then '7'" << endl;
+	total_errors++;
+    }
+
+    // Calls resolved by the context may not be pure so each is made
+    SQLParse unbound;
+    unbound.parse("next(1) = 1 and next(1) = 2");
+
+    TaskContext nc;
+    SQLValue n1 = unbound.expression()->evaluate(nc);
+    int tree_calls = nc.nextCalls;
+    nc.nextCalls = 0;
+    SQLValue n2 = unbound.program()->evaluate(nc);
+
+    cout << "expression 'next(1) = 1 and next(1) = 2' evaluated to '"
+	 << n1.asString() << "' then '" << n2.asString() << "'" << endl;
+
+    if (!n1.asBoolean() || !n2.asBoolean() ||
+	tree_calls != 2 || nc.nextCalls != 2)
+    {
+	cout << "Error should have been 'True' with two calls" << endl;
+	total_errors++;
+    }
+
+    run_bound("math.hypot(x, y, 1)", 5, "Function(math.hypot, {x, y, 1})");
+
+    run_bound_error("hypot(x)", "Wrong number of arguments to function "
+		    "'hypot': expected 2 but got 1");
+    run_bound_error("sqrt(1, 2)", "expected 1 but got 2");
+    run_bound_error("hypot(x, 'abc')", "Mismatched type for argument 2 of "
+		    "function 'hypot': abc");
+    run_bound_error("math.hypot(x)", "expected at least 2 but got 1");
+
+    // Functions that are not declared are left to the context
+    SQLParse parser;
+    parser.setSchema(&schema);
+    if (!parser.parse("unknown_function(x)"))
+    {
+	cout << "Undeclared function did not parse" << endl;
+	total_errors++;
+    }
 }
 
 int main()
@@ -96,5 +281,7 @@ int main()
     // Test some unknown functions
     run_expression("unknown_function(1, 2, 4)", 0);
 
+    test_registry();
+
     return total_errors;
 }
@@ -11,6 +11,7 @@
 #include "SQLParse.h"
 #include "SQLExpression.h"
 #include "SQLContext.h"
+#include "SQLProgram.h"
 
 #include <iostream>
 
@@ -35,6 +36,8 @@ SQLValue IPContext::variableLookup(const string &class_name,
             return new SQLIPAddressValue("192.168.0.1");
         else if (member_name == "port")
             return new SQLIntegerValue(4321);
+        else if (member_name == "addr6")
+            return new SQLIPAddressValue("2001:db8::1");
     }
     else if (class_name == "dest")
     {
@@ -69,6 +72,15 @@ void run_query(const string &s,
 
     SQLValue v = e->evaluate(sc);
 
+    // The compiled program must agree with the tree
+    SQLValue pv = parser.program()->evaluate(sc);
+    if (pv.type() != v.type() || pv.asString() != v.asString())
+    {
+        cout << "query '" << s << "' program evaluated to '"
+             << pv.asString() << "' not '" << v.asString() << "'" << endl;
+        total_errors++;
+    }
+
     if (v.isException())
     {
         cout << "query '" << s << "' generated an exception '"
@@ -111,6 +123,29 @@ int main()
     run_query("src.addr not between 10.0.0.0 and 10.255.255.255", true);
     run_query("src.addr == 192.168.0.1 and dest.port == 80", true);
 
+    // Subnets
+    run_query("src.addr within 192.168.0.0/16", true);
+    run_query("src.addr << 192.168.0.0/24", true);
+    run_query("src.addr << 192.168.1.0/24", false);
+    run_query("dest.addr within 10.0.0.0/8", true);
+    run_query("dest.addr within 10.0.0.0/31", false);
+    run_query("dest.addr within '10.0.0.8/29'", true);
+    run_query("dest.addr within 0.0.0.0/0", true);
+    run_query("dest.addr within 10.0.0.10/32", true);
+    run_query("10.1.0.0/16 within 10.0.0.0/8", true);
+    run_query("10.0.0.0/8 within 10.1.0.0/16", false);
+    run_query("src.port within 10.0.0.0/8", false, true);
+
+    // IPv6
+    run_query("src.addr6 == 2001:db8::1", true);
+    run_query("src.addr6 == '2001:0db8:0:0::1'", true);
+    run_query("src.addr6 > 2001:db8::", true);
+    run_query("src.addr6 within 2001:db8::/32", true);
+    run_query("src.addr6 within 2001:db9::/32", false);
+    run_query("src.addr6 within ::/0", true);
+    run_query("src.addr within ::ffff:192.168.0.0/112", true);
+    run_query("src.addr6 within 10.0.0.0/8", false);
+
     cout << "Found a total of " << total_errors << " errors" << endl;
 
     return total_errors;
@@ -11,11 +11,46 @@
 #include "SQLParse.h"
 #include "SQLExpression.h"
 #include "SQLContext.h"
+#include "SQLProgram.h"
 
 #include <iostream>
+#include <limits.h>
 
 using namespace std;
 
+// An application defined type holding the name of a colour
+class ColourValue
+: public SQLValueRep
+{
+public:
+    ColourValue(const string &name = "") : name_(name) { ; }
+
+    virtual bool fromString(const string &s) { name_ = s; return true; }
+    virtual void toString(string &s) { s = name_; }
+    virtual const char *typeAsString() const { return "Colour"; }
+    virtual SQLValueRep *clone() const { return new ColourValue(name_); }
+
+    virtual int compare(SQLValueRep *rep) const
+    {
+	const string &n = static_cast<ColourValue *>(rep)->name_;
+
+	return name_.compare(n);
+    }
+
+    virtual SQLValueRep *binaryOperation(SQLValueRep *, char op)
+    {
+	return illegalOperation(op);
+    }
+
+    virtual SQLValueRep *unaryOperation(char op)
+    {
+	return illegalOperation(op);
+    }
+
+private:
+    string name_;
+};
+
 // Define the lookup context
 class TaskContext
 : public SQLContext
@@ -32,6 +67,10 @@ SQLValue TaskContext::variableLookup(const string &class_name,
 	return new SQLIntegerValue(3);
     else if (member_name == "y")
 	return new SQLIntegerValue(4);
+    else if (member_name == "m")
+	return SQLValue::makeInteger(INT_MIN);
+    else if (member_name == "red" || member_name == "blue")
+	return new ColourValue(member_name);
     else
 	// If no match then pass evaluation onto other context if any
 	return SQLContext::variableLookup(class_name, member_name);
@@ -70,6 +109,41 @@ void run_expression(const string &s, SQLValue expected_value)
 	     << "'" << endl;
 	total_errors++;
     }
+
+    // The compiled program must agree with the tree
+    SQLValue pval = parser.program()->evaluate(sc);
+    if (pval.type() != val.type() || pval.asString() != val.asString())
+    {
+	cout << "Program evaluated to '" << pval.asString() << "'" << endl;
+	total_errors++;
+    }
+}
+
+// The tree and the program must both give an exception with the message
+void run_exception(const string &s, const string &message)
+{
+    SQLParse parser;
+
+    if (!parser.parse(s))
+    {
+	cerr << "Could not parse the expression '" << s << "'" << endl;
+	total_errors++;
+	return;
+    }
+
+    TaskContext sc;
+    SQLValue val = parser.expression()->evaluate(sc);
+    SQLValue pval = parser.program()->evaluate(sc);
+
+    cout << "expression '" << s << "' evaluated to '" << val.asString() << "'"
+	 << endl;
+
+    if (!val.isException() || val.asString().find(message) == string::npos ||
+	!pval.isException() || pval.asString() != val.asString())
+    {
+	cout << "Error should have been '" << message << "'" << endl;
+	total_errors++;
+    }
 }
 
 int main()
@@ -90,5 +164,23 @@ int main()
 
     run_expression("x*x + y*y", new SQLIntegerValue(25));
 
+    // Integer division that would trap. Constants are folded when parsed.
+    run_exception("x / 0", "Division by zero");
+    run_exception("5 / 0", "Division by zero");
+    run_exception("m / -1", "Integer overflow in division");
+    run_exception("(-2147483647 - 1) / -1", "Integer overflow in division");
+    run_expression("m / 1", SQLValue::makeInteger(INT_MIN));
+
+    // A list of constants is held in a set for each type of operand
+    run_expression("x in ('3', 5)", SQLValue::makeBoolean(true));
+    run_expression("x in (3.0, 5)", SQLValue::makeBoolean(true));
+    run_exception("x in ('a', 3)", "Mismatched types in list expression");
+
+    // Application defined values are compared by their rep
+    run_expression("red = blue", SQLValue::makeBoolean(false));
+    run_expression("blue < red", SQLValue::makeBoolean(true));
+    run_expression("red = 'red'", SQLValue::makeBoolean(true));
+    run_exception("red + blue", "Illegal");
+
     return total_errors;
 }
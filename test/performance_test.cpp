@@ -12,6 +12,10 @@
 #include "SQLParse.h"
 #include "SQLExpression.h"
 #include "SQLContext.h"
+#include "SQLObjectContext.h"
+#include "SQLProgram.h"
+#include "SQLSchema.h"
+#include "SQLParseCache.h"
 
 #include <iostream>
 #include <sstream>
@@ -19,9 +23,39 @@
 #include <sys/time.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <new>
+#include <vector>
 
 using namespace std;
 
+// Count the calls to the global allocator so we can check that evaluating
+// a query does not allocate once it has reached a steady state.
+static unsigned long num_allocations = 0;
+static unsigned long steady_state_allocations = 0;
+
+void *operator new(size_t size)
+{
+    num_allocations++;
+
+    void *p = malloc(size);
+    if (p == 0)
+	throw bad_alloc();
+
+    return p;
+}
+
+void operator delete(void *p) throw()
+{
+    free(p);
+}
+
+#if __cpp_sized_deallocation
+void operator delete(void *p, size_t) throw()
+{
+    free(p);
+}
+#endif
+
 struct Shift
 {
 #if SQL_DATE_SUPPORT
@@ -32,11 +66,15 @@ struct Shift
     string status;
     string unit;
     string level;
+    string description;
+    int hours;
 };
 
 const int max_shifts = 100000;
 
 static Shift **shifts;
+static SQLSchema schema;
+static SQLObjectContext<Shift> object_context;
 
 void make_shifts()
 {
@@ -80,6 +118,9 @@ void make_shifts()
 	ss << "Unit " << (rand() % 4) + 1;
 	s->unit = ss.str();
 
+	// Long enough that the value is held on the heap
+	s->description = "Rostered shift in " + s->unit;
+
 	res = rand() % 3;
 	switch(res)
 	{
@@ -95,7 +136,29 @@ void make_shifts()
 	default:
 	    assert(0);
 	}
+
+	s->hours = rand() % 10;
     }
+
+#if SQL_DATE_SUPPORT
+    schema.addField("start", SQLDateTimeType);
+    schema.addField("end", SQLDateTimeType);
+#endif
+    schema.addField("status", SQLStringType);
+    schema.addField("unit", SQLStringType);
+    schema.addField("level", SQLStringType);
+    schema.addField("description", SQLStringType);
+    schema.addField("hours", SQLIntegerType);
+
+#if SQL_DATE_SUPPORT
+    object_context.dateTimeField("start", &Shift::start)
+		  .dateTimeField("end", &Shift::end);
+#endif
+    object_context.field("status", &Shift::status)
+		  .field("unit", &Shift::unit)
+		  .field("level", &Shift::level)
+		  .field("description", &Shift::description)
+		  .field("hours", &Shift::hours);
 }
 
 // Define the lookup context
@@ -106,6 +169,13 @@ public:
     virtual SQLValue variableLookup(const string &class_name,
 				    const string &member_name) const;
     Shift *shift_;
+
+protected:
+    enum Slot { START, END, STATUS, UNIT, LEVEL, DESCRIPTION, HOURS };
+
+    virtual int resolveSlot(const string &class_name,
+			    const string &member_name) const;
+    virtual SQLValue fetchSlot(int slot) const;
 };
 
 SQLValue ShiftContext::variableLookup(const string &class_name,
@@ -113,21 +183,74 @@ SQLValue ShiftContext::variableLookup(const string &class_name,
 {
 #if SQL_DATE_SUPPORT
     if (member_name == "start")
-	return new SQLDateTimeValue(shift_->start);
+	return SQLValue::makeDateTime(shift_->start);
     else if (member_name == "end")
-	return new SQLDateTimeValue(shift_->end);
+	return SQLValue::makeDateTime(shift_->end);
 #endif
+    // The strings live as long as the shift so do not need to be copied
     if (member_name == "status")
-	return new SQLStringValue(shift_->status);
+	return SQLValue::makeBorrowedString(shift_->status);
     else if (member_name == "unit")
-	return new SQLStringValue(shift_->unit);
+	return SQLValue::makeBorrowedString(shift_->unit);
     else if (member_name == "level")
-	return new SQLStringValue(shift_->level);
+	return SQLValue::makeBorrowedString(shift_->level);
+    else if (member_name == "description")
+	return SQLValue::makeString(shift_->description);
+    else if (member_name == "hours")
+	return SQLValue::makeInteger(shift_->hours);
     else
 	// If no match then pass evaluation onto other context if any
 	return SQLContext::variableLookup(class_name, member_name);
 }
 
+int ShiftContext::resolveSlot(const string &class_name,
+			      const string &member_name) const
+{
+#if SQL_DATE_SUPPORT
+    if (member_name == "start")
+	return START;
+    else if (member_name == "end")
+	return END;
+#endif
+    if (member_name == "status")
+	return STATUS;
+    else if (member_name == "unit")
+	return UNIT;
+    else if (member_name == "level")
+	return LEVEL;
+    else if (member_name == "description")
+	return DESCRIPTION;
+    else if (member_name == "hours")
+	return HOURS;
+    else
+	return NEXT_IN_CHAIN;
+}
+
+SQLValue ShiftContext::fetchSlot(int slot) const
+{
+    switch (slot)
+    {
+#if SQL_DATE_SUPPORT
+    case START:
+	return SQLValue::makeDateTime(shift_->start);
+    case END:
+	return SQLValue::makeDateTime(shift_->end);
+#endif
+    case STATUS:
+	return SQLValue::makeBorrowedString(shift_->status);
+    case UNIT:
+	return SQLValue::makeBorrowedString(shift_->unit);
+    case LEVEL:
+	return SQLValue::makeBorrowedString(shift_->level);
+    case DESCRIPTION:
+	return SQLValue::makeString(shift_->description);
+    case HOURS:
+	return SQLValue::makeInteger(shift_->hours);
+    default:
+	return SQLContext::fetchSlot(slot);
+    }
+}
+
 double diff(struct timeval &end, struct timeval &start)
 {
     double d = end.tv_sec * 1000.0 + (double)end.tv_usec/1.0E3;
@@ -191,6 +314,142 @@ int run_query(const string &s)
 
     cout << "Query took " << diff(end, start) << " milliseconds" << endl;
 
+    // The same query compiled to a program
+    SQLProgram *p = parser.program();
+
+    gettimeofday(&start, 0);
+
+    int program_count = 0;
+
+    for(int i = 0; i < max_shifts; i++)
+    {
+	sc.shift_ = shifts[i];
+
+	SQLValue v = p->evaluate(sc);
+
+	if (!v.isNull() && !v.isException() && v.asBoolean())
+	    program_count++;
+    }
+
+    gettimeofday(&end, 0);
+
+    cout << "Program took " << diff(end, start) << " milliseconds" << endl;
+
+    assert(program_count == count);
+
+    // The same query specialised for the declared types
+    SQLParse typed_parser;
+    typed_parser.setSchema(&schema);
+    bool typed = typed_parser.parse(s);
+    assert(typed);
+    SQLExpression *te = typed_parser.expression();
+
+    gettimeofday(&start, 0);
+
+    int typed_count = 0;
+
+    for(int i = 0; i < max_shifts; i++)
+    {
+	sc.shift_ = shifts[i];
+
+	SQLValue v = te->evaluate(sc);
+
+	if (!v.isNull() && !v.isException() && v.asBoolean())
+	    typed_count++;
+    }
+
+    gettimeofday(&end, 0);
+
+    cout << "Typed query took " << diff(end, start) << " milliseconds" << endl;
+
+    assert(typed_count == count);
+
+    // The typed query with its variables resolved to slots of the context
+    SQLParse resolved_parser;
+    resolved_parser.setSchema(&schema);
+    resolved_parser.setContext(&sc);
+    bool resolved = resolved_parser.parse(s);
+    assert(resolved);
+    SQLProgram *rp = resolved_parser.program();
+
+    gettimeofday(&start, 0);
+
+    int resolved_count = 0;
+
+    for(int i = 0; i < max_shifts; i++)
+    {
+	sc.shift_ = shifts[i];
+
+	SQLValue v = rp->evaluate(sc);
+
+	if (!v.isNull() && !v.isException() && v.asBoolean())
+	    resolved_count++;
+    }
+
+    gettimeofday(&end, 0);
+
+    cout << "Resolved program took " << diff(end, start)
+	 << " milliseconds" << endl;
+
+    assert(resolved_count == count);
+
+    // The same with the members of the shift read by an object context
+    SQLParse object_parser;
+    object_parser.setSchema(&schema);
+    object_parser.setContext(&object_context);
+    bool object_parsed = object_parser.parse(s);
+    assert(object_parsed);
+    SQLProgram *op = object_parser.program();
+
+    gettimeofday(&start, 0);
+
+    int object_count = 0;
+
+    for(int i = 0; i < max_shifts; i++)
+    {
+	object_context.setObject(shifts[i]);
+
+	SQLValue v = op->evaluate(object_context);
+
+	if (!v.isNull() && !v.isException() && v.asBoolean())
+	    object_count++;
+    }
+
+    gettimeofday(&end, 0);
+
+    cout << "Object program took " << diff(end, start)
+	 << " milliseconds" << endl;
+
+    assert(object_count == count);
+
+    // Evaluate again now the type conversion caches and the SQLPool are
+    // filled to check that the steady state does not allocate.
+    unsigned long allocations = num_allocations;
+#if SQL_COUNT_REFERENCES
+    unsigned long references = SQLValue::referenceOperations();
+#endif
+
+    for(int i = 0; i < max_shifts; i++)
+    {
+	sc.shift_ = shifts[i];
+
+	SQLValue v = e->evaluate(sc);
+	SQLValue rv = rp->evaluate(sc);
+
+	object_context.setObject(shifts[i]);
+	SQLValue ov = op->evaluate(object_context);
+    }
+
+    allocations = num_allocations - allocations;
+    steady_state_allocations += allocations;
+
+    cout << "Query made " << allocations << " allocations" << endl;
+#if SQL_COUNT_REFERENCES
+    references = SQLValue::referenceOperations() - references;
+    cout << "Query made " << (double)references / max_shifts
+	 << " reference count operations per row" << endl;
+#endif
+
     cout << "Query '" << s << "' match " << count << " records out of "
 	 << max_shifts << endl;
     cout << endl;
@@ -234,6 +493,104 @@ int run_hard_query1(const string &status,
 }
 #endif
 
+// Compare converting a Real to an Integer directly with the string
+// round trip that typeConvert() used to do.
+void run_conversion_benchmark()
+{
+    struct timeval start;
+    struct timeval end;
+
+    SQLValue int_value = SQLValue::makeInteger(0);
+
+    gettimeofday(&start, 0);
+
+    long long sum = 0;
+    for(int i = 0; i < max_shifts; i++)
+    {
+	SQLValue v = SQLValue::makeReal(i + 0.5);
+	v.typeConvert(int_value);
+	sum += v.asInteger();
+    }
+
+    gettimeofday(&end, 0);
+
+    cout << "Native conversion took " << diff(end, start)
+	 << " milliseconds" << endl;
+
+    gettimeofday(&start, 0);
+
+    long long string_sum = 0;
+    for(int i = 0; i < max_shifts; i++)
+    {
+	SQLValue v = SQLValue::makeReal(i + 0.5);
+	SQLValue s = SQLValue::makeString(v.asString());
+	s.typeConvert(int_value);
+	string_sum += s.asInteger();
+    }
+
+    gettimeofday(&end, 0);
+
+    cout << "String conversion took " << diff(end, start)
+	 << " milliseconds" << endl;
+    cout << endl;
+
+    assert(sum == string_sum);
+}
+
+// Parse the same filter with different literals each time and then look
+// it up in a cache where all of them share one expression.
+void run_parse_benchmark()
+{
+    struct timeval start;
+    struct timeval end;
+    const int num_parses = 10000;
+    const char *status[4] = { "O", "L", "W", "T" };
+
+    vector<string> queries;
+    for(int i = 0; i < num_parses; i++)
+    {
+	stringstream s;
+	s << "status = '" << status[i % 4] << "' and hours > " << i % 8;
+	queries.push_back(s.str());
+    }
+
+    gettimeofday(&start, 0);
+
+    int parse_count = 0;
+    for(int i = 0; i < num_parses; i++)
+    {
+	SQLParse parser;
+	if (parser.parse(queries[i]))
+	    parse_count++;
+    }
+
+    gettimeofday(&end, 0);
+
+    cout << "Parsing " << num_parses << " queries took "
+	 << diff(end, start) << " milliseconds" << endl;
+
+    SQLParseCache cache;
+
+    gettimeofday(&start, 0);
+
+    int cache_count = 0;
+    for(int i = 0; i < num_parses; i++)
+    {
+	SQLCachedQuery query;
+	if (cache.lookup(queries[i], query))
+	    cache_count++;
+    }
+
+    gettimeofday(&end, 0);
+
+    cout << "Cached lookup of " << num_parses << " queries took "
+	 << diff(end, start) << " milliseconds" << endl;
+    cout << endl;
+
+    assert(parse_count == num_parses && cache_count == num_parses);
+    assert(cache.misses() == 1 && cache.hits() == (unsigned long)num_parses - 1);
+}
+
 int main()
 {
 #if SQL_DATE_SUPPORT
@@ -256,6 +613,58 @@ int main()
 
     assert(r1 + r2 + r4 + r5 == max_shifts);
 
+    // Mixed type queries. The first is converted once per query, the
+    // others convert a value on every row.
+    run_conversion_benchmark();
+
+    run_parse_benchmark();
+
+    int m1 = run_query("hours > 3.5");
+    int m2 = run_query("3.5 < hours");
+
+    assert(m1 == m2);
+
+    int l1 = run_query("unit like 'Unit 1'");
+    int l2 = run_query("unit = 'Unit 1'");
+
+    assert(l1 == l2);
+
+    int m3 = run_query("hours in (2.0, 4.0, 6.0)");
+    int m4 = run_query("hours in (2, 4, 6)");
+
+    assert(m3 == m4);
+
+    // A long list of codes of which only two match any shift
+    stringstream codes;
+    codes << "unit in (";
+    for (int i = 0; i < 2000; i++)
+	codes << "'Unit " << i * 2 + 1 << "', ";
+    codes << "'Unit 3')";
+
+    int i1 = run_query(codes.str());
+    int i2 = run_query("unit = 'Unit 1' or unit = 'Unit 3'");
+
+    assert(i1 == i2);
+
+    // The selective test is tried first whichever way the query is written
+    int c1 = run_query("level like '%a%o%r' and unit like '%3' and hours = 3");
+    int c2 = run_query("hours = 3 and unit like '%3' and level like '%a%o%r'");
+
+    assert(c1 == c2);
+
+    int f1 = run_query("sqrt(hours) > 2");
+    int f2 = run_query("hours > 4");
+
+    assert(f1 == f2);
+
+    // Long strings are reference counted as they are passed around. The
+    // lookup copies the string so this query is expected to allocate.
+    unsigned long allocations = steady_state_allocations;
+    int d1 = run_query("description = 'Rostered shift in Unit 1'");
+    steady_state_allocations = allocations;
+
+    assert(d1 == l2);
+
 #if SQL_DATE_SUPPORT
     // Find all the ASOs in unit one who are on duty at 1200.
     string s =
@@ -280,5 +689,7 @@ int main()
     assert(r6 == r7);
 #endif
 
+    assert(steady_state_allocations == 0);
+
     return 0;
 }
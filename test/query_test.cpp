@@ -11,8 +11,16 @@
 #include "SQLParse.h"
 #include "SQLExpression.h"
 #include "SQLContext.h"
+#include "SQLObjectContext.h"
+#include "SQLParameters.h"
+#include "SQLParseCache.h"
+#include "SQLPredicate.h"
+#include "SQLProgram.h"
+#include "SQLReferences.h"
+#include "SQLSchema.h"
 
 #include <iostream>
+#include <pthread.h>
 
 using namespace std;
 
@@ -29,6 +37,7 @@ struct Task
 
 static int max_tasks = 10;
 static Task **tasks;
+static SQLSchema schema;
 
 int total_errors = 0;
 
@@ -64,6 +73,14 @@ void make_tasks()
 				   "7remark", "8remark", "" };
 	t->remark = remark[i % 10];
     }
+
+#if SQL_DATE_SUPPORT
+    schema.addField("start", SQLDateTimeType);
+    schema.addField("end", SQLDateTimeType);
+#endif
+    schema.addField("status", SQLStringType);
+    schema.addField("crews", SQLIntegerType);
+    schema.addField("remark", SQLStringType);
 }
 
 // Define the lookup context
@@ -103,6 +120,11 @@ SQLValue TaskContext::variableLookup(const string &class_name,
 	return SQLContext::variableLookup(class_name, member_name);
 }
 
+// Queries found through the caches share an expression with the earlier
+// queries that differ only in their literals
+static SQLParseCache query_cache;
+static SQLParseCache typed_cache;
+
 int run_query(const string &s,
               int expected_count,
 	      bool expect_exception = false,
@@ -119,6 +141,31 @@ int run_query(const string &s,
 
     SQLExpression *e = parser.expression();
 
+    // With the declared types the query either gives the same results or
+    // fails to parse where it would generate an exception
+    SQLParse typed_parser;
+    typed_parser.setSchema(&schema);
+    bool typed = typed_parser.parse(s);
+    if (!typed)
+    {
+	cout << "query '" << s << "' has type errors: "
+	     << typed_parser.errorString();
+	if (!expect_exception)
+	    total_errors++;
+    }
+
+    // The cached queries must parse and give the same results as the
+    // queries parsed on their own
+    SQLCachedQuery cached;
+    SQLCachedQuery typed_cached;
+    if (!query_cache.lookup(s, cached) ||
+	typed_cache.lookup(s, typed_cached) != typed)
+    {
+	cout << "query '" << s << "' did not parse the same from the cache"
+	     << endl;
+	total_errors++;
+    }
+
     int true_count = 0;
     int null_count = 0;
 
@@ -131,6 +178,40 @@ int run_query(const string &s,
 
 	SQLValue v = e->evaluate(sc);
 
+	// The compiled program must agree with the tree
+	SQLValue pv = parser.program()->evaluate(sc);
+	if (pv.type() != v.type() || pv.asString() != v.asString())
+	{
+	    cout << "query '" << s << "' program evaluated to '"
+		 << pv.asString() << "' not '" << v.asString() << "'" << endl;
+	    total_errors++;
+	}
+
+	SQLValue cv = cached.evaluate(sc);
+	SQLValue tcv = typed ? typed_cached.evaluate(sc) : v;
+	if (cv.type() != v.type() || cv.asString() != v.asString() ||
+	    tcv.type() != v.type() || tcv.asString() != v.asString())
+	{
+	    cout << "query '" << s << "' from the cache evaluated to '"
+		 << cv.asString() << "' and '" << tcv.asString() << "' not '"
+		 << v.asString() << "'" << endl;
+	    total_errors++;
+	}
+
+	if (typed)
+	{
+	    SQLValue tv = typed_parser.expression()->evaluate(sc);
+	    SQLValue tpv = typed_parser.program()->evaluate(sc);
+	    if (tv.type() != v.type() || tv.asString() != v.asString() ||
+		tpv.type() != v.type() || tpv.asString() != v.asString())
+	    {
+		cout << "query '" << s << "' with a schema evaluated to '"
+		     << tv.asString() << "' not '" << v.asString() << "'"
+		     << endl;
+		total_errors++;
+	    }
+	}
+
 	if (v.isException())
 	{
 	    cout << "query '" << s << "' generated an exception '"
@@ -179,6 +260,1129 @@ int run_query(const string &s,
     return true_count;
 }
 
+// Check the tree built with the declared types
+void check_tree(const string &s, const string &expected)
+{
+    SQLParse parser;
+    parser.setSchema(&schema);
+    parser.parse(s);
+
+    string tree = parser.expression()->asString();
+    cout << "query '" << s << "' typed as " << tree << endl;
+
+    if (tree != expected)
+    {
+	cout << "Should be " << expected << endl;
+	total_errors++;
+    }
+}
+
+// Count the tasks matching a parsed expression with the bound parameters
+int count_matches(SQLParse &parser, bool &got_exception)
+{
+    TaskContext sc;
+    int count = 0;
+
+    got_exception = false;
+
+    for(int i = 0; i < max_tasks; i++)
+    {
+	sc.task_ = tasks[i];
+
+	SQLValue v = parser.expression()->evaluate(sc);
+	SQLValue pv = parser.program()->evaluate(sc);
+	if (pv.type() != v.type() || pv.asString() != v.asString())
+	{
+	    cout << "program evaluated to '" << pv.asString() << "' not '"
+		 << v.asString() << "'" << endl;
+	    total_errors++;
+	}
+
+	if (v.isException())
+	    got_exception = true;
+	else if (!v.isNull() && v.asBoolean())
+	    count++;
+    }
+
+    return count;
+}
+
+void check_count(SQLParse &parser, const string &what, int expected,
+		 bool expect_exception = false)
+{
+    bool got_exception;
+    int count = count_matches(parser, got_exception);
+
+    cout << "query '" << what << "' matched " << count << " tasks" << endl;
+
+    if (got_exception != expect_exception || count != expected)
+    {
+	cout << "Did not get the expected match count " << expected << endl;
+	total_errors++;
+    }
+}
+
+// Parse once and evaluate with different parameter values
+void test_parameters()
+{
+    SQLParse parser;
+    if (!parser.parse("status = :status and crews > ?") ||
+	parser.numParameters() != 2 ||
+	parser.parameterIndex("status") != 0 ||
+	parser.parameterName(1) != "")
+    {
+	cout << "Parameters not parsed" << endl;
+	total_errors++;
+	return;
+    }
+
+    check_count(parser, "unbound parameters", 0, true);
+
+    parser.bind("status", SQLValue::makeString("Driving"));
+    parser.bind(1, SQLValue::makeInteger(2));
+    check_count(parser, "status = 'Driving' and crews > 2", 2);
+
+    parser.bind(1, SQLValue::makeString("4"));
+    check_count(parser, "status = 'Driving' and crews > '4'", 2);
+
+    parser.bind("status", SQLValue::makeString("Shunting"));
+    check_count(parser, "status = 'Shunting' and crews > '4'", 1);
+
+    if (parser.bind("missing", SQLValue()) || parser.bind(2, SQLValue()))
+    {
+	cout << "Bound a parameter that does not exist" << endl;
+	total_errors++;
+    }
+
+    // A container bound to the list of 'in'
+    parser.parse("crews in :codes or remark in :codes");
+    vector<int> codes;
+    codes.push_back(2);
+    codes.push_back(5);
+    codes.push_back(7);
+    parser.bindList("codes", codes.begin(), codes.end());
+    check_count(parser, "crews in (2, 5, 7)", 3);
+
+    codes.push_back(9);
+    parser.bindList("codes", codes.begin(), codes.end());
+    check_count(parser, "crews in (2, 5, 7, 9)", 4);
+
+    // Long lists are searched through a hashed set
+    for (int i = 1; i <= 16; i++)
+	codes.push_back(-i);
+    parser.bindList("codes", codes.begin(), codes.end());
+    check_count(parser, "crews in (2, 5, 7, 9, -1, ..., -16)", 4);
+
+    parser.parse("status not in ?");
+    const char *status[] = { "Driving", "Shunting" };
+    parser.bindList(0, status, status + 2);
+    check_count(parser, "status not in ('Driving', 'Shunting')", 5);
+
+    parser.bind(0, SQLValue::makeString("Travelling"));
+    check_count(parser, "status not in ('Travelling')", 8);
+
+    // A value that does not convert only raises an exception when it is
+    // reached, as with a list of constants
+    parser.parse("crews in ?");
+    SQLValue mixed[] = { SQLValue::makeInteger(1),
+			 SQLValue::makeString("abc") };
+    parser.bindList(0, mixed, mixed + 2);
+    check_count(parser, "crews in (1, 'abc')", 1, true);
+
+    // Each context may have its own values
+    parser.parse("crews < :max");
+    parser.bind("max", SQLValue::makeInteger(3));
+
+    SQLParameters *other = new SQLParameters;
+    other->getRef();
+    other->bind(0, SQLValue::makeInteger(6));
+
+    TaskContext sc;
+    sc.setParameters(other);
+    int count = 0;
+    for(int i = 0; i < max_tasks; i++)
+    {
+	sc.task_ = tasks[i];
+	if (parser.program()->evaluate(sc).asBoolean())
+	    count++;
+    }
+    other->releaseRef();
+
+    cout << "query 'crews < 6' matched " << count << " tasks" << endl;
+    if (count != 5)
+	total_errors++;
+    check_count(parser, "crews < 3", 2);
+
+    // The expression keeps its values after the parser has gone
+    SQLParse *p = new SQLParse;
+    p->parse("crews = ?");
+    p->bind(0, SQLValue::makeInteger(4));
+    SQLExpression *e = p->expression();
+    e->getRef();
+    delete p;
+
+    sc.setParameters(0);
+    sc.task_ = tasks[3];
+    if (!e->evaluate(sc).asBoolean())
+    {
+	cout << "Parameter value lost with the parser" << endl;
+	total_errors++;
+    }
+    e->releaseRef();
+}
+
+// Build the binary expressions a chain replaced, in the written order
+SQLExpression *written_order(SQLLogicChainExpression *chain)
+{
+    bool is_and = string(chain->shortName()) == "And";
+    SQLExpression *e = chain->operandNumber(0);
+
+    for (int i = 1; i < chain->numOperands(); i++)
+    {
+	if (is_and)
+	    e = new SQLAndExpression(e, chain->operandNumber(i));
+	else
+	    e = new SQLOrExpression(e, chain->operandNumber(i));
+    }
+
+    e->getRef();
+
+    return e;
+}
+
+// Evaluate a chain many times so that it is sampled and reordered, checking
+// every result against the written order. Returns the operand tried first.
+int check_chain(const string &s, int operands, const SQLSchema *typed = 0)
+{
+    SQLParse parser;
+    if (typed != 0)
+	parser.setSchema(typed);
+    if (!parser.parse(s))
+    {
+	cout << "Could not parse " << s << endl;
+	total_errors++;
+	return -1;
+    }
+
+    // Repeated variables are shared below the root
+    SQLExpression *root = parser.expression();
+    SQLCommonScopeExpression *scope =
+	dynamic_cast<SQLCommonScopeExpression *>(root);
+    if (scope != 0)
+	root = scope->operand();
+
+    SQLLogicChainExpression *chain =
+	dynamic_cast<SQLLogicChainExpression *>(root);
+    if (chain == 0 || chain->numOperands() != operands)
+    {
+	cout << "query '" << s << "' is not a chain of " << operands
+	     << " operands: " << parser.expression()->asString() << endl;
+	total_errors++;
+	return -1;
+    }
+
+    SQLExpression *reference = written_order(chain);
+    TaskContext sc;
+    int errors = 0;
+
+    for (int n = 0; n < 2000; n++)
+    {
+	for (int i = 0; i < max_tasks; i++)
+	{
+	    sc.task_ = tasks[i];
+
+	    SQLValue v = parser.program()->evaluate(sc);
+	    SQLValue rv = reference->evaluate(sc);
+	    if (v.type() != rv.type() || v.asString() != rv.asString())
+	    {
+		if (errors++ == 0)
+		    cout << "query '" << s << "' evaluated to '" << v.asString()
+			 << "' not '" << rv.asString() << "'" << endl;
+	    }
+	}
+    }
+
+    reference->releaseRef();
+
+    cout << "query '" << s << "' tries operand "
+	 << chain->evaluationOrder(0) << " first" << endl;
+
+    if (errors > 0)
+	total_errors++;
+
+    return chain->evaluationOrder(0);
+}
+
+void test_chains()
+{
+    check_chain("crews > 2 and status = 'Driving' and remark is not null", 3);
+    check_chain("crews = 3 or status = 'Driving' or remark = 'r5'", 3);
+    check_chain("(crews > 2 and crews < 9) and (remark = 'Rem3' and crews > 1)",
+		4);
+
+    // Nulls and exceptions give the same results as the written order
+    check_chain("crews > 2 and null_value = 'x' and status != 'Driving'", 3);
+    check_chain("crews > 7 and xxx = 1 and status = 'Driving'", 3);
+    check_chain("xxx = 1 or crews > 7 or null_value = 'x'", 3);
+    check_chain("crews > 7 or xxx = 1 or status = 'Driving'", 3);
+    check_chain("remark like 'R%' and crews < 5", 2);
+
+    // A chain on the right of an OR is kept so only its first operand
+    // passes exceptions through
+    check_chain("crews = 1 or (crews = 2 or xxx = 1)", 2);
+
+    // Without a schema the comparisons may fail to convert so are kept
+    if (check_chain("crews > 0 and crews = 3", 2) != 0)
+    {
+	cout << "An operand was moved ahead of one that may raise" << endl;
+	total_errors++;
+    }
+
+    // The operand that decides the result is moved first
+    if (check_chain("crews > 0 and crews = 3", 2, &schema) != 1)
+    {
+	cout << "The selective operand was not moved first" << endl;
+	total_errors++;
+    }
+    if (check_chain("crews < 0 or crews != 3", 2, &schema) != 1)
+    {
+	cout << "The selective operand was not moved first" << endl;
+	total_errors++;
+    }
+}
+
+// A division that raises only for a rare row must not be hidden by a more
+// selective operand being moved ahead of it
+void test_rare_exception()
+{
+    const string s = "10 / (crews - 1) > 0 and status = 'Driving'";
+
+    SQLParse parser;
+    parser.setSchema(&schema);
+    if (!parser.parse(s))
+    {
+	cout << "Could not parse " << s << endl;
+	total_errors++;
+	return;
+    }
+
+    // None of these rows divide by zero and few have the status
+    TaskContext sc;
+    for (int n = 0; n < 2000; n++)
+    {
+	for (int i = 1; i < max_tasks; i++)
+	{
+	    sc.task_ = tasks[i];
+	    parser.program()->evaluate(sc);
+	}
+    }
+
+    Task rare = *tasks[3];
+    rare.crews = 1;
+    sc.task_ = &rare;
+
+    SQLValue v = parser.program()->evaluate(sc);
+    if (!v.isException())
+    {
+	cout << "query '" << s << "' hid the exception for a rare row and "
+	     << "evaluated to '" << v.asString() << "'" << endl;
+	total_errors++;
+    }
+}
+
+// Count the variables looked up for each row
+class CountingContext
+: public TaskContext
+{
+public:
+    CountingContext() : lookups(0) { ; }
+
+    virtual SQLValue variableLookup(const string &class_name,
+				    const string &member_name) const
+    {
+	lookups++;
+	return TaskContext::variableLookup(class_name, member_name);
+    }
+
+    mutable int lookups;
+};
+
+// Check the matches and the variables looked up for each task
+void check_lookups(const string &s, int expected_count, int expected_lookups)
+{
+    SQLParse parser;
+    if (!parser.parse(s))
+    {
+	cout << "Could not parse " << s << endl;
+	total_errors++;
+	return;
+    }
+
+    CountingContext sc;
+    int count = 0;
+    int program_count = 0;
+    int tree_lookups = 0;
+    int program_lookups = 0;
+
+    for (int i = 0; i < max_tasks; i++)
+    {
+	sc.task_ = tasks[i];
+
+	sc.lookups = 0;
+	SQLValue v = parser.expression()->evaluate(sc);
+	if (!v.isNull() && !v.isException() && v.asBoolean())
+	    count++;
+	tree_lookups += sc.lookups;
+
+	sc.lookups = 0;
+	v = parser.program()->evaluate(sc);
+	if (!v.isNull() && !v.isException() && v.asBoolean())
+	    program_count++;
+	program_lookups += sc.lookups;
+    }
+
+    cout << "query '" << s << "' matched " << count << " tasks with "
+	 << tree_lookups << " lookups" << endl;
+
+    if (count != expected_count || program_count != expected_count ||
+	tree_lookups != expected_lookups ||
+	program_lookups != expected_lookups)
+    {
+	cout << "Should match " << expected_count << " tasks with "
+	     << expected_lookups << " lookups" << endl;
+	total_errors++;
+    }
+}
+
+void test_common()
+{
+    // Both sides of a between compare the same variable
+    check_lookups("crews between 2 and 4", 3, 10);
+    check_lookups("crews not between 2 and 4", 7, 10);
+    check_lookups("crews + 1 > 3 and crews + 2 < 8", 3, 10);
+    check_lookups("sqrt(crews) > 1 and sqrt(crews) < 2", 2, 10);
+    check_lookups("status = 'Driving' xor status = 'Shunting'", 5, 10);
+    check_lookups("crews > 5 xor remark is null", 5, 20);
+
+    // Only structurally equal expressions are shared
+    check_lookups("crews = 2", 1, 10);
+    check_lookups("remark like 'R%' or remark like 'r%'", 6, 10);
+
+    // A shared exception is returned from every occurrence
+    check_lookups("xxx > 1 or xxx < 1", 0, 10);
+
+    // The tree is shown without the shared nodes, and the operands of an
+    // 'or' are bound as those of an 'and' are
+    check_tree("crews + 1 > 3 or crews + 1 < 2",
+	       "Or(IntegerGreaterThan(Operation(crews + 1), 3), "
+	       "IntegerLessThan(Operation(crews + 1), 2))");
+}
+
+// Provides the crews and status of a task by slot and counts the fetches
+class SlotContext
+: public SQLContext
+{
+public:
+    SlotContext() : fetches(0) { ; }
+
+    Task *task_;
+    mutable int fetches;
+
+protected:
+    enum { CREWS, STATUS };
+
+    virtual int resolveSlot(const string &class_name,
+			    const string &member_name) const
+    {
+	if (member_name == "crews")
+	    return CREWS;
+	else if (member_name == "status")
+	    return STATUS;
+	else
+	    return NEXT_IN_CHAIN;
+    }
+
+    virtual SQLValue fetchSlot(int slot) const
+    {
+	fetches++;
+
+	switch (slot)
+	{
+	case CREWS:
+	    return SQLValue::makeInteger(task_->crews);
+	case STATUS:
+	    return SQLValue::makeBorrowedString(task_->status);
+	default:
+	    return SQLContext::fetchSlot(slot);
+	}
+    }
+};
+
+// A context further down the chain with one variable
+class DepotContext
+: public SQLContext
+{
+protected:
+    virtual int resolveSlot(const string &class_name,
+			    const string &member_name) const
+    {
+	return member_name == "depot" ? 0 : NEXT_IN_CHAIN;
+    }
+
+    virtual SQLValue fetchSlot(int slot) const
+    {
+	return SQLValue::makeString("North");
+    }
+};
+
+// Evaluate a query resolved for a chain of contexts and count the variables
+// fetched by slot and looked up by name
+void check_slots(const string &s, SQLContext &context, SlotContext &sc,
+		 CountingContext &cc, int expected_count,
+		 int expected_fetches, int expected_lookups)
+{
+    SlotContext resolver;
+    DepotContext depot;
+    CountingContext names;
+    resolver.chain(&depot);
+    depot.chain(&names);
+
+    SQLParse parser;
+    parser.setContext(&resolver);
+    if (!parser.parse(s))
+    {
+	cout << "Could not parse " << s << endl;
+	total_errors++;
+	return;
+    }
+
+    int count = 0;
+    int program_count = 0;
+    sc.fetches = 0;
+    cc.lookups = 0;
+
+    for (int i = 0; i < max_tasks; i++)
+    {
+	sc.task_ = tasks[i];
+	cc.task_ = tasks[i];
+
+	SQLValue v = parser.expression()->evaluate(context);
+	if (!v.isNull() && !v.isException() && v.asBoolean())
+	    count++;
+
+	v = parser.program()->evaluate(context);
+	if (!v.isNull() && !v.isException() && v.asBoolean())
+	    program_count++;
+    }
+
+    cout << "query '" << s << "' matched " << count << " tasks with "
+	 << sc.fetches << " fetches and " << cc.lookups << " lookups" << endl;
+
+    if (count != expected_count || program_count != expected_count ||
+	sc.fetches != expected_fetches || cc.lookups != expected_lookups)
+    {
+	cout << "Should match " << expected_count << " tasks with "
+	     << expected_fetches << " fetches and " << expected_lookups
+	     << " lookups" << endl;
+	total_errors++;
+    }
+}
+
+void test_slots()
+{
+    SlotContext sc;
+    DepotContext depot;
+    CountingContext cc;
+    sc.chain(&depot);
+    depot.chain(&cc);
+
+    // Variables of each context in the chain are fetched by slot and the
+    // rest looked up by name
+    check_slots("crews > 5 xor remark is null", sc, sc, cc, 5, 20, 20);
+    check_slots("depot = 'North' xor crews > 5", sc, sc, cc, 5, 20, 0);
+    check_slots("status = 'Driving' xor xxx = 1", sc, sc, cc, 0, 20, 20);
+
+    // Another class of context looks every variable up by name
+    CountingContext other;
+    check_slots("crews > 5 xor remark is null", other, sc, other, 5, 0, 40);
+
+    // Unknown variables are errors when every context provides slots
+    SlotContext alone;
+    SQLParse unknown_parser;
+    unknown_parser.setContext(&alone);
+    if (unknown_parser.parse("crews = 1 or xxx = 1 or xxx > 2") ||
+	unknown_parser.numErrors() != 1 ||
+	unknown_parser.errorString().find("Unknown variable 'xxx'") ==
+	string::npos)
+    {
+	cout << "Unknown variable not reported: "
+	     << unknown_parser.errorString() << endl;
+	total_errors++;
+    }
+
+    // but not when a context in the chain looks them up by name
+    unknown_parser.setContext(&sc);
+    if (!unknown_parser.parse("crews = 1 or xxx = 1"))
+	total_errors++;
+
+    // A context that only provides slots still gives its variables by name
+    SQLParse parser;
+    parser.parse("crews > 5 xor depot = 'North'");
+    sc.task_ = tasks[0];
+    if (parser.program()->evaluate(sc).asBoolean() != true)
+	total_errors++;
+}
+
+static SQLValue task_remark(const Task &t)
+{
+    if (t.remark.empty())
+	return SQLValue();
+    else
+	return SQLValue::makeBorrowedString(t.remark);
+}
+
+// An object context must give the same results as the hand written one
+void test_object_context()
+{
+    SQLObjectContext<Task> oc;
+#if SQL_DATE_SUPPORT
+    oc.dateTimeField("start", &Task::start)
+      .dateTimeField("end", &Task::end);
+#endif
+    oc.field("status", &Task::status)
+      .field("crews", &Task::crews)
+      .field("remark", task_remark, SQLStringType);
+
+    SQLSchema object_schema;
+    oc.addFields(object_schema);
+
+    const char *queries[] =
+    {
+	"crews = 10", "crews between 2 and 4", "status = 'Driving'",
+	"remark like 'Rem%'", "remark is null", "crews * 2 > 10",
+	"crews > 5 and remark is not null", "crews in (1, 2, 3)", "xxx = 1",
+#if SQL_DATE_SUPPORT
+	"start > '03:00 1/12/2010'"
+#endif
+    };
+    int num_queries = sizeof(queries) / sizeof(queries[0]);
+
+    TaskContext tc;
+
+    for (int q = 0; q < num_queries; q++)
+    {
+	SQLParse parser;
+	parser.parse(queries[q]);
+
+	SQLParse object_parser;
+	object_parser.setSchema(&object_schema);
+	object_parser.setContext(&oc);
+	object_parser.parse(queries[q]);
+
+	for (int i = 0; i < max_tasks; i++)
+	{
+	    tc.task_ = tasks[i];
+	    oc.setObject(tasks[i]);
+
+	    SQLValue v = parser.program()->evaluate(tc);
+	    SQLValue ov = object_parser.program()->evaluate(oc);
+	    SQLValue nv = parser.program()->evaluate(oc);
+	    if (ov.type() != v.type() || ov.asString() != v.asString() ||
+		nv.type() != v.type() || nv.asString() != v.asString())
+	    {
+		cout << "object query '" << queries[q] << "' evaluated to '"
+		     << ov.asString() << "' not '" << v.asString() << "'"
+		     << endl;
+		total_errors++;
+		break;
+	    }
+	}
+    }
+
+    // Variables of another class are passed down the chain
+    SQLObjectContext<Task> classed("task");
+    classed.field("crews", &Task::crews);
+    classed.chain(&tc);
+    classed.setObject(tasks[3]);
+    tc.task_ = tasks[1];
+
+    SQLParse parser;
+    parser.setContext(&classed);
+    parser.parse("task.crews = 4 and other.crews = 2");
+    if (!parser.program()->evaluate(classed).asBoolean())
+	total_errors++;
+
+#if __cplusplus >= 201103L
+    SQLObjectContext<Task> lc;
+    lc.field("busy", [](const Task &t) {
+	    return SQLValue::makeBoolean(t.crews > 5);
+	}, SQLBooleanType);
+    lc.setObject(tasks[7]);
+    parser.setContext(&lc);
+    parser.parse("busy");
+    if (!parser.program()->evaluate(lc).asBoolean())
+	total_errors++;
+#endif
+}
+
+// Show the usage of each variable as a string such as "crews:ER status:P"
+string usage_string(const SQLReferences &refs)
+{
+    string s;
+
+    for (size_t i = 0; i < refs.variables().size(); i++)
+    {
+	const SQLVariableReference &v = refs.variables()[i];
+
+	if (!s.empty())
+	    s += " ";
+	s += v.name() + ":";
+	if (v.usage & SQLVariableReference::Equality)
+	    s += "E";
+	if (v.usage & SQLVariableReference::Range)
+	    s += "R";
+	if (v.usage & SQLVariableReference::Pattern)
+	    s += "P";
+	if (v.usage & SQLVariableReference::Other)
+	    s += "O";
+    }
+
+    for (size_t i = 0; i < refs.functions().size(); i++)
+	s += " " + refs.functions()[i] + "()";
+
+    return s;
+}
+
+void check_references(const string &s, bool typed, const string &expected)
+{
+    SQLParse parser;
+    if (typed)
+	parser.setSchema(&schema);
+    parser.parse(s);
+
+    SQLReferences refs;
+    SQLExpression::findReferences(parser.expression(), refs);
+
+    string found = usage_string(refs);
+    cout << "query '" << s << "' references " << found << endl;
+
+    if (found != expected)
+    {
+	cout << "Should be " << expected << endl;
+	total_errors++;
+    }
+}
+
+void test_references()
+{
+    for (int typed = 0; typed < 2; typed++)
+    {
+	check_references("crews = 1", typed, "crews:E");
+	check_references("crews != 1 or status in ('a', 'b')", typed,
+			 "crews:E status:E");
+	check_references("crews between 2 and 4", typed, "crews:R");
+	check_references("crews > 2 and status <= 'D'", typed,
+			 "crews:R status:R");
+	check_references("remark like 'Rem%' or remark is null", typed,
+			 "remark:PO");
+	check_references("sqrt(crews) > 1 and crews = 4", typed,
+			 "crews:EO sqrt()");
+	check_references("crews + 1 > 3 or crews + 1 < 2", typed, "crews:O");
+	check_references("task.crews = other.crews", typed,
+			 "task.crews:E other.crews:E");
+	check_references("1 = 1", typed, "");
+    }
+
+    // Functions of constants are evaluated when parsed
+    check_references("crews = abs(-1) and foo(status)", false,
+		     "crews:E status:O foo()");
+}
+
+// Accepts the predicates on some variables and keeps them to select the
+// rows as a data source would
+class VariableHandler
+: public SQLPredicateHandler
+{
+public:
+    VariableHandler(const string &v) : variables(" " + v + " ") { ; }
+
+    ~VariableHandler()
+    {
+	for (size_t i = 0; i < accepted.size(); i++)
+	    accepted[i]->releaseRef();
+    }
+
+    virtual bool accept(const SQLPredicate &p)
+    {
+	if (!offered.empty())
+	    offered += "; ";
+	offered += p.asString();
+
+	if (variables.find(" " + p.name() + " ") == string::npos)
+	    return false;
+
+	p.expression->getRef();
+	accepted.push_back(p.expression);
+	return true;
+    }
+
+    bool selects(SQLContext &context)
+    {
+	for (size_t i = 0; i < accepted.size(); i++)
+	    if (!accepted[i]->evaluate(context).asBoolean())
+		return false;
+
+	return true;
+    }
+
+    string variables;
+    string offered;
+    vector<SQLExpression *> accepted;
+};
+
+void check_pushdown(const string &s, bool typed, const string &accept,
+		    const string &expected_offered,
+		    const string &expected_residual)
+{
+    SQLParse parser;
+    if (typed)
+	parser.setSchema(&schema);
+    parser.parse(s);
+
+    SQLParse pushed;
+    if (typed)
+	pushed.setSchema(&schema);
+    pushed.parse(s);
+
+    VariableHandler handler(accept);
+    pushed.pushDown(handler);
+
+    string residual = pushed.expression()->asString();
+    cout << "query '" << s << "' offered " << handler.offered
+	 << " leaving " << residual << endl;
+
+    if (handler.offered != expected_offered || residual != expected_residual)
+    {
+	cout << "Should offer " << expected_offered << " leaving "
+	     << expected_residual << endl;
+	total_errors++;
+    }
+
+    TaskContext tc;
+    for (int i = 0; i < max_tasks; i++)
+    {
+	tc.task_ = tasks[i];
+
+	bool matched = parser.program()->evaluate(tc).asBoolean();
+	bool selected = handler.selects(tc);
+	bool pushed_matched = selected &&
+	    pushed.program()->evaluate(tc).asBoolean() &&
+	    pushed.expression()->evaluate(tc).asBoolean();
+
+	if (matched != pushed_matched)
+	{
+	    cout << "task " << i << " matched " << matched << " not "
+		 << pushed_matched << endl;
+	    total_errors++;
+	    break;
+	}
+    }
+}
+
+void test_pushdown()
+{
+    check_pushdown("crews > 2 and status = 'Driving' and remark is not null",
+		   false, "crews",
+		   "crews > 2; status = Driving",
+		   "And(Equals(status, Driving), Not(Null(remark)))");
+    check_pushdown("crews > 2 and status = 'Driving' and remark is not null",
+		   true, "crews",
+		   "crews > 2; status = Driving",
+		   "And(StringEquals(status, Driving), Not(Null(remark)))");
+    check_pushdown("3 < crews and 'Driving' != status", false, "crews status",
+		   "crews > 3; status != Driving", "True");
+    check_pushdown("crews between 2 and 8 and remark like 'Rem%'", true,
+		   "remark", "crews >= 2; crews <= 8; remark like Rem%",
+		   "Range(crews, [2, 8])");
+
+    // Strings compared without case are offered as such
+    SQLStringValue::setCaseInsensitive(true);
+    check_pushdown("remark like 'rem%' and status = 'driving' and crews > 0",
+		   true, "remark status crews",
+		   "remark like rem% ignoring case; "
+		   "status = driving ignoring case; crews > 0", "True");
+    SQLStringValue::setCaseInsensitive(false);
+    check_pushdown("crews between 2 and 8 and remark like 'Rem%'", true,
+		   "crews", "crews >= 2; crews <= 8; remark like Rem%",
+		   "Like(remark, Rem%)");
+    check_pushdown("crews in (1, 2, 3) and remark is null", false, "crews",
+		   "crews in (1, 2, 3); remark is null", "Null(remark)");
+    check_pushdown("crews in (1, 2, 3) or status = 'Travelling'", false,
+		   "crews status", "",
+		   "Or(In(crews, {1, 2, 3}), Equals(status, Travelling))");
+    check_pushdown("crews + 1 > 3 and status = 'Shunting' and crews + 1 < 9",
+		   false, "status", "status = Shunting",
+		   "And(GreaterThan(Operation(crews + 1), 3), "
+		   "LessThan(Operation(crews + 1), 9))");
+}
+
+void check_normalise(const string &s, const string &expected)
+{
+    string key = SQLParseCache::normalise(s);
+    cout << "query '" << s << "' normalised to '" << key << "'" << endl;
+
+    if (key != expected)
+    {
+	cout << "Should be '" << expected << "'" << endl;
+	total_errors++;
+    }
+}
+
+// Queries from the cache must give the same results as parsing them
+void test_cache()
+{
+    check_normalise("status='O'", "status = ?");
+    check_normalise("  STATUS = \"L\"  AND crews>2", "STATUS = ? and crews > ?");
+    check_normalise("crews Between 1 and 3", "crews between ? and ?");
+    check_normalise("crews in (1, -2, 3.5)", "crews in ?");
+    check_normalise("crews in (1, crews)", "crews in ( ? , crews )");
+    check_normalise("remark NOT like 'Rem%' escape 'X'",
+		    "remark not like 'Rem%' escape 'X'");
+    check_normalise("a-b != true", "a-b != ?");
+    check_normalise("ip << 10.0.0.0/8 or ip = fe80::1", "ip << ? or ip = ?");
+    check_normalise("crews = ? and status = 'O'", "crews = ? and status = 'O'");
+    check_normalise("'don\\'t' = x", "? = x");
+
+    const char *queries[] =
+    {
+	"crews = 10", "crews=10", "CREWS = 3", "crews = 3",
+	"status = 'Driving'", "status='Shunting'", "crews between 2 and 4",
+	"crews between 5 and 9", "crews in (1, 2, 3)", "crews in ('4', '5')",
+	"crews not in (4, 5)", "remark like 'Rem%'", "remark like 'Rem%'",
+	"remark like '%k'", "crews > 5 or null_value = 'fred'",
+	"crews * 2 > 10", "crews * 3 > 10", "5 = 'abc'", "crews in (1, crews)",
+	"1 + 2 = crews", "not (crews < 4)", "crews = 1 or crews = 2"
+    };
+    int num_queries = sizeof(queries) / sizeof(queries[0]);
+
+    SQLParseCache cache(8);
+    TaskContext sc;
+
+    for (int q = 0; q < num_queries; q++)
+    {
+	SQLParse parser;
+	parser.parse(queries[q]);
+
+	SQLCachedQuery query;
+	if (!cache.lookup(queries[q], query))
+	{
+	    cout << "Could not parse cached query '" << queries[q] << "' : "
+		 << query.errorString() << endl;
+	    total_errors++;
+	    continue;
+	}
+
+	for (int i = 0; i < max_tasks; i++)
+	{
+	    sc.task_ = tasks[i];
+
+	    SQLValue v = parser.program()->evaluate(sc);
+	    SQLValue cv = query.evaluate(sc);
+	    if (cv.type() != v.type() || cv.asString() != v.asString())
+	    {
+		cout << "cached query '" << queries[q] << "' evaluated to '"
+		     << cv.asString() << "' not '" << v.asString() << "'"
+		     << endl;
+		total_errors++;
+		break;
+	    }
+	}
+    }
+
+    cout << "cache hits " << cache.hits() << " misses " << cache.misses()
+	 << " evictions " << cache.evictions() << endl;
+    // Literals in arithmetic are part of the key so are still folded
+    if (cache.hits() != 6 || cache.misses() != 16 ||
+	cache.evictions() != 8 || cache.size() != 8)
+	total_errors++;
+
+    // A query keeps its expression after it has left the cache
+    SQLCachedQuery query;
+    cache.lookup("crews < 3", query);
+    cache.clear();
+    sc.task_ = tasks[0];
+    if (cache.size() != 0 || !query.evaluate(sc).asBoolean())
+	total_errors++;
+
+    // Errors are for the text as it was given
+    if (cache.lookup("crews = 'abc", query) || query.errorString().empty())
+	total_errors++;
+    if (cache.lookup("crews < < 3", query) || query.errorString().empty())
+	total_errors++;
+
+    // The memory of a 'like' pattern is freed as soon as it is parsed and
+    // may hold a later literal, which must not be taken for the pattern
+    const char *patterns[] =
+    {
+	"aaaaaaaaaaaaaaaaaaaaaaa", "Rem%", "%k", "aaaaaaaaaaaaaaaaaaaaaab",
+	"r_", "%emark%", "Rem%"
+    };
+    int num_patterns = sizeof(patterns) / sizeof(patterns[0]);
+
+    SQLParseCache like_cache;
+    for (int n = 0; n < 3; n++)
+    {
+	for (int q = 0; q < num_patterns; q++)
+	{
+	    string s = string("remark like '") + patterns[q] +
+		"' and crews > 1 + 2";
+	    check_normalise(s, string("remark like '") + patterns[q] +
+			    "' and crews > 1 + 2");
+
+	    SQLParse parser;
+	    parser.parse(s);
+
+	    if (!like_cache.lookup(s, query))
+	    {
+		cout << "Could not parse cached query '" << s << "'" << endl;
+		total_errors++;
+		continue;
+	    }
+
+	    for (int i = 0; i < max_tasks; i++)
+	    {
+		sc.task_ = tasks[i];
+
+		SQLValue v = parser.program()->evaluate(sc);
+		SQLValue cv = query.evaluate(sc);
+		if (cv.type() != v.type() || cv.asString() != v.asString())
+		{
+		    cout << "cached query '" << s << "' evaluated to '"
+			 << cv.asString() << "' not '" << v.asString() << "'"
+			 << endl;
+		    total_errors++;
+		    break;
+		}
+	    }
+	}
+    }
+
+    if (like_cache.misses() != num_patterns - 1)
+    {
+	cout << "like patterns gave " << like_cache.misses()
+	     << " cache entries" << endl;
+	total_errors++;
+    }
+}
+
+// Queries shared between threads. The long strings are held on the heap
+// so copying them updates a shared reference count.
+static const char *thread_queries[] =
+{
+    "status in ('Driving', 'Shunting', 'A status too long to hold inline')",
+    "crews in ('1', 2, 3.0) or remark = 'A remark too long to hold inline'",
+    "crews > 2 and status != 'Driving' and remark like '%k%'",
+    "crews * 2 > 10 or remark is null or crews / (crews - 4) > 1",
+    "status like 'XD.*g' escape 'X' and crews < 8",
+    "(remark + ' and a suffix to make it long') like 'Rem%suffix%'"
+};
+static const int num_thread_queries =
+    sizeof(thread_queries) / sizeof(thread_queries[0]);
+
+enum { NUM_THREADS = 4, THREAD_ROUNDS = 200 };
+
+struct ThreadTest
+{
+    SQLParseCache *cache;
+    SQLParse *parsers;
+    const vector<string> *expected;
+    int errors;
+};
+
+static void *evaluate_queries(void *arg)
+{
+    ThreadTest *t = (ThreadTest *)arg;
+    TaskContext sc;
+
+    for (int r = 0; r < THREAD_ROUNDS; r++)
+    {
+	for (int q = 0; q < num_thread_queries; q++)
+	{
+	    SQLCachedQuery query;
+	    t->cache->lookup(thread_queries[q], query);
+	    SQLParse &parser = t->parsers[q];
+
+	    for (int i = 0; i < max_tasks; i++)
+	    {
+		sc.task_ = tasks[i];
+		const string &expected = (*t->expected)[q * max_tasks + i];
+
+		if (query.evaluate(sc).asString() != expected ||
+		    parser.expression()->evaluate(sc).asString() != expected ||
+		    parser.program()->evaluate(sc).asString() != expected)
+		    t->errors++;
+	    }
+
+	    // Finding the references only reads the shared expressions
+	    SQLReferences refs;
+	    SQLExpression::findReferences(parser.expression(), refs);
+	    SQLExpression::findReferences(query.expression(), refs);
+	}
+    }
+
+    return 0;
+}
+
+// Evaluate the same expressions from several threads at once, both shared
+// by the cache and parsed once, and check they give the same results as
+// when evaluated by one thread.
+void test_threads()
+{
+    SQLParseCache cache(num_thread_queries / 2);
+    SQLParse parsers[num_thread_queries];
+    vector<string> expected;
+    TaskContext sc;
+
+    for (int q = 0; q < num_thread_queries; q++)
+    {
+	if (!parsers[q].parse(thread_queries[q]))
+	{
+	    cout << "Could not parse '" << thread_queries[q] << "'" << endl;
+	    total_errors++;
+	    return;
+	}
+
+	for (int i = 0; i < max_tasks; i++)
+	{
+	    sc.task_ = tasks[i];
+	    expected.push_back(parsers[q].program()->evaluate(sc).asString());
+	}
+    }
+
+    ThreadTest tests[NUM_THREADS];
+    pthread_t threads[NUM_THREADS];
+
+    for (int n = 0; n < NUM_THREADS; n++)
+    {
+	tests[n].cache = &cache;
+	tests[n].parsers = parsers;
+	tests[n].expected = &expected;
+	tests[n].errors = 0;
+	pthread_create(&threads[n], 0, evaluate_queries, &tests[n]);
+    }
+
+    int errors = 0;
+    for (int n = 0; n < NUM_THREADS; n++)
+    {
+	pthread_join(threads[n], 0);
+	errors += tests[n].errors;
+    }
+
+    cout << "threads evaluated queries with " << errors << " errors" << endl;
+    if (errors != 0)
+	total_errors++;
+}
+
 int main()
 {
 #if SQL_DATE_SUPPORT
@@ -187,6 +1391,7 @@ int main()
 #endif
 
     make_tasks();
+    typed_cache.setSchema(&schema);
 
 #if SQL_DATE_SUPPORT
     run_query("start between '05:00 1/12/2010' and '7:00 1/12/2010'",
@@ -209,6 +1414,33 @@ int main()
     run_query("crews not in (4, 5)", 8);
     // The escape here turns the expression into a regular expression
     run_query("crews like 'X[1-3]' escape 'X'", 3);
+    run_query("status like 'Driving'", 3);
+    run_query("status like 'Tra%'", 2);
+    run_query("status like '%ing'", 7);
+    run_query("status like '%ell%'", 5);
+    run_query("status like '%'", 10);
+    run_query("status like 'M%c%s'", 3);
+    run_query("status like '_r%ing'", 5);
+    run_query("status like 'S%n%n%g'", 2);
+    run_query("status like 'S%n%n%n%g'", 0);
+    run_query("status like '%i_g'", 7);
+    run_query("remark like '%remark'", 2);
+    // Regular expression characters have no special meaning
+    run_query("status like 'Dr.ving'", 0);
+    run_query("status like 'Driv(ing)?'", 0);
+    run_query("status like 'Driving|Shunting'", 0);
+
+    SQLStringValue::setCaseInsensitive(true);
+    run_query("status like 'driving'", 3);
+    run_query("status like '%ELL%'", 5);
+    run_query("status like 'm%C%S'", 3);
+    run_query("status like 'dX[a-z]+' escape 'X'", 3);
+    SQLStringValue::setCaseInsensitive(false);
+    run_query("status like 'driving'", 0);
+    run_query("status like 'dX[a-z]+' escape 'X'", 0);
+    // A regular expression that does not compile raises an exception
+    run_query("status like 'X[a-' escape 'X'", 0, true);
+
     run_query("crews != 3 and crews != 4", 8);
     run_query("crews = 5 or crews = 7", 2);
     run_query("crews < 5", 4);
@@ -255,6 +1487,34 @@ int main()
     run_query("null_value and crews > 5", 0, false, true);
     run_query("crews > 5 and null_value", 0, false, true);
 
+    // Type errors are found when parsing with a schema
+    run_query("crews = 'abc'", 0, true);
+    run_query("status within 10.0.0.0/8", 0, true);
+
+    check_tree("crews < 5", "IntegerLessThan(crews, 5)");
+    check_tree("crews = '5'", "IntegerEquals(crews, 5)");
+    check_tree("status != 'Driving'", "StringNotEquals(status, Driving)");
+    check_tree("crews between 2 and 4", "Range(crews, [2, 4])");
+    check_tree("crews < 4 and crews > 2", "Range(crews, (2, 4))");
+    check_tree("crews < 4 and status > 'A'",
+	       "And(IntegerLessThan(crews, 4), StringGreaterThan(status, A))");
+    check_tree("null_value = 5", "Equals(null_value, 5)");
+#if SQL_DATE_SUPPORT
+    check_tree("start >= '05:00 01/12/2010'",
+	       "DateTimeGreaterEquals(start, 05:00 01/12/2010)");
+#endif
+
+    test_parameters();
+    test_cache();
+    test_chains();
+    test_rare_exception();
+    test_common();
+    test_slots();
+    test_object_context();
+    test_references();
+    test_pushdown();
+    test_threads();
+
     cout << "Found a total of " << total_errors << " errors" << endl;
 
     return total_errors;